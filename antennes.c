@@ -17,19 +17,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <strings.h>
 #include <limits.h>
+#include <math.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <err.h>
+#include <errno.h>
 #include <string.h>
 #include <stdarg.h>
 #include <ctype.h>
 #include <time.h>
 #include <libgen.h>
+#include <getopt.h>
 
 #include "utils.h"
 
@@ -49,6 +57,7 @@ struct sta_nm {
 #define NATURE_ID_MAX 100
 struct f_nature {
 	struct csv csv;
+	struct arena arena;
 	struct nature *table[NATURE_ID_MAX];
 	int count;
 };
@@ -58,24 +67,33 @@ struct nature {
 	char *nat_lb_nom;
 };
 
-#define SUPPORTS_ID_MAX 4 * 1000 * 1000
+/* supports are indexed by sup_id, and sorted by sup_id once loaded.
+ * 'grid' locates them by coordinates, with their position in 'index' */
 struct f_support {
 	struct csv csv;
-	struct support *table[SUPPORTS_ID_MAX];
+	struct arena arena;
+	struct idx index;
 	int count;
+	struct csr stations; /* station names of each support */
+	struct geo_grid grid;
+};
+
+/* spatial queries of supports */
+enum {
+	GEO_QUERY_NONE,
+	GEO_QUERY_BBOX,
+	GEO_QUERY_NEAR,
+	GEO_QUERY_KNN,
 };
 
-#define SUPPORT_STA_MAX 100
 #define SUPPORT_DESCRIPTION_BUF_SIZE 131072
 #define SUPPORT_CP_DEPT_MAX 0x99 /* departement INSEE */
 struct support {
 	int sup_id;
-	struct sta_nm sta_nm_anfr[SUPPORT_STA_MAX];
+	struct sta_nm **sta_nm_anfr; /* slice of f_support 'stations' */
 	int nat_id;
 	int lat_dms[3];
-	char *lat_ns;
 	int lon_dms[3];
-	char *lon_ew;
 	int sup_nm_haut;
 	int tpo_id;
 	char *adr_lb_lieu;
@@ -96,6 +114,7 @@ struct support {
 #define PROPRIETAIRE_ID_MAX 100
 struct f_proprietaire {
 	struct csv csv;
+	struct arena arena;
 	struct proprio *table[PROPRIETAIRE_ID_MAX];
 	int count;
 };
@@ -108,6 +127,7 @@ struct proprio {
 #define EXPLOITANT_ID_MAX 500
 struct f_exploitant {
 	struct csv csv;
+	struct arena arena;
 	struct exploitant *table[EXPLOITANT_ID_MAX];
 	int count;
 };
@@ -127,47 +147,45 @@ struct exploitant {
  * |  dept |  zone |   id    |
  * ---------------------------
  * STA_NM_ANFR is mapped to sta_nm structure
- * storage is in f_station:
+ * storage is in f_station, allocated from its arena:
  * - 'dept' are indexed in a pointer table 'depts'.
  * - 'zone' are indexed in a pointer table 'zones' per 'dept'.
  * - 'id' are indexed in in a pointer table 'stations' as an array of pointers to all possible stations for a given 'dept' and 'zone'.
  */
 
-#define STATION_EMETTEUR_MAX 500
-#define STATION_ANTENNE_MAX 100
 #define SYSTEMES_ID_MAX 100
 struct station {
 	struct sta_nm sta_nm;
 	int adm_id;
 	char *dem_nm_consis_str;
-	struct tm dte_implemntatation;
+	int32_t dte_implemntatation; /* day number, see DAY_NONE */
 	char *dte_implemntatation_str;
-	struct tm dte_modif;
+	int32_t dte_modif;
 	char *dte_modif_str;
-	struct tm dte_en_service;
+	int32_t dte_en_service;
 	char *dte_en_service_str;
 	/* computed */
-	struct tm dte_latest; /* most recent date from the above */
+	int32_t dte_latest; /* most recent date from the above */
 	/* references */
-	struct emetteur *emetteurs[STATION_EMETTEUR_MAX];
+	struct emetteur **emetteurs; /* slice of f_emetteur 'station_emetteurs' */
 	int emetteur_count;
-	int systeme_count[SYSTEMES_ID_MAX];
-	struct antenne *antennes[STATION_ANTENNE_MAX];
+	struct antenne **antennes; /* slice of f_antenne 'station_antennes' */
 	int antenne_count;
 };
 
 /* station id is 4 decimal digits */
 #define STATION_ID_MAX 10*10*10*10
-struct station_zone {
-	struct station *stations[STATION_ID_MAX];
-	int station_count;
-};
 
 /* zones are from sta_nm character 3 to 5, max value of 465 as of 202101 is obtained by:
  * $ cut -d';' -f1 SUP_STATION.txt |cut -c 4-6 |sort -n |tail -n1 */
 #define STATION_ZONE_MAX 600
+
+/* stations of a departement are indexed by zone and id, see STATION_KEY(), as only a few thousands of the
+ * STATION_ZONE_MAX * STATION_ID_MAX possible names are in use */
+#define STATION_KEY(nm) ((nm)->zone * STATION_ID_MAX + (nm)->id)
 struct station_dept {
-	struct station_zone *zones[STATION_ZONE_MAX];
+	struct idx stations;
+	uint8_t zones[STATION_ZONE_MAX+1]; /* 1 for the zones in use */
 	int zone_count;
 };
 
@@ -176,78 +194,133 @@ struct station_dept {
 #define STATION_DEPT_MAX 0x999
 struct f_station {
 	struct csv csv;
+	struct arena arena; /* stations, departements and zones */
 	struct station_dept *depts[STATION_DEPT_MAX];
 	int id_count;
 	int station_count;
 	int dept_count;
 	int zone_count;
-	struct tm latest; /* latest station update date */
+	int32_t latest; /* latest station update date */
+	int32_t future; /* earliest station update date more recent than now, which 'latest' depends on */
+	int has_future;
 };
 
 /* emetteurs have an integer id, max value of 20308500 as of 20220729 obtained by:
- * $ cut -d';' -f1 SUP_EMETTEUR.txt |sort -n |tail -n1 */
-#define EMETTEUR_ID_MAX 40000000
+ * $ cut -d';' -f1 SUP_EMETTEUR.txt |sort -n |tail -n1
+ * but only 1953886 are in use, so they are indexed by emr_id instead of using a table of all possible ids */
 struct f_emetteur {
 	struct csv csv;
-	struct emetteur *table[EMETTEUR_ID_MAX];
+	struct arena arena;
+	struct idx index;
 	int count;
-	char *systemes_lb[SYSTEMES_ID_MAX]; /* index for the different values of emr_lb_systeme */
+	struct dict systemes; /* different values of emr_lb_systeme, coded by order of appearance */
 	int systemes_count[SYSTEMES_ID_MAX];
-	int systeme_count;
+	struct csr station_emetteurs;
+	struct csr antenne_emetteurs;
 };
 
-#define EMETTEUR_BAND_MAX 70
 struct emetteur {
 	int emr_id;
 	char *emr_id_str;
-	char *emr_lb_systeme;
-	int systeme_id;
+	uint8_t systeme_id; /* code of emr_lb_systeme */
 	struct sta_nm sta_nm;
 	int aer_id;
-	struct tm emr_dt_service;
 	char *emr_dt_service_str;
-	struct bande *bandes[EMETTEUR_BAND_MAX];
+	struct bande **bandes; /* slice of f_bande 'emetteur_bandes' */
 	int bande_count;
 };
 
+/* frequencies of all bandes stored by columns, for scans over millions of bandes.
+ * rows are in the order of f_bande 'emetteur_bandes', so the bandes of an emetteur are contiguous,
+ * starting at emetteur_bandes_pos() */
+#define BANDE_FILL_CHUNK 16384 /* emetteurs per task filling the columns */
+struct bande_columns {
+	uint64_t *f_deb; /* Hz */
+	uint64_t *f_fin;
+	int *emr_pos; /* position of the emetteur in f_emetteur 'index' */
+	int count;
+};
+struct bande_fill {
+	struct f_bande *bandes;
+	struct f_emetteur *emetteurs;
+};
+
 /* bandes have an integer id, max value of 45214227 as of 20220729 obtained by:
- * $ cut -d';' -f2 tmp/extract/SUP_BANDE.txt |sort -n |tail -n1 */
-#define BANDE_ID_MAX 100000000
+ * $ cut -d';' -f2 tmp/extract/SUP_BANDE.txt |sort -n |tail -n1
+ * but only 3897941 are in use, so they are indexed by ban_id */
 struct f_bande {
 	struct csv csv;
-	struct bande *table[BANDE_ID_MAX];
+	struct arena arena;
+	struct idx index;
 	int count;
+	struct dict unites; /* different values of ban_fg_unite */
+	struct csr emetteur_bandes;
+	struct bande_columns columns;
 };
 
 struct bande {
 	struct sta_nm sta_nm;
 	int ban_id;
 	int emr_id;
-	uint64_t ban_nb_f_deb;
 	char *ban_nb_f_deb_str;
-	uint64_t ban_nb_f_fin;
 	char *ban_nb_f_fin_str;
-	char *ban_fg_unite;
+	uint8_t ban_fg_unite; /* code in f_bande 'unites' */
 };
-/* used when computing bands per exploitant */
-struct bande_tree {
-	int emr_count;
+/* used when computing bands per exploitant: bands are aggregated by frequencies in a hash table,
+ * with their emetteur count per systeme in a list of counters */
+struct bande_count {
 	uint64_t ban_nb_f_deb;
-	char *ban_nb_f_deb_str;
 	uint64_t ban_nb_f_fin;
-	char *ban_nb_f_fin_str;
-	int systemes_count[SYSTEMES_ID_MAX];
-	struct bande_tree *next; /* band with higher ban_nb_f_deb, or same ban_nb_f_deb and higher ban_nb_f_fin */
+	int emr_count; /* 0 for an empty slot */
+	int systemes; /* first counter in bande_agg 'counters' */
+};
+
+struct bande_systeme {
+	int systeme_id;
+	int count;
+	int next; /* next counter of the same band, or -1 */
+};
+
+#define BANDE_AGG_SIZE_MIN 1024
+struct bande_agg {
+	struct station **stations; /* stations of the exploitant, once per support listing them */
+	int stations_count;
+	int stations_alloc;
+	struct bande_count *table;
+	int size; /* power of 2 */
+	int count;
+	struct bande_systeme *counters;
+	int counters_count;
+	int counters_alloc;
+};
+
+/* state of output_bands() */
+struct bande_output {
+	struct anfr_set *set;
+	const char *output_dir;
+	struct bande_agg aggs[EXPLOITANT_ID_MAX];
+};
+
+/* state of output_frequencies() */
+#define FREQUENCY_SCAN_CHUNK 65536 /* bandes per scan task, multiple of 64 */
+struct frequency_scan {
+	struct bande_columns *cols;
+	uint64_t min;
+	uint64_t max;
+	uint64_t *bitmap; /* matching bandes */
+	int *matches; /* count of matching bandes per task */
 };
 
 /* antennes have an integer id, max value of 7878184 as of 20220729 obtained by:
- * $ cut -d';' -f2 tmp/extract/SUP_ANTENNE.txt  |sort -n |tail -n1 */
-#define ANTENNE_ID_MAX 20000000
-#define ANTENNE_EMETTEUR_MAX 50
+ * $ cut -d';' -f2 tmp/extract/SUP_ANTENNE.txt  |sort -n |tail -n1
+ * but only 552795 are in use, so they are indexed by aer_id */
 struct f_antenne {
 	struct csv csv;
-	struct antenne *table[ANTENNE_ID_MAX];
+	struct arena arena;
+	struct idx index;
 	int count;
+	struct dict rayons; /* different values of aer_fg_rayon */
+	struct csr station_antennes;
 };
 
 struct antenne {
@@ -257,13 +330,13 @@ struct antenne {
 	int tae_id;
 	float aer_nb_dimension;
 	char *aer_nb_dimension_str;
-	char *aer_fg_rayon;
+	uint8_t aer_fg_rayon; /* code in f_antenne 'rayons' */
 	float aer_nb_azimut;
 	char *aer_nb_azimut_str;
 	float aer_nb_alt_bas;
 	char *aer_nb_alt_bas_str;
 	char *sup_id_str;
-	struct emetteur *emetteurs[ANTENNE_EMETTEUR_MAX];
+	struct emetteur **emetteurs; /* slice of f_emetteur 'antenne_emetteurs' */
 	int emetteur_count;
 };
 
@@ -276,6 +349,9 @@ struct f_type_antenne {
 };
 
 struct anfr_set {
+	char *path;
+	char *snapshot; /* mapping of the snapshot the set was loaded from, or NULL */
+	size_t snapshot_size;
 	struct f_nature *natures;
 	struct f_support *supports;
 	struct f_proprietaire *proprietaires;
@@ -285,63 +361,515 @@ struct anfr_set {
 	struct f_bande *bandes;
 	struct f_antenne *antennes;
 	struct f_type_antenne *types_antenne;
+	struct support_bitmaps *bitmaps;
+};
+
+/* bitmaps of the support positions having each value of an attribute, built once loaded for --filter.
+ * bitmaps come first, to be walked as a single array of SUPPORT_BITMAPS_COUNT */
+#define SUPPORT_BITMAPS_COUNT ((int)(offsetof(struct support_bitmaps, latest) / sizeof(struct bitmap)))
+struct support_bitmaps {
+	struct bitmap exploitants[EXPLOITANT_ID_MAX];
+	struct bitmap systemes[SYSTEMES_ID_MAX];
+	struct bitmap proprietaires[PROPRIETAIRE_ID_MAX];
+	struct bitmap natures[NATURE_ID_MAX];
+	struct bitmap depts[256];
+	int32_t *latest; /* most recent station date of each support position */
+	int count;
+};
+
+/* set snapshot, written in the data directory with --snapshot and used by later runs while the input files are unchanged.
+ * snapshots are keyed by set_snapshot_layout(), from the layout of the saved records listed in SET_SNAPSHOT_FIELDS.
+ * SET_SNAPSHOT_VERSION must only be increased when saved values change meaning without changing the layout */
+#define SET_SNAPSHOT_FILE "antennes.snapshot"
+#define SET_SNAPSHOT_VERSION 1
+#define SET_FILE_COUNT 9
+struct set_stamp {
+	int64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+};
+struct set_snapshot {
+	struct set_stamp stamps[SET_FILE_COUNT]; /* input files when the set was loaded */
+	char *out; /* loading output, replayed when using the snapshot */
+	size_t out_len;
+	char *err;
+	size_t err_len;
+	int warnings;
+	struct anfr_set *set;
+};
+
+/* records saved in set snapshots, with all their fields */
+static const struct snap_field SET_SNAPSHOT_FIELDS[] = {
+	SNAP_STRUCT(struct set_snapshot),
+	SNAP_FIELD(struct set_snapshot, stamps),
+	SNAP_FIELD(struct set_snapshot, out),
+	SNAP_FIELD(struct set_snapshot, out_len),
+	SNAP_FIELD(struct set_snapshot, err),
+	SNAP_FIELD(struct set_snapshot, err_len),
+	SNAP_FIELD(struct set_snapshot, warnings),
+	SNAP_FIELD(struct set_snapshot, set),
+	SNAP_STRUCT(struct set_stamp),
+	SNAP_FIELD(struct set_stamp, size),
+	SNAP_FIELD(struct set_stamp, mtime_sec),
+	SNAP_FIELD(struct set_stamp, mtime_nsec),
+	SNAP_STRUCT(struct anfr_set),
+	SNAP_FIELD(struct anfr_set, path),
+	SNAP_FIELD(struct anfr_set, snapshot),
+	SNAP_FIELD(struct anfr_set, snapshot_size),
+	SNAP_FIELD(struct anfr_set, natures),
+	SNAP_FIELD(struct anfr_set, supports),
+	SNAP_FIELD(struct anfr_set, proprietaires),
+	SNAP_FIELD(struct anfr_set, stations),
+	SNAP_FIELD(struct anfr_set, exploitants),
+	SNAP_FIELD(struct anfr_set, emetteurs),
+	SNAP_FIELD(struct anfr_set, bandes),
+	SNAP_FIELD(struct anfr_set, antennes),
+	SNAP_FIELD(struct anfr_set, types_antenne),
+	SNAP_FIELD(struct anfr_set, bitmaps),
+	SNAP_STRUCT(struct sta_nm),
+	SNAP_FIELD(struct sta_nm, nm),
+	SNAP_FIELD(struct sta_nm, dept),
+	SNAP_FIELD(struct sta_nm, zone),
+	SNAP_FIELD(struct sta_nm, id),
+	SNAP_FIELD(struct sta_nm, str),
+	SNAP_STRUCT(struct f_nature),
+	SNAP_FIELD(struct f_nature, csv),
+	SNAP_FIELD(struct f_nature, arena),
+	SNAP_FIELD(struct f_nature, table),
+	SNAP_FIELD(struct f_nature, count),
+	SNAP_STRUCT(struct nature),
+	SNAP_FIELD(struct nature, nat_id),
+	SNAP_FIELD(struct nature, nat_lb_nom),
+	SNAP_STRUCT(struct f_support),
+	SNAP_FIELD(struct f_support, csv),
+	SNAP_FIELD(struct f_support, arena),
+	SNAP_FIELD(struct f_support, index),
+	SNAP_FIELD(struct f_support, count),
+	SNAP_FIELD(struct f_support, stations),
+	SNAP_FIELD(struct f_support, grid),
+	SNAP_STRUCT(struct support),
+	SNAP_FIELD(struct support, sup_id),
+	SNAP_FIELD(struct support, sta_nm_anfr),
+	SNAP_FIELD(struct support, nat_id),
+	SNAP_FIELD(struct support, lat_dms),
+	SNAP_FIELD(struct support, lon_dms),
+	SNAP_FIELD(struct support, sup_nm_haut),
+	SNAP_FIELD(struct support, tpo_id),
+	SNAP_FIELD(struct support, adr_lb_lieu),
+	SNAP_FIELD(struct support, adr_lb_add0),
+	SNAP_FIELD(struct support, adr_lb_add2),
+	SNAP_FIELD(struct support, adr_lb_add3),
+	SNAP_FIELD(struct support, adr_nm_cp_str),
+	SNAP_FIELD(struct support, adr_nm_cp),
+	SNAP_FIELD(struct support, com_cd_insee),
+	SNAP_FIELD(struct support, lat),
+	SNAP_FIELD(struct support, lon),
+	SNAP_FIELD(struct support, dept),
+	SNAP_FIELD(struct support, dept_name),
+	SNAP_FIELD(struct support, sta_count),
+	SNAP_STRUCT(struct f_proprietaire),
+	SNAP_FIELD(struct f_proprietaire, csv),
+	SNAP_FIELD(struct f_proprietaire, arena),
+	SNAP_FIELD(struct f_proprietaire, table),
+	SNAP_FIELD(struct f_proprietaire, count),
+	SNAP_STRUCT(struct proprio),
+	SNAP_FIELD(struct proprio, tpo_id),
+	SNAP_FIELD(struct proprio, tpo_lb),
+	SNAP_STRUCT(struct f_exploitant),
+	SNAP_FIELD(struct f_exploitant, csv),
+	SNAP_FIELD(struct f_exploitant, arena),
+	SNAP_FIELD(struct f_exploitant, table),
+	SNAP_FIELD(struct f_exploitant, count),
+	SNAP_STRUCT(struct exploitant),
+	SNAP_FIELD(struct exploitant, adm_id),
+	SNAP_FIELD(struct exploitant, adm_lb_nom),
+	SNAP_STRUCT(struct f_station),
+	SNAP_FIELD(struct f_station, csv),
+	SNAP_FIELD(struct f_station, arena),
+	SNAP_FIELD(struct f_station, depts),
+	SNAP_FIELD(struct f_station, id_count),
+	SNAP_FIELD(struct f_station, station_count),
+	SNAP_FIELD(struct f_station, dept_count),
+	SNAP_FIELD(struct f_station, zone_count),
+	SNAP_FIELD(struct f_station, latest),
+	SNAP_FIELD(struct f_station, future),
+	SNAP_FIELD(struct f_station, has_future),
+	SNAP_STRUCT(struct station_dept),
+	SNAP_FIELD(struct station_dept, stations),
+	SNAP_FIELD(struct station_dept, zones),
+	SNAP_FIELD(struct station_dept, zone_count),
+	SNAP_STRUCT(struct station),
+	SNAP_FIELD(struct station, sta_nm),
+	SNAP_FIELD(struct station, adm_id),
+	SNAP_FIELD(struct station, dem_nm_consis_str),
+	SNAP_FIELD(struct station, dte_implemntatation),
+	SNAP_FIELD(struct station, dte_implemntatation_str),
+	SNAP_FIELD(struct station, dte_modif),
+	SNAP_FIELD(struct station, dte_modif_str),
+	SNAP_FIELD(struct station, dte_en_service),
+	SNAP_FIELD(struct station, dte_en_service_str),
+	SNAP_FIELD(struct station, dte_latest),
+	SNAP_FIELD(struct station, emetteurs),
+	SNAP_FIELD(struct station, emetteur_count),
+	SNAP_FIELD(struct station, antennes),
+	SNAP_FIELD(struct station, antenne_count),
+	SNAP_STRUCT(struct f_emetteur),
+	SNAP_FIELD(struct f_emetteur, csv),
+	SNAP_FIELD(struct f_emetteur, arena),
+	SNAP_FIELD(struct f_emetteur, index),
+	SNAP_FIELD(struct f_emetteur, count),
+	SNAP_FIELD(struct f_emetteur, systemes),
+	SNAP_FIELD(struct f_emetteur, systemes_count),
+	SNAP_FIELD(struct f_emetteur, station_emetteurs),
+	SNAP_FIELD(struct f_emetteur, antenne_emetteurs),
+	SNAP_STRUCT(struct emetteur),
+	SNAP_FIELD(struct emetteur, emr_id),
+	SNAP_FIELD(struct emetteur, emr_id_str),
+	SNAP_FIELD(struct emetteur, systeme_id),
+	SNAP_FIELD(struct emetteur, sta_nm),
+	SNAP_FIELD(struct emetteur, aer_id),
+	SNAP_FIELD(struct emetteur, emr_dt_service_str),
+	SNAP_FIELD(struct emetteur, bandes),
+	SNAP_FIELD(struct emetteur, bande_count),
+	SNAP_STRUCT(struct f_bande),
+	SNAP_FIELD(struct f_bande, csv),
+	SNAP_FIELD(struct f_bande, arena),
+	SNAP_FIELD(struct f_bande, index),
+	SNAP_FIELD(struct f_bande, count),
+	SNAP_FIELD(struct f_bande, unites),
+	SNAP_FIELD(struct f_bande, emetteur_bandes),
+	SNAP_FIELD(struct f_bande, columns),
+	SNAP_STRUCT(struct bande_columns),
+	SNAP_FIELD(struct bande_columns, f_deb),
+	SNAP_FIELD(struct bande_columns, f_fin),
+	SNAP_FIELD(struct bande_columns, emr_pos),
+	SNAP_FIELD(struct bande_columns, count),
+	SNAP_STRUCT(struct bande),
+	SNAP_FIELD(struct bande, sta_nm),
+	SNAP_FIELD(struct bande, ban_id),
+	SNAP_FIELD(struct bande, emr_id),
+	SNAP_FIELD(struct bande, ban_nb_f_deb_str),
+	SNAP_FIELD(struct bande, ban_nb_f_fin_str),
+	SNAP_FIELD(struct bande, ban_fg_unite),
+	SNAP_STRUCT(struct f_antenne),
+	SNAP_FIELD(struct f_antenne, csv),
+	SNAP_FIELD(struct f_antenne, arena),
+	SNAP_FIELD(struct f_antenne, index),
+	SNAP_FIELD(struct f_antenne, count),
+	SNAP_FIELD(struct f_antenne, rayons),
+	SNAP_FIELD(struct f_antenne, station_antennes),
+	SNAP_STRUCT(struct antenne),
+	SNAP_FIELD(struct antenne, sta_nm),
+	SNAP_FIELD(struct antenne, aer_id),
+	SNAP_FIELD(struct antenne, aer_id_str),
+	SNAP_FIELD(struct antenne, tae_id),
+	SNAP_FIELD(struct antenne, aer_nb_dimension),
+	SNAP_FIELD(struct antenne, aer_nb_dimension_str),
+	SNAP_FIELD(struct antenne, aer_fg_rayon),
+	SNAP_FIELD(struct antenne, aer_nb_azimut),
+	SNAP_FIELD(struct antenne, aer_nb_azimut_str),
+	SNAP_FIELD(struct antenne, aer_nb_alt_bas),
+	SNAP_FIELD(struct antenne, aer_nb_alt_bas_str),
+	SNAP_FIELD(struct antenne, sup_id_str),
+	SNAP_FIELD(struct antenne, emetteurs),
+	SNAP_FIELD(struct antenne, emetteur_count),
+	SNAP_STRUCT(struct f_type_antenne),
+	SNAP_FIELD(struct f_type_antenne, csv),
+	SNAP_FIELD(struct f_type_antenne, table),
+	SNAP_FIELD(struct f_type_antenne, counts),
+	SNAP_FIELD(struct f_type_antenne, count),
+	SNAP_STRUCT(struct support_bitmaps),
+	SNAP_FIELD(struct support_bitmaps, exploitants),
+	SNAP_FIELD(struct support_bitmaps, systemes),
+	SNAP_FIELD(struct support_bitmaps, proprietaires),
+	SNAP_FIELD(struct support_bitmaps, natures),
+	SNAP_FIELD(struct support_bitmaps, depts),
+	SNAP_FIELD(struct support_bitmaps, latest),
+	SNAP_FIELD(struct support_bitmaps, count),
+};
+
+/* reference table loaded once by a --batch for each distinct content of its file, and shared with the processes
+ * loading the periods through set_refs. its loading output is replayed by each period */
+struct set_ref {
+	int file;
+	uint8_t digest[SHA256_LEN];
+	void *table;
+	char *out;
+	size_t out_len;
+	char *err;
+	size_t err_len;
+	int warnings;
+};
+
+/* period of a --batch, run in its own process. memory is estimated from the size of the input files, and corrected
+ * by the largest ratio of measured to estimated memory of the finished periods */
+#define BATCH_MEMORY_BASE (16LL * 1024 * 1024) /* program, thread stacks and fixed size tables of a set */
+#define BATCH_MEMORY_PER_INPUT 5 /* bytes of memory per byte of input files, measured 4.9 with -k and -b from 11 to 183MB */
+struct batch_period {
+	char *path;
+	char *name;
+	int64_t memory; /* estimated */
+	int64_t reserved; /* corrected estimation, while running */
+	pid_t pid;
+	struct timespec start;
+	double seconds;
+	long maxrss; /* kilobytes */
+	int status;
 };
 
 #define KML_ANFR_DESCRIPTION "KML export of french emetteurs bellow 5W based on ANFR data"
 
+/* state of output_kml(): placemarks are first rendered in sup_id order to a spill file,
+ * then each kml file is written document by document, referencing placemarks in the mapped spill file */
+struct kml_output {
+	struct anfr_set *set;
+	const char *output_dir;
+	const char *source_name;
+	const int *sups; /* positions of the exported supports in the supports index */
+	FILE *spill;
+	off_t spill_len;
+	char *map; /* spill file mapping, once all placemarks are rendered */
+	struct kml_placemark *placemarks; /* by support position in the supports index */
+	int *tpos; /* proprietaire of each support position */
+	int *depts; /* departement of each support position */
+	int *systemes; /* systemes ids of all supports */
+	int systemes_count;
+	int systemes_alloc;
+	int kml_count;
+};
+
+/* placemarks of a support in the spill file */
+struct kml_placemark {
+	off_t full;
+	int full_len;
+	off_t light;
+	int light_len;
+	int systemes; /* position of the support systeme ids in kml_output 'systemes' */
+	int systemes_count;
+};
+
+/* placemarks of a support, rendered in the text of its chunk */
+struct kml_rendered {
+	size_t full;
+	int full_len;
+	size_t light; /* without name and description */
+	int light_len;
+	int *systemes; /* systeme ids of the support emetteurs, in order of appearance */
+	int systemes_count;
+};
+
+/* supports rendered by a single task of output_kml() */
+#define KML_CHUNK_SUPPORTS 64
+struct kml_chunk {
+	struct kml_output *out;
+	int first; /* first support in kml_output 'sups' */
+	int count;
+	char *text;
+	size_t text_len;
+	size_t text_alloc;
+	struct kml_rendered *rendered;
+	int *systemes;
+};
+
+/* state of output_tiles(): supports are split in a quadtree of tiles over the world, down to tiles of at most
+ * TILES_SUPPORTS_MAX supports holding their placemarks. tiles above them hold clusters of their supports on a grid of
+ * TILES_CLUSTER_GRID cells per side, replaced by the tiles of the next level once these are TILES_LOD_MIN pixels wide */
+#define TILES_SUPPORTS_MAX 256
+#define TILES_DEPTH_MAX 18 /* supports at the same location are not split further */
+#define TILES_CLUSTER_GRID 4
+#define TILES_LOD_MIN 128
+struct tile_output {
+	struct kml_output *out;
+	struct manifest *manifest;
+	struct kml_region root;
+	int *tmp; /* supports being split in quadrants */
+	uint8_t *quadrants; /* quadrant of each support being split */
+	int tile_count;
+	int cluster_count;
+};
+
+/* change of a record from an older set, see output_diff() */
+enum {
+	DIFF_SAME,
+	DIFF_ADDED,
+	DIFF_REMOVED,
+	DIFF_MODIFIED,
+	DIFF_CHANGES,
+};
+enum {
+	DIFF_SUPPORTS,
+	DIFF_STATIONS,
+	DIFF_EMETTEURS,
+	DIFF_BANDES,
+	DIFF_RECORDS,
+};
+static const char *DIFF_RECORD_NAMES[DIFF_RECORDS] = {
+	"supports",
+	"stations",
+	"emetteurs",
+	"bandes",
+};
+
+/* state of output_diff(): records of the two sets are matched by id through the indexes of the older set,
+ * and compared by fingerprints computed from both sets while matching */
+#define DIFF_CHUNK 4096 /* records per diff task */
+struct set_diff {
+	struct anfr_set *old;
+	struct anfr_set *set;
+	uint8_t *sup_changes; /* change of each support position of 'set', DIFF_SAME, DIFF_ADDED or DIFF_MODIFIED */
+	uint8_t *sup_removed; /* 1 for the support positions of 'old' not in 'set' */
+	int counts[DIFF_RECORDS][DIFF_CHANGES];
+};
+
 __attribute__((__noreturn__)) void usageexit(void);
 /* input file processing */
 struct anfr_set		*set_load(char *);
+void				 set_load_file(void *);
+void				 set_finalize(struct anfr_set *);
+void				 set_finalize_stations(void *, int);
+void				 set_finalize_supports(void *, int);
+struct support_bitmaps *support_bitmaps_build(struct anfr_set *);
+void				 support_bitmaps_chunk(void *, int);
+void				 support_bitmaps_free(struct support_bitmaps *);
+void				 support_bitmaps_snapshot(struct snap *, struct support_bitmaps *);
 void				 set_free(struct anfr_set *);
+void				 set_stamps(char *, struct set_stamp *);
+struct anfr_set		*set_snapshot_load(char *, struct set_stamp *);
+void				 set_snapshot_save(struct anfr_set *, struct set_stamp *, char *, size_t, char *, size_t, int);
+void				 set_snapshot_walk(struct snap *, void *);
+uint64_t			 set_snapshot_layout(void);
 struct f_nature		*natures_load(char *);
 void				 natures_free(struct f_nature *);
+void				 natures_snapshot(struct snap *, struct f_nature *);
 const char			*nature_get_name(struct f_nature *, int);
 struct f_support	*supports_load(char *);
 void				 supports_free(struct f_support *);
+void				 supports_snapshot(struct snap *, struct f_support *);
+void				 support_sort_stations(struct f_station *, struct support *);
 struct f_proprietaire *proprietaires_load(char *);
 void				 proprietaires_free(struct f_proprietaire *);
+void				 proprietaires_snapshot(struct snap *, struct f_proprietaire *);
 const char			*proprietaire_get_name(struct f_proprietaire *, int);
 struct f_station	*stations_load(char *);
 void				 stations_free(struct f_station *);
+void				 stations_snapshot(struct snap *, struct f_station *);
 struct station		*station_get(struct f_station *, struct sta_nm *);
-struct station		*station_get_next(struct f_station *, struct sta_nm *, int, struct station *);
-int					 station_description(struct f_type_antenne *, struct station *, char *);
+struct station		*station_find(struct f_station *, struct sta_nm *);
+int					 station_cmp(struct station *, struct station *);
+void				 station_sort_references(struct station *);
+int					 station_description(struct anfr_set *, struct station *, char *);
 int					 station_systemes(struct f_emetteur *, struct station *, char *);
 struct f_exploitant	*exploitants_load(char *);
 void				 exploitants_free(struct f_exploitant *);
+void				 exploitants_snapshot(struct snap *, struct f_exploitant *);
 const char			*exploitant_get_name(struct f_exploitant *, int);
+void				 emetteurs_parse(void *, int);
 struct f_emetteur	*emetteurs_load(char *, struct f_station *, struct f_antenne *);
 void				 emetteurs_free(struct f_emetteur *);
+void				 emetteurs_snapshot(struct snap *, struct f_emetteur *);
 const char *		 emetteurs_stats(struct f_emetteur *);
 struct emetteur		*emetteur_get(struct f_emetteur *, int);
-struct emetteur		*emetteur_get_next(struct emetteur **, int, struct emetteur *);
+int					 emetteur_cmp(const void *, const void *);
+void				 bandes_parse(void *, int);
 struct f_bande		*bandes_load(char *, struct f_emetteur *);
 void				 bandes_free(struct f_bande *);
+void				 bandes_snapshot(struct snap *, struct f_bande *);
+void				 bandes_fill(void *, int);
+uint64_t			 bande_hz(char *, char);
+int					 emetteur_bandes_pos(struct f_bande *, struct emetteur *);
 struct f_antenne	*antennes_load(char *, struct f_station *);
 void				 antennes_free(struct f_antenne *);
-struct antenne		*antenne_get_next(struct antenne **, int, struct antenne *);
+void				 antennes_snapshot(struct snap *, struct f_antenne *);
+int					 antenne_cmp(const void *, const void *);
 struct f_type_antenne *types_antenne_load(char *);
 void				 types_antenne_free(struct f_type_antenne *);
+void				 types_antenne_snapshot(struct snap *, struct f_type_antenne *);
 char				*type_antenne_get(struct f_type_antenne *, int);
+/* batch */
+int					 batch_run(const char *, const char *, const char *, int, int64_t);
+__attribute__((__noreturn__)) void batch_period(struct batch_period *, const char *, const char *, int);
+struct set_ref		*batch_ref(struct set_ref ***, int *, int, const char *);
 /* output file */
-void				 output_kml(struct anfr_set *, const char *, const char *);
-void				 output_bands(struct anfr_set *, const char *, const char *);
+void				 output_kml(struct anfr_set *, const char *, const char *, const int *, int);
+void				 output_kml_render(void *);
+int					 support_style(struct anfr_set *, struct support *);
+void				 output_kml_spill(void *);
+void				 output_kml_placemarks(struct kml_output *, int);
+void				 output_kml_free(struct kml_output *);
+int					 output_kml_groups(int *, int, int *, int, int *, int *);
+void				 output_kml_doc_id(struct anfr_set *, struct anfr_set *, const char *, int, char *, size_t);
+void				 output_kml_doc(struct kml_output *, struct kml *, const char *, const char *, int *, int, int);
+void				 output_kml_release(struct kml_output *);
+void				 output_tiles(struct anfr_set *, const char *, const char *, const int *, int);
+void				 output_tiles_region(struct tile_output *, int, int, int, struct kml_region *);
+void				 output_tiles_node(struct tile_output *, int, int, int, int *, int);
+void				 output_bands(struct anfr_set *, const char *, const char *, const int *, int);
+void				 output_bands_exploitant(void *, int);
+void				 bande_agg_add(struct bande_agg *, uint64_t, uint64_t, int);
+int					 bande_count_cmp(const void *, const void *);
+int					 frequency_range_parse(const char *, uint64_t *, uint64_t *);
+int					 geo_args_parse(const char *, float *, int, int *);
+void				 output_frequencies(struct anfr_set *, uint64_t, uint64_t);
+int					*output_geo_query(struct anfr_set *, int, float [4], int, int *);
+void				 filter_value(struct anfr_set *, const char *, const char *, uint64_t *);
+int					*output_filter(struct anfr_set *, const char *, const int *, int, int *);
+void				 output_diff(struct anfr_set *, struct anfr_set *, const char *, const char *);
+void				 diff_index(struct set_diff *, int, struct idx *, struct idx *, uint64_t (*)(struct anfr_set *, void *), uint8_t *, uint8_t *, int);
+void				 diff_supports(void *, int);
+void				 diff_stations(void *, int);
+void				 diff_emetteurs(void *, int);
+void				 diff_bandes(void *, int);
+uint64_t			 support_fingerprint(struct anfr_set *, void *);
+uint64_t			 station_fingerprint(struct station *);
+uint64_t			 emetteur_fingerprint(struct anfr_set *, void *);
+uint64_t			 bande_fingerprint(struct anfr_set *, void *);
+uint64_t			 antenne_fingerprint(struct anfr_set *, void *);
+void				 frequencies_scan(void *, int);
 /* utils */
 void		 csv_stanm(struct csv *, struct sta_nm *);
 
 struct conf conf;
+struct set_ref *set_refs[SET_FILE_COUNT]; /* reference tables shared by a --batch */
 
 __attribute__((__noreturn__)) void
 usageexit()
 {
-	printf("usage: antennes [-Cv] [-b <dir>] [-k <dir>] <data_dir>\n");
+	printf("usage: antennes [-CHsv] [-b <dir>] [-F <min>-<max>] [-j <jobs>] [-k <dir>] [--gz] [--kmz] [--incremental] [--tiles] [--snapshot]\n");
+	printf("                [--bbox <lat_min>,<lon_min>,<lat_max>,<lon_max> | --near <lat>,<lon>,<meters> | --knn <lat>,<lon>,<k>]\n");
+	printf("                [--filter <expr>] [--diff <old_data_dir>] <data_dir>\n");
+	printf("       antennes [-Hsv] [-b <dir>] [-j <jobs>] [-k <dir>] [--gz] [--kmz] [--incremental] [--tiles] [--snapshot] [--memory <megabytes>]\n");
+	printf("                --batch <extract_dir>\n");
 	printf("antennes v%d, Query and export KML files from ANFR radio sites public data\n", VERSION);
 	printf("-b <dir> export csv bands statistics to this directory\n");
 	printf("-C       do not set any kml placemark colors\n");
+	printf("-F <min>-<max> list the bandes overlapping these frequencies in Hz, with optional k, M or G suffix\n");
+	printf("-H       allocate loaded records on huge pages\n");
+	printf("-j <n>   number of parallel jobs, defaults to the number of cpus\n");
 	printf("-k <dir> export kml files to this directory\n");
 	printf("-s       display antennes statistics\n");
 	printf("-v       verbose logging\n");
-	printf("if neither -s or -k are specified, this program only loads the data.\n");
+	printf("--gz     with -k, also write each kml file gzip compressed as <name>.kml.gz\n");
+	printf("--kmz    with -k, also write each kml file as a <name>.kmz archive\n");
+	printf("--incremental with -k, keep the kml files unchanged since the previous export to the same directory, and replace\n");
+	printf("         the changed ones atomically, based on the file digests stored in <dir>/%s.\n", MANIFEST_FILE);
+	printf("         kml files are named 'latest' instead of <data_dir> and are not dated. the colors of the supports still\n");
+	printf("         depend on the latest station update, so a new data set changes supports in most files\n");
+	printf("--tiles  with -k, export the supports as a super-overlay of tiles loaded by the clients as the view zooms in,\n");
+	printf("         instead of the kml files listed below\n");
+	printf("--snapshot write a snapshot of the loaded data to <data_dir>/%s, used by later runs while input files are unchanged\n", SET_SNAPSHOT_FILE);
+	printf("--bbox <lat_min>,<lon_min>,<lat_max>,<lon_max> list the supports inside this box, and export only them with -k\n");
+	printf("--near <lat>,<lon>,<meters> list the supports within this distance, nearest first, and export only them with -k\n");
+	printf("--knn <lat>,<lon>,<k> list the k nearest supports, nearest first, and export only them with -k\n");
+	printf("--filter <expr> list the supports matching <attribute>=<value>[,<value>...] terms joined by '&', and export only them\n");
+	printf("         with -k and -b. attributes are exploitant, proprietaire, nature, systeme, dept and since=<dd/mm/yyyy>\n");
+	printf("         values of a term are or-ed, terms are and-ed, and apply to the supports of a location query\n");
+	printf("--diff <old_data_dir> count the supports, stations, emetteurs and bandes added, removed and modified since this older data,\n");
+	printf("         and with -k export only the changed supports instead of all supports\n");
+	printf("--batch <extract_dir> export each period directory of <extract_dir> to <dir>/<period> with -k and -b, running periods in\n");
+	printf("         parallel processes and sharing the reference tables of the same content. output of a period is written to\n");
+	printf("         <dir>/<period>.log, and the time and memory used by each period are listed once done\n");
+	printf("--memory <megabytes> memory budget of the periods of a batch running together, defaults to half of the physical memory\n");
+	printf("if none of -s, -k, -b, -F, --filter, --diff or a location query are specified, this program only loads the data.\n");
 	printf("output kml files hierarchy:\n");
 	printf("   anfr_proprietaires.kml : all supports in a single file, one section per proprietaire\n");
 	printf("   anfr_departements.kml : all supports in a single file, one section per departement\n");
@@ -349,6 +877,17 @@ usageexit()
 	printf("   anfr_proprietaire/anfr_proprietaire_<proprietaire-id>_<proprietaire-name>.kml : one file per proprietaire\n");
 	printf("   anfr_departement/anfr_departement_<dept-id>.kml : one file per departement\n");
 	printf("   anfr_systeme/anfr_systeme_<sys-name>.kml : one file per systeme, one section per departement\n");
+	printf("output kml files with --tiles:\n");
+	printf("   anfr_tiles.kml : root tile, to open in the client, with clusters of supports linking to the next tiles\n");
+	printf("   anfr_tiles/<level>_<x>_<y>.kml : tile of a quadtree level, with the placemarks of at most %d supports or clusters\n", TILES_SUPPORTS_MAX);
+	printf("      the quadtree covers the world, x and y counted from longitude -180 and latitude -90\n");
+	printf("output kml files with --diff:\n");
+	printf("   anfr_changes.kml : changed supports, one section per added, removed and modified\n");
+	printf("   anfr_update.kml : NetworkLinkControl update of anfr_departements.kml of the older data to the newer one\n");
+	printf("      supports of departements absent from the older data are left out with a warning\n");
+	printf("kml ids:\n");
+	printf("   placemarks have the support id, documents the proprietaire or departement number, prefixed by tpo or dept\n");
+	printf("   only when a support has the same id\n");
 	printf("kml placemark colors:\n");
 	printf("   orange for supports with stations updated in less than 3 months, red for 1 month, blue otherwise\n");
 	exit(1);
@@ -357,13 +896,49 @@ usageexit()
 int
 main(int argc, char *argv[])
 {
-	struct anfr_set *set;
-	int ch, stats = 0;
-	char *kml_export = NULL, *bands_export = NULL;
+	struct anfr_set *set, *old;
+	int ch, stats = 0, frequencies = 0, geo_query = GEO_QUERY_NONE, sel_count = 0;
+	char *kml_export = NULL, *bands_export = NULL, *filter = NULL, *diff = NULL, *batch = NULL;
+	int64_t memory;
+	uint64_t freq_min = 0, freq_max = 0;
+	float geo_args[4], f;
+	int geo_k = 0;
+	int *sel = NULL, *filtered;
 	time_t now;
+	enum {
+		OPT_SNAPSHOT = 256,
+		OPT_BBOX,
+		OPT_NEAR,
+		OPT_KNN,
+		OPT_FILTER,
+		OPT_DIFF,
+		OPT_INCREMENTAL,
+		OPT_BATCH,
+		OPT_MEMORY,
+		OPT_GZ,
+		OPT_KMZ,
+		OPT_TILES,
+	};
+	static struct option longopts[] = {
+		{ "snapshot", no_argument, NULL, OPT_SNAPSHOT },
+		{ "bbox", required_argument, NULL, OPT_BBOX },
+		{ "near", required_argument, NULL, OPT_NEAR },
+		{ "knn", required_argument, NULL, OPT_KNN },
+		{ "filter", required_argument, NULL, OPT_FILTER },
+		{ "diff", required_argument, NULL, OPT_DIFF },
+		{ "incremental", no_argument, NULL, OPT_INCREMENTAL },
+		{ "batch", required_argument, NULL, OPT_BATCH },
+		{ "memory", required_argument, NULL, OPT_MEMORY },
+		{ "gz", no_argument, NULL, OPT_GZ },
+		{ "kmz", no_argument, NULL, OPT_KMZ },
+		{ "tiles", no_argument, NULL, OPT_TILES },
+		{ NULL, 0, NULL, 0 },
+	};
 
 	bzero(&conf, sizeof(conf));
-	while ((ch = getopt(argc, argv, "b:Chk:sv")) != -1) {
+	conf.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	memory = (int64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2;
+	while ((ch = getopt_long(argc, argv, "b:CF:Hhj:k:sv", longopts, NULL)) != -1) {
 		switch (ch) {
 			case 'b':
 				bands_export = optarg;
@@ -371,6 +946,19 @@ main(int argc, char *argv[])
 			case 'C':
 				conf.no_color = 1;
 				break;
+			case 'F':
+				if (frequency_range_parse(optarg, &freq_min, &freq_max) < 0)
+					usageexit();
+				frequencies = 1;
+				break;
+			case 'H':
+				conf.hugepages = 1;
+				break;
+			case 'j':
+				conf.jobs = atoi(optarg);
+				if (conf.jobs < 1)
+					usageexit();
+				break;
 			case 'k':
 				kml_export = optarg;
 				break;
@@ -380,18 +968,82 @@ main(int argc, char *argv[])
 			case 'v':
 				conf.verbose = 1;
 				break;
+			case OPT_SNAPSHOT:
+				conf.snapshot = 1;
+				break;
+			case OPT_BBOX:
+				if (geo_query != GEO_QUERY_NONE || geo_args_parse(optarg, geo_args, 4, NULL) < 0)
+					usageexit();
+				if (geo_args[0] > geo_args[2]) {
+					f = geo_args[0];
+					geo_args[0] = geo_args[2];
+					geo_args[2] = f;
+				}
+				if (geo_args[1] > geo_args[3]) {
+					f = geo_args[1];
+					geo_args[1] = geo_args[3];
+					geo_args[3] = f;
+				}
+				geo_query = GEO_QUERY_BBOX;
+				break;
+			case OPT_NEAR:
+				if (geo_query != GEO_QUERY_NONE || geo_args_parse(optarg, geo_args, 3, NULL) < 0 || geo_args[2] < 0)
+					usageexit();
+				geo_query = GEO_QUERY_NEAR;
+				break;
+			case OPT_KNN:
+				if (geo_query != GEO_QUERY_NONE || geo_args_parse(optarg, geo_args, 2, &geo_k) < 0 || geo_k < 1)
+					usageexit();
+				geo_query = GEO_QUERY_KNN;
+				break;
+			case OPT_FILTER:
+				filter = optarg;
+				break;
+			case OPT_DIFF:
+				diff = optarg;
+				break;
+			case OPT_INCREMENTAL:
+				conf.incremental = 1;
+				break;
+			case OPT_BATCH:
+				batch = optarg;
+				break;
+			case OPT_MEMORY:
+				memory = atoll(optarg) * 1024 * 1024;
+				if (memory <= 0)
+					usageexit();
+				break;
+			case OPT_GZ:
+				conf.compress |= KML_COMPRESS_GZ;
+				break;
+			case OPT_KMZ:
+				conf.compress |= KML_COMPRESS_KMZ;
+				break;
+			case OPT_TILES:
+				conf.tiles = 1;
+				break;
 			default:
 				usageexit();
 		}
 	}
 	argc -= optind;
 	argv += optind;
-	if (argc < 1)
-		usageexit();
 
 	time(&now);
-	gmtime_r(&now, &conf.now);
-	strftime(conf.now_str, sizeof(conf.now_str), "%Y-%m-%d", &conf.now);
+	conf.now = now / 86400;
+	*daytoa(conf.now, conf.now_str) = '\0';
+	if (conf.incremental)
+		conf.now_str[0] = '\0'; /* kml files of the same supports must be identical, so they are not dated */
+
+	if (conf.tiles && (!kml_export || diff))
+		usageexit();
+	if (batch) {
+		if (argc != 0 || (!kml_export && !bands_export) || geo_query != GEO_QUERY_NONE || filter || frequencies || diff)
+			usageexit();
+		return batch_run(batch, kml_export, bands_export, stats, memory) > 0;
+	}
+	if (argc < 1)
+		usageexit();
 
 	info("[+] loading files from %s\n", argv[0]);
 	if (stats)
@@ -403,20 +1055,45 @@ main(int argc, char *argv[])
 		printf("\nemetteurs systemes count:\n%s", emetteurs_stats(set->emetteurs));
 	}
 
-	if (kml_export) {
+	if (geo_query != GEO_QUERY_NONE) {
+		info("[*] querying supports location\n");
+		sel = output_geo_query(set, geo_query, geo_args, geo_k, &sel_count);
+	}
+
+	if (filter) {
+		info("[*] filtering supports\n");
+		filtered = output_filter(set, filter, sel, sel_count, &sel_count);
+		free(sel);
+		sel = filtered;
+	}
+
+	if (frequencies) {
+		info("[*] listing bandes from %" PRIu64 " to %" PRIu64 " Hz\n", freq_min, freq_max);
+		output_frequencies(set, freq_min, freq_max);
+	}
+
+	if (diff) {
+		info("[+] loading older files from %s\n", diff);
+		old = set_load(diff);
+		info("[*] comparing to %s\n", diff);
+		output_diff(old, set, kml_export, basename(argv[0]));
+		set_free(old);
+	} else if (kml_export && conf.tiles) {
+		info("[*] exporting kml tiles to %s\n", kml_export);
+		output_tiles(set, kml_export, conf.incremental ? "latest" : basename(argv[0]), sel, sel_count);
+	} else if (kml_export) {
 		info("[*] exporting kml to %s\n", kml_export);
-		output_kml(set, kml_export, basename(argv[0]));
+		output_kml(set, kml_export, conf.incremental ? "latest" : basename(argv[0]), sel, sel_count);
 	}
 
 	if (bands_export) {
 		info("[*] exporting bands usage to %s\n", bands_export);
-		output_bands(set, bands_export, basename(argv[0]));
+		output_bands(set, bands_export, basename(argv[0]), sel, sel_count);
 	}
 
-#ifdef DEBUG
-	info("[*] freeing ressources\n");
+	verb("[*] freeing ressources\n");
+	free(sel);
 	set_free(set);
-#endif
 
 	if (conf.warn_incoherent_data > 0)
 		printf("incoherent data warnings: %d\n", conf.warn_incoherent_data);
@@ -424,37 +1101,469 @@ main(int argc, char *argv[])
 	return 0;
 }
 
+/* input files, in the order of their loading tasks */
+enum {
+	SET_FILE_NATURE,
+	SET_FILE_SUPPORT,
+	SET_FILE_PROPRIETAIRE,
+	SET_FILE_STATION,
+	SET_FILE_EXPLOITANT,
+	SET_FILE_ANTENNE,
+	SET_FILE_TYPE_ANTENNE,
+	SET_FILE_EMETTEUR,
+	SET_FILE_BANDE,
+};
+static const char *SET_FILES[SET_FILE_COUNT] = {
+	"SUP_NATURE.txt",
+	"SUP_SUPPORT.txt",
+	"SUP_PROPRIETAIRE.txt",
+	"SUP_STATION.txt",
+	"SUP_EXPLOITANT.txt",
+	"SUP_ANTENNE.txt",
+	"SUP_TYPE_ANTENNE.txt",
+	"SUP_EMETTEUR.txt",
+	"SUP_BANDE.txt",
+};
+
+struct set_file {
+	struct anfr_set *set;
+	int file;
+};
+
+/* loads all files of a set in parallel, following the dependencies between files:
+ * antennes are linked to stations, emetteurs to stations and antennes, and bandes to emetteurs.
+ * loading output is the same as loading files sequentially */
 struct anfr_set *
 set_load(char *path)
 {
-	struct anfr_set *set = xmalloc_zero(sizeof(struct anfr_set));
-	char dir[PATH_MAX];
-
-	snprintf(dir, sizeof(dir), "%s/SUP_NATURE.txt", path);
-	set->natures = natures_load(dir);
-	snprintf(dir, sizeof(dir), "%s/SUP_SUPPORT.txt", path);
-	set->supports = supports_load(dir);
-	snprintf(dir, sizeof(dir), "%s/SUP_PROPRIETAIRE.txt", path);
-	set->proprietaires = proprietaires_load(dir);
-	snprintf(dir, sizeof(dir), "%s/SUP_STATION.txt", path);
-	set->stations = stations_load(dir);
-	snprintf(dir, sizeof(dir), "%s/SUP_EXPLOITANT.txt", path);
-	set->exploitants = exploitants_load(dir);
-	snprintf(dir, sizeof(dir), "%s/SUP_ANTENNE.txt", path);
-	set->antennes = antennes_load(dir, set->stations);
-	snprintf(dir, sizeof(dir), "%s/SUP_TYPE_ANTENNE.txt", path);
-	set->types_antenne = types_antenne_load(dir);
-	snprintf(dir, sizeof(dir), "%s/SUP_EMETTEUR.txt", path);
-	set->emetteurs = emetteurs_load(dir, set->stations, set->antennes);
-	snprintf(dir, sizeof(dir), "%s/SUP_BANDE.txt", path);
-	set->bandes = bandes_load(dir, set->emetteurs);
+	struct anfr_set *set;
+	struct task tasks[SET_FILE_COUNT];
+	struct set_file files[SET_FILE_COUNT];
+	struct set_stamp stamps[SET_FILE_COUNT];
+	char *out, *err;
+	size_t out_len, err_len;
+	int n;
+
+	set_stamps(path, stamps);
+	set = set_snapshot_load(path, stamps);
+	if (set)
+		return set;
+
+	set = xmalloc_zero(sizeof(struct anfr_set));
+	set->path = path;
+	if (conf.snapshot)
+		out_capture_begin();
+	bzero(tasks, sizeof(tasks));
+	for (n=0; n<SET_FILE_COUNT; n++) {
+		files[n].set = set;
+		files[n].file = n;
+		tasks[n].fn = set_load_file;
+		tasks[n].arg = &files[n];
+	}
+	task_dep(&tasks[SET_FILE_ANTENNE], &tasks[SET_FILE_STATION]);
+	task_dep(&tasks[SET_FILE_EMETTEUR], &tasks[SET_FILE_STATION]);
+	task_dep(&tasks[SET_FILE_EMETTEUR], &tasks[SET_FILE_ANTENNE]);
+	task_dep(&tasks[SET_FILE_BANDE], &tasks[SET_FILE_EMETTEUR]);
+	tasks_run(tasks, SET_FILE_COUNT, conf.jobs);
+	set_finalize(set);
+
+	if (conf.snapshot) {
+		out_capture_end(&out, &out_len, &err, &err_len);
+		fwrite(out, 1, out_len, stdout);
+		fwrite(err, 1, err_len, stderr);
+		set_snapshot_save(set, stamps, out, out_len, err, err_len, conf.warn_incoherent_data);
+		free(out);
+		free(err);
+	}
 
 	return set;
 }
 
+void
+set_load_file(void *arg)
+{
+	struct set_file *file = arg;
+	struct anfr_set *set = file->set;
+	struct set_ref *ref = set_refs[file->file];
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", set->path, SET_FILES[file->file]);
+	if (ref) {
+		fwrite(ref->out, 1, ref->out_len, out_stdout());
+		fwrite(ref->err, 1, ref->err_len, out_stderr());
+		__atomic_add_fetch(&conf.warn_incoherent_data, ref->warnings, __ATOMIC_RELAXED);
+	}
+	switch (file->file) {
+	case SET_FILE_NATURE:
+		set->natures = ref ? ref->table : natures_load(path);
+		break;
+	case SET_FILE_SUPPORT:
+		set->supports = supports_load(path);
+		break;
+	case SET_FILE_PROPRIETAIRE:
+		set->proprietaires = ref ? ref->table : proprietaires_load(path);
+		break;
+	case SET_FILE_STATION:
+		set->stations = stations_load(path);
+		break;
+	case SET_FILE_EXPLOITANT:
+		set->exploitants = ref ? ref->table : exploitants_load(path);
+		break;
+	case SET_FILE_ANTENNE:
+		set->antennes = antennes_load(path, set->stations);
+		break;
+	case SET_FILE_TYPE_ANTENNE:
+		set->types_antenne = ref ? ref->table : types_antenne_load(path);
+		break;
+	case SET_FILE_EMETTEUR:
+		set->emetteurs = emetteurs_load(path, set->stations, set->antennes);
+		break;
+	case SET_FILE_BANDE:
+		set->bandes = bandes_load(path, set->emetteurs);
+		break;
+	}
+}
+
+/* exports each period directory of 'root' to its directory in 'kml_dir' and 'bands_dir', returns the number of failed periods.
+ * periods are run in child processes of conf.jobs threads split between them, started in period order as long as their
+ * estimated memory fits in 'budget' with the running ones. reference tables are loaded once per distinct file content,
+ * before forking the periods using them */
+int
+batch_run(const char *root, const char *kml_dir, const char *bands_dir, int stats, int64_t budget)
+{
+	static const int ref_files[] = { SET_FILE_NATURE, SET_FILE_PROPRIETAIRE, SET_FILE_EXPLOITANT, SET_FILE_TYPE_ANTENNE };
+	struct batch_period *periods, *period;
+	struct set_ref **refs = NULL;
+	struct dirent **entries;
+	struct stat fstat;
+	struct rusage ru;
+	struct timespec start, end;
+	char path[PATH_MAX];
+	double scale = 0, ratio;
+	int64_t used = 0;
+	pid_t pid;
+	int n, f, count = 0, entries_count, refs_count = 0, running = 0, next = 0, concurrency, jobs, status, failed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	entries_count = scandir(root, &entries, NULL, alphasort);
+	if (entries_count < 0)
+		err(1, "could not read batch directory %s", root);
+	periods = xmalloc_zero((entries_count + 1) * sizeof(struct batch_period));
+	for (n=0; n<entries_count; n++) {
+		snprintf(path, sizeof(path), "%s/%s/%s", root, entries[n]->d_name, SET_FILES[SET_FILE_SUPPORT]);
+		if (entries[n]->d_name[0] == '.' || stat(path, &fstat) == -1) {
+			free(entries[n]);
+			continue;
+		}
+		period = &periods[count++];
+		snprintf(path, sizeof(path), "%s/%s", root, entries[n]->d_name);
+		period->path = strdup(path);
+		period->name = strdup(entries[n]->d_name);
+		period->memory = BATCH_MEMORY_BASE;
+		for (f=0; f<SET_FILE_COUNT; f++) {
+			snprintf(path, sizeof(path), "%s/%s", period->path, SET_FILES[f]);
+			if (stat(path, &fstat) == 0)
+				period->memory += fstat.st_size * BATCH_MEMORY_PER_INPUT;
+		}
+		free(entries[n]);
+	}
+	free(entries);
+	if (count == 0)
+		errx(1, "no period found in batch directory %s", root);
+	concurrency = count < conf.jobs ? count : conf.jobs;
+	jobs = conf.jobs / concurrency;
+	info("[+] exporting %d periods from %s, %d at a time of %d jobs within %" PRId64 " MB\n",
+		count, root, concurrency, jobs, budget / (1024 * 1024));
+	if (kml_dir && stat(kml_dir, &fstat) == -1)
+		mkdir(kml_dir, 0755);
+	if (bands_dir && stat(bands_dir, &fstat) == -1)
+		mkdir(bands_dir, 0755);
+
+	while (next < count || running > 0) {
+		period = &periods[next];
+		if (next < count && running < concurrency
+				&& (running == 0 || used + (int64_t)(period->memory * (scale ? scale : 1)) <= budget)) {
+			for (f=0; f<(int)(sizeof(ref_files) / sizeof(ref_files[0])); f++) {
+				snprintf(path, sizeof(path), "%s/%s", period->path, SET_FILES[ref_files[f]]);
+				set_refs[ref_files[f]] = batch_ref(&refs, &refs_count, ref_files[f], path);
+			}
+			period->reserved = period->memory * (scale ? scale : 1);
+			fflush(NULL);
+			period->pid = fork();
+			if (period->pid == -1)
+				err(1, "fork");
+			if (period->pid == 0) {
+				conf.jobs = jobs;
+				batch_period(period, kml_dir, bands_dir, stats);
+			}
+			clock_gettime(CLOCK_MONOTONIC, &period->start);
+			verb("started period %s, estimated to %" PRId64 " MB\n", period->name, period->reserved / (1024 * 1024));
+			used += period->reserved;
+			running++;
+			next++;
+			continue;
+		}
+		pid = wait4(-1, &status, 0, &ru);
+		if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "wait4");
+		}
+		for (n=0; n<next && periods[n].pid != pid; n++);
+		if (n == next)
+			continue;
+		period = &periods[n];
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		period->seconds = (end.tv_sec - period->start.tv_sec) + (end.tv_nsec - period->start.tv_nsec) / 1e9;
+		period->maxrss = ru.ru_maxrss;
+		period->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		if (period->status != 0)
+			failed++;
+		ratio = (double)period->maxrss * 1024 / period->memory;
+		if (ratio > scale)
+			scale = ratio;
+		used -= period->reserved;
+		running--;
+		info("[*] period %s %s in %.2fs, %ld MB\n", period->name, period->status ? "failed" : "done", period->seconds, period->maxrss / 1024);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("PERIOD;STATUS;SECONDS;MAX_RSS_MB\n");
+	for (n=0; n<count; n++)
+		printf("%s;%d;%.2f;%ld\n", periods[n].name, periods[n].status, periods[n].seconds, periods[n].maxrss / 1024);
+	info("%d periods exported in %.2fs, %d failed, %d reference tables loaded\n", count,
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, failed, refs_count);
+
+	for (n=0; n<count; n++) {
+		free(periods[n].path);
+		free(periods[n].name);
+	}
+	free(periods);
+	for (n=0; n<refs_count; n++) {
+		free(refs[n]->out);
+		free(refs[n]->err);
+		free(refs[n]);
+	}
+	free(refs);
+
+	return failed;
+}
+
+/* runs the exports of a period in a child process of batch_run(), with its output written to <dir>/<period>.log */
+__attribute__((__noreturn__)) void
+batch_period(struct batch_period *period, const char *kml_dir, const char *bands_dir, int stats)
+{
+	struct anfr_set *set;
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s.log", kml_dir ? kml_dir : bands_dir, period->name);
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1 || dup2(fd, STDERR_FILENO) == -1)
+		err(1, "could not create batch log %s", path);
+	close(fd);
+	conf.warn_incoherent_data = 0;
+
+	info("[+] loading files from %s\n", period->path);
+	if (stats)
+		printf("file name : %s\n\n", period->name);
+	set = set_load(period->path);
+
+	if (stats) {
+		info("[*] displaying statistics\n");
+		printf("\nemetteurs systemes count:\n%s", emetteurs_stats(set->emetteurs));
+	}
+	if (kml_dir) {
+		snprintf(path, sizeof(path), "%s/%s", kml_dir, period->name);
+		info("[*] exporting kml to %s\n", path);
+		if (conf.tiles)
+			output_tiles(set, path, conf.incremental ? "latest" : period->name, NULL, 0);
+		else
+			output_kml(set, path, conf.incremental ? "latest" : period->name, NULL, 0);
+	}
+	if (bands_dir) {
+		snprintf(path, sizeof(path), "%s/%s", bands_dir, period->name);
+		info("[*] exporting bands usage to %s\n", path);
+		output_bands(set, path, period->name, NULL, 0);
+	}
+	set_free(set);
+
+	if (conf.warn_incoherent_data > 0)
+		printf("incoherent data warnings: %d\n", conf.warn_incoherent_data);
+	exit(0);
+}
+
+/* returns the reference table of 'file' loaded from 'path', loading it if no table was loaded from the same content */
+struct set_ref *
+batch_ref(struct set_ref ***refs, int *count, int file, const char *path)
+{
+	struct set_ref *ref;
+	uint8_t digest[SHA256_LEN];
+	char p[PATH_MAX];
+	int n, warnings;
+
+	if (sha256_file(path, digest) < 0)
+		return NULL; /* reported when loading the period */
+	for (n=0; n<*count; n++)
+		if ((*refs)[n]->file == file && !memcmp((*refs)[n]->digest, digest, SHA256_LEN))
+			return (*refs)[n];
+
+	ref = xmalloc_zero(sizeof(struct set_ref));
+	ref->file = file;
+	memcpy(ref->digest, digest, SHA256_LEN);
+	snprintf(p, sizeof(p), "%s", path);
+	warnings = conf.warn_incoherent_data;
+	out_capture_begin();
+	switch (file) {
+	case SET_FILE_NATURE:
+		ref->table = natures_load(p);
+		break;
+	case SET_FILE_PROPRIETAIRE:
+		ref->table = proprietaires_load(p);
+		break;
+	case SET_FILE_EXPLOITANT:
+		ref->table = exploitants_load(p);
+		break;
+	case SET_FILE_TYPE_ANTENNE:
+		ref->table = types_antenne_load(p);
+		break;
+	default:
+		errx(1, "batch_ref: %s is not a reference table", SET_FILES[file]);
+	}
+	out_capture_end(&ref->out, &ref->out_len, &ref->err, &ref->err_len);
+	ref->warnings = conf.warn_incoherent_data - warnings;
+	verb("loaded reference table %s\n", path);
+	*refs = realloc(*refs, (*count + 1) * sizeof(struct set_ref *));
+	if (!*refs)
+		err(1, "realloc");
+	(*refs)[(*count)++] = ref;
+
+	return ref;
+}
+
+/* sorts the references between records once loaded, so that outputs iterate them in order:
+ * stations of supports by date then number, and emetteurs and antennes of stations by id */
+void
+set_finalize(struct anfr_set *set)
+{
+	parallel_for(STATION_DEPT_MAX, conf.jobs, set_finalize_stations, set);
+	parallel_for(set->supports->index.count, conf.jobs, set_finalize_supports, set);
+	set->bitmaps = support_bitmaps_build(set);
+}
+
+void
+set_finalize_stations(void *arg, int dept)
+{
+	struct anfr_set *set = arg;
+	struct station_dept *sdept;
+	int n;
+
+	sdept = set->stations->depts[dept];
+	if (!sdept)
+		return;
+	idx_sort(&sdept->stations); /* stations in name order */
+	for (n=0; n<sdept->stations.count; n++)
+		station_sort_references(sdept->stations.items[n]);
+}
+
+void
+set_finalize_supports(void *arg, int n)
+{
+	struct anfr_set *set = arg;
+
+	support_sort_stations(set->stations, set->supports->index.items[n]);
+}
+
+/* builds the bitmaps of the supports attributes, filling each chunk of positions on its own thread */
+struct support_bitmaps *
+support_bitmaps_build(struct anfr_set *set)
+{
+	struct support_bitmaps *bitmaps;
+	struct bitmap *all;
+	int n;
+
+	bitmaps = xmalloc_zero(sizeof(struct support_bitmaps));
+	bitmaps->count = set->supports->index.count;
+	bitmaps->latest = xmalloc_zero((bitmaps->count + 1) * sizeof(int32_t));
+	all = (struct bitmap *)bitmaps;
+	for (n=0; n<SUPPORT_BITMAPS_COUNT; n++)
+		bitmap_init(&all[n], bitmaps->count);
+	set->bitmaps = bitmaps;
+	parallel_for((bitmaps->count >> BITMAP_CHUNK_BITS) + 1, conf.jobs, support_bitmaps_chunk, set);
+
+	return bitmaps;
+}
+
+void
+support_bitmaps_chunk(void *arg, int chunk)
+{
+	struct anfr_set *set = arg;
+	struct support_bitmaps *bitmaps = set->bitmaps;
+	struct support *sup;
+	struct station *sta;
+	int n, s, e, end;
+	int32_t latest;
+
+	end = (chunk + 1) << BITMAP_CHUNK_BITS;
+	if (end > bitmaps->count)
+		end = bitmaps->count;
+	for (n=chunk<<BITMAP_CHUNK_BITS; n<end; n++) {
+		sup = set->supports->index.items[n];
+		if (sup->tpo_id >= 0 && sup->tpo_id < PROPRIETAIRE_ID_MAX)
+			bitmap_add(&bitmaps->proprietaires[sup->tpo_id], n);
+		if (sup->nat_id >= 0 && sup->nat_id < NATURE_ID_MAX)
+			bitmap_add(&bitmaps->natures[sup->nat_id], n);
+		bitmap_add(&bitmaps->depts[sup->dept], n);
+		latest = DAY_NONE;
+		for (s=0; s<sup->sta_count; s++) {
+			sta = station_find(set->stations, sup->sta_nm_anfr[s]);
+			if (!sta)
+				continue;
+			if (sta->dte_latest > latest)
+				latest = sta->dte_latest;
+			if (sta->adm_id >= 0 && sta->adm_id < EXPLOITANT_ID_MAX)
+				bitmap_add(&bitmaps->exploitants[sta->adm_id], n);
+			for (e=0; e<sta->emetteur_count; e++)
+				bitmap_add(&bitmaps->systemes[sta->emetteurs[e]->systeme_id], n);
+		}
+		bitmaps->latest[n] = latest;
+	}
+}
+
+void
+support_bitmaps_free(struct support_bitmaps *bitmaps)
+{
+	struct bitmap *all = (struct bitmap *)bitmaps;
+	int n;
+
+	for (n=0; n<SUPPORT_BITMAPS_COUNT; n++)
+		bitmap_free(&all[n]);
+	free(bitmaps->latest);
+	free(bitmaps);
+}
+
+void
+support_bitmaps_snapshot(struct snap *snap, struct support_bitmaps *bitmaps)
+{
+	struct bitmap *all = (struct bitmap *)bitmaps;
+	int n;
+
+	snap_region(snap, bitmaps, sizeof(struct support_bitmaps));
+	snap_data(snap, bitmaps->latest, (bitmaps->count + 1) * sizeof(int32_t));
+	snap_ptr(snap, &bitmaps->latest);
+	for (n=0; n<SUPPORT_BITMAPS_COUNT; n++)
+		bitmap_snapshot(snap, &all[n]);
+}
+
 void
 set_free(struct anfr_set *set)
 {
+	if (set->snapshot) {
+		munmap(set->snapshot, set->snapshot_size);
+		free(set);
+		return;
+	}
+	support_bitmaps_free(set->bitmaps);
 	bandes_free(set->bandes);
 	emetteurs_free(set->emetteurs);
 	types_antenne_free(set->types_antenne);
@@ -464,6 +1573,128 @@ set_free(struct anfr_set *set)
 	proprietaires_free(set->proprietaires);
 	supports_free(set->supports);
 	natures_free(set->natures);
+	free(set);
+}
+
+/* records the size and modification time of the input files of a set */
+void
+set_stamps(char *path, struct set_stamp *stamps)
+{
+	char file[PATH_MAX];
+	struct stat fstat;
+	int n;
+
+	bzero(stamps, SET_FILE_COUNT * sizeof(struct set_stamp));
+	for (n=0; n<SET_FILE_COUNT; n++) {
+		snprintf(file, sizeof(file), "%s/%s", path, SET_FILES[n]);
+		if (stat(file, &fstat) == -1)
+			continue; /* reported when loading */
+		stamps[n].size = fstat.st_size;
+		stamps[n].mtime_sec = fstat.st_mtim.tv_sec;
+		stamps[n].mtime_nsec = fstat.st_mtim.tv_nsec;
+	}
+}
+
+/* returns the set from the snapshot of 'path', or NULL if there is none or if it is out of date */
+struct anfr_set *
+set_snapshot_load(char *path, struct set_stamp *stamps)
+{
+	struct set_snapshot *snapshot;
+	struct anfr_set *set;
+	char file[PATH_MAX], *map;
+	size_t map_size;
+
+	snprintf(file, sizeof(file), "%s/%s", path, SET_SNAPSHOT_FILE);
+	snapshot = snap_load(file, set_snapshot_layout(), &map, &map_size);
+	if (!snapshot)
+		return NULL;
+	if (memcmp(snapshot->stamps, stamps, sizeof(snapshot->stamps))) {
+		verb("snapshot %s is older than input files, ignoring\n", file);
+		munmap(map, map_size);
+		return NULL;
+	}
+	if (snapshot->set->stations->has_future && conf.now > snapshot->set->stations->future) {
+		verb("snapshot %s latest station date has changed, ignoring\n", file);
+		munmap(map, map_size);
+		return NULL;
+	}
+	verb("loading snapshot %s\n", file);
+
+	set = xmalloc_zero(sizeof(struct anfr_set));
+	memcpy(set, snapshot->set, sizeof(struct anfr_set));
+	set->path = path;
+	set->snapshot = map;
+	set->snapshot_size = map_size;
+	fwrite(snapshot->out, snapshot->out_len, 1, out_stdout());
+	fwrite(snapshot->err, snapshot->err_len, 1, out_stderr());
+	conf.warn_incoherent_data += snapshot->warnings;
+
+	return set;
+}
+
+void
+set_snapshot_save(struct anfr_set *set, struct set_stamp *stamps, char *out, size_t out_len, char *err, size_t err_len, int warnings)
+{
+	struct set_snapshot snapshot;
+	char file[PATH_MAX];
+
+	bzero(&snapshot, sizeof(snapshot));
+	memcpy(snapshot.stamps, stamps, sizeof(snapshot.stamps));
+	snapshot.out = out;
+	snapshot.out_len = out_len;
+	snapshot.err = err;
+	snapshot.err_len = err_len;
+	snapshot.warnings = warnings;
+	snapshot.set = set;
+
+	snprintf(file, sizeof(file), "%s/%s", set->path, SET_SNAPSHOT_FILE);
+	verb("writing snapshot %s\n", file);
+	if (snap_write(file, set_snapshot_layout(), set_snapshot_walk, &snapshot) == -1)
+		warnx_out("could not write snapshot %s: %s", file, strerror(errno));
+}
+
+/* returns the key of set snapshots, which changes with the layout of any saved record */
+uint64_t
+set_snapshot_layout(void)
+{
+	return snap_layout(SET_SNAPSHOT_VERSION, SET_SNAPSHOT_FIELDS, sizeof(SET_SNAPSHOT_FIELDS) / sizeof(SET_SNAPSHOT_FIELDS[0]));
+}
+
+void
+set_snapshot_walk(struct snap *snap, void *arg)
+{
+	struct set_snapshot *snapshot = arg;
+	struct anfr_set *set = snapshot->set;
+
+	snap_region(snap, snapshot, sizeof(struct set_snapshot));
+	snap_data(snap, snapshot->out, snapshot->out_len + 1);
+	snap_data(snap, snapshot->err, snapshot->err_len + 1);
+	snap_ptr(snap, &snapshot->out);
+	snap_ptr(snap, &snapshot->err);
+	snap_ptr(snap, &snapshot->set);
+
+	snap_region(snap, set, sizeof(struct anfr_set));
+	snap_zero(snap, &set->path, sizeof(set->path));
+	snap_ptr(snap, &set->natures);
+	snap_ptr(snap, &set->supports);
+	snap_ptr(snap, &set->proprietaires);
+	snap_ptr(snap, &set->stations);
+	snap_ptr(snap, &set->exploitants);
+	snap_ptr(snap, &set->emetteurs);
+	snap_ptr(snap, &set->bandes);
+	snap_ptr(snap, &set->antennes);
+	snap_ptr(snap, &set->types_antenne);
+	snap_ptr(snap, &set->bitmaps);
+	natures_snapshot(snap, set->natures);
+	supports_snapshot(snap, set->supports);
+	proprietaires_snapshot(snap, set->proprietaires);
+	stations_snapshot(snap, set->stations);
+	exploitants_snapshot(snap, set->exploitants);
+	emetteurs_snapshot(snap, set->emetteurs);
+	bandes_snapshot(snap, set->bandes);
+	antennes_snapshot(snap, set->antennes);
+	types_antenne_snapshot(snap, set->types_antenne);
+	support_bitmaps_snapshot(snap, set->bitmaps);
 }
 
 struct f_nature *
@@ -487,13 +1718,13 @@ natures_load(char *path)
 		if (nat_id >= NATURE_ID_MAX)
 			errx(1, "nature id %d too big", nat_id);
 
-		nature = malloc(sizeof(struct nature));
+		nature = arena_alloc(&natures->arena, sizeof(struct nature));
 		nature->nat_id = nat_id;
 		csv_str(csv, &nature->nat_lb_nom);
 		natures->table[nature->nat_id] = nature;
 		natures->count++;
 	}
-	printf("%d natures of support\n", natures->count);
+	msg("%d natures of support\n", natures->count);
 
 	return natures;
 }
@@ -501,15 +1732,28 @@ natures_load(char *path)
 void
 natures_free(struct f_nature *natures)
 {
-	int n;
-
-	for (n=0; n<NATURE_ID_MAX; n++)
-		if (natures->table[n])
-			free(natures->table[n]);
+	arena_free(&natures->arena);
 	csv_close(&natures->csv);
 	free(natures);
 }
 
+void
+natures_snapshot(struct snap *snap, struct f_nature *natures)
+{
+	struct nature *nature;
+	int n;
+
+	snap_region(snap, natures, sizeof(struct f_nature));
+	csv_snapshot(snap, &natures->csv);
+	arena_snapshot(snap, &natures->arena);
+	for (n=0; n<NATURE_ID_MAX; n++) {
+		if (!(nature = natures->table[n]))
+			continue;
+		snap_ptr(snap, &natures->table[n]);
+		snap_ptr(snap, &nature->nat_lb_nom);
+	}
+}
+
 const char *
 nature_get_name(struct f_nature *f, int id)
 {
@@ -524,7 +1768,10 @@ supports_load(char *path)
 	struct f_support *supports;
 	struct csv *csv;
 	struct support *sup;
-	int sup_id;
+	struct sta_nm *nm;
+	float *lat, *lon;
+	int sup_id, n;
+	char *lat_ns, *lon_ew;
 
 	supports = xmalloc_zero(sizeof(struct f_support));
 	csv = &supports->csv;
@@ -534,22 +1781,22 @@ supports_load(char *path)
 		if (!isdigit(csv->line[0]))
 			continue; /* comment or header */
 		csv_int(csv, &sup_id, NULL);
-		if (sup_id >= SUPPORTS_ID_MAX)
-			errx(1, "invalid support id, too big: %d", sup_id);
-		if (!supports->table[sup_id]) {
+		sup = idx_get(&supports->index, sup_id);
+		if (!sup) {
 			verb("new support %d\n", sup_id);
-			sup = malloc(sizeof(struct support));
+			sup = arena_alloc(&supports->arena, sizeof(struct support));
 			sup->sup_id = sup_id;
-			csv_stanm(csv, &sup->sta_nm_anfr[0]);
+			nm = arena_alloc(&supports->arena, sizeof(struct sta_nm));
+			csv_stanm(csv, nm);
 			csv_int(csv, &sup->nat_id, NULL);
 			csv_int(csv, &sup->lat_dms[0], NULL);
 			csv_int(csv, &sup->lat_dms[1], NULL);
 			csv_int(csv, &sup->lat_dms[2], NULL);
-			csv_str(csv, &sup->lat_ns);
+			csv_str(csv, &lat_ns);
 			csv_int(csv, &sup->lon_dms[0], NULL);
 			csv_int(csv, &sup->lon_dms[1], NULL);
 			csv_int(csv, &sup->lon_dms[2], NULL);
-			csv_str(csv, &sup->lon_ew);
+			csv_str(csv, &lon_ew);
 			csv_int(csv, &sup->sup_nm_haut, NULL);
 			csv_int(csv, &sup->tpo_id, NULL);
 			csv_str(csv, &sup->adr_lb_lieu);
@@ -558,23 +1805,37 @@ supports_load(char *path)
 			csv_str(csv, &sup->adr_lb_add3);
 			csv_int(csv, &sup->adr_nm_cp, &sup->adr_nm_cp_str);
 			csv_int16(csv, &sup->com_cd_insee, NULL);
-			coord_dms_to_dd(sup->lat_dms, sup->lat_ns, sup->lon_dms, sup->lon_ew, &sup->lat, &sup->lon);
+			coord_dms_to_dd(sup->lat_dms, lat_ns, sup->lon_dms, lon_ew, &sup->lat, &sup->lon);
 			sup->dept = sup->com_cd_insee >> 12;
 			snprintf(sup->dept_name, sizeof(sup->dept_name), "%02X", sup->dept);
+			sup->sta_nm_anfr = NULL;
 			sup->sta_count = 0;
-			supports->table[sup->sup_id] = sup;
+			idx_put(&supports->index, sup->sup_id, sup);
 			supports->count++;
 		} else {
 			verb("existing support %d\n", sup_id);
-			sup = supports->table[sup_id];
-			if (sup->sta_count == SUPPORT_STA_MAX)
-				errx(1, "maximum stations %d reached for support %d", SUPPORT_STA_MAX, sup->sup_id);
-			csv_stanm(csv, &sup->sta_nm_anfr[sup->sta_count]);
+			nm = arena_alloc(&supports->arena, sizeof(struct sta_nm));
+			csv_stanm(csv, nm);
 		}
+		csr_link(&supports->stations, sup, nm);
 		sup->sta_count++;
 		verb("%d: tpo=%d lieu='%s' add0='%s' cp=%d insee=%x\n", sup->sup_id, sup->tpo_id, sup->adr_lb_lieu, sup->adr_lb_add0, sup->adr_nm_cp, sup->com_cd_insee);
 	}
-	printf("%d supports\n", supports->count);
+	idx_sort(&supports->index);
+	csr_build(&supports->stations, offsetof(struct support, sta_nm_anfr), offsetof(struct support, sta_count));
+	lat = malloc((supports->index.count + 1) * sizeof(float));
+	lon = malloc((supports->index.count + 1) * sizeof(float));
+	if (!lat || !lon)
+		err(1, "malloc");
+	for (n=0; n<supports->index.count; n++) {
+		sup = supports->index.items[n];
+		lat[n] = sup->lat;
+		lon[n] = sup->lon;
+	}
+	geo_grid_build(&supports->grid, lat, lon, supports->index.count);
+	free(lat);
+	free(lon);
+	msg("%d supports\n", supports->count);
 
 	return supports;
 }
@@ -582,17 +1843,68 @@ supports_load(char *path)
 void
 supports_free(struct f_support *supports)
 {
-	int n;
-
-	for (n=0; n<SUPPORTS_ID_MAX; n++)
-		if (supports->table[n])
-			free(supports->table[n]);
+	arena_free(&supports->arena);
+	idx_free(&supports->index);
+	csr_free(&supports->stations);
+	geo_grid_free(&supports->grid);
 	csv_close(&supports->csv);
 	free(supports);
 }
 
-struct f_proprietaire *
-proprietaires_load(char *path)
+/* orders the stations of 'sup' with station_cmp(), stations not found last.
+ * the same station listed twice stays adjacent */
+#define SUPPORT_SORT_STACK 32
+void
+support_sort_stations(struct f_station *stations, struct support *sup)
+{
+	struct station *stack[SUPPORT_SORT_STACK], **table, *sta;
+	struct sta_nm *nm;
+	int n, m;
+
+	table = stack;
+	if (sup->sta_count > SUPPORT_SORT_STACK && !(table = malloc(sup->sta_count * sizeof(struct station *))))
+		err(1, "malloc");
+	for (n=0; n<sup->sta_count; n++) {
+		nm = sup->sta_nm_anfr[n];
+		sta = station_find(stations, nm);
+		for (m=n; sta && m>0 && (!table[m-1] || station_cmp(sta, table[m-1]) < 0); m--) {
+			table[m] = table[m-1];
+			sup->sta_nm_anfr[m] = sup->sta_nm_anfr[m-1];
+		}
+		table[m] = sta;
+		sup->sta_nm_anfr[m] = nm;
+	}
+	if (table != stack)
+		free(table);
+}
+
+void
+supports_snapshot(struct snap *snap, struct f_support *supports)
+{
+	struct support *sup;
+	int n, s;
+
+	snap_region(snap, supports, sizeof(struct f_support));
+	csv_snapshot(snap, &supports->csv);
+	arena_snapshot(snap, &supports->arena);
+	idx_snapshot(snap, &supports->index);
+	csr_snapshot(snap, &supports->stations);
+	geo_grid_snapshot(snap, &supports->grid);
+	for (n=0; n<supports->index.count; n++) {
+		sup = supports->index.items[n];
+		snap_ptr(snap, &sup->sta_nm_anfr);
+		for (s=0; s<sup->sta_count; s++)
+			snap_ptr(snap, &sup->sta_nm_anfr[s]->str);
+		snap_ptr(snap, &sup->adr_lb_lieu);
+		snap_ptr(snap, &sup->adr_lb_add0);
+		snap_ptr(snap, &sup->adr_lb_add2);
+		snap_ptr(snap, &sup->adr_lb_add3);
+		snap_ptr(snap, &sup->adr_nm_cp_str);
+	}
+}
+
+struct f_proprietaire *
+proprietaires_load(char *path)
 {
 	struct f_proprietaire *proprietaires;
 	struct csv *csv;
@@ -613,14 +1925,14 @@ proprietaires_load(char *path)
 			warn_incoherent_data("line %d: proprietaire %d already exists, ignoring\n", csv->line_count, tpo_id);
 			continue;
 		}
-		proprio = malloc(sizeof(struct proprio));
+		proprio = arena_alloc(&proprietaires->arena, sizeof(struct proprio));
 		proprio->tpo_id = tpo_id;
 		csv_str(csv, &proprio->tpo_lb);
 		verb("proprietaire id %d : %s\n", tpo_id, proprio->tpo_lb);
 		proprietaires->table[proprio->tpo_id] = proprio;
 		proprietaires->count++;
 	}
-	printf("%d proprietaires\n", proprietaires->count);
+	msg("%d proprietaires\n", proprietaires->count);
 
 	return proprietaires;
 }
@@ -628,15 +1940,28 @@ proprietaires_load(char *path)
 void
 proprietaires_free(struct f_proprietaire *proprietaires)
 {
-	int n;
-
-	for (n=0; n<PROPRIETAIRE_ID_MAX; n++)
-		if (proprietaires->table[n])
-			free(proprietaires->table[n]);
+	arena_free(&proprietaires->arena);
 	csv_close(&proprietaires->csv);
 	free(proprietaires);
 }
 
+void
+proprietaires_snapshot(struct snap *snap, struct f_proprietaire *proprietaires)
+{
+	struct proprio *proprio;
+	int n;
+
+	snap_region(snap, proprietaires, sizeof(struct f_proprietaire));
+	csv_snapshot(snap, &proprietaires->csv);
+	arena_snapshot(snap, &proprietaires->arena);
+	for (n=0; n<PROPRIETAIRE_ID_MAX; n++) {
+		if (!(proprio = proprietaires->table[n]))
+			continue;
+		snap_ptr(snap, &proprietaires->table[n]);
+		snap_ptr(snap, &proprio->tpo_lb);
+	}
+}
+
 const char *
 proprietaire_get_name(struct f_proprietaire *f, int proprio)
 {
@@ -653,11 +1978,10 @@ stations_load(char *path)
 	struct f_station *stations;
 	struct csv *csv;
 	struct station_dept *dept;
-	struct station_zone *zone;
 	struct station *sta;
-	struct tm *dte_latest;
 
 	stations = xmalloc_zero(sizeof(struct f_station));
+	stations->latest = DAY_NONE;
 	csv = &stations->csv;
 	csv_open(csv, path, CSV_NORMAL, ';', 0);
 
@@ -665,57 +1989,54 @@ stations_load(char *path)
 		if (!isdigit(csv->line[0]))
 			continue; /* comment or header */
 
-		sta = malloc(sizeof(struct station));
+		sta = arena_alloc(&stations->arena, sizeof(struct station));
 		csv_stanm(csv, &sta->sta_nm);
 		csv_int(csv, &sta->adm_id, NULL);
 		csv_int(csv, NULL, &sta->dem_nm_consis_str);
 		csv_date(csv, &sta->dte_implemntatation, &sta->dte_implemntatation_str);
 		csv_date(csv, &sta->dte_modif, &sta->dte_modif_str);
 		csv_date(csv, &sta->dte_en_service, &sta->dte_en_service_str);
+		sta->emetteurs = NULL;
 		sta->emetteur_count = 0;
-		bzero(sta->systeme_count, sizeof(sta->systeme_count));
+		sta->antennes = NULL;
 		sta->antenne_count = 0;
 
 		/* set station most recent date */
-		if (tm_diff(&sta->dte_implemntatation, &sta->dte_modif) > 0) {
-			if (tm_diff(&sta->dte_implemntatation, &sta->dte_en_service) > 0)
-				dte_latest = &sta->dte_implemntatation;
-			else
-				dte_latest = &sta->dte_en_service;
-		} else {
-			if (tm_diff(&sta->dte_modif, &sta->dte_en_service))
-				dte_latest = &sta->dte_modif;
-			else
-				dte_latest = &sta->dte_en_service;
-		}
-		memcpy(&sta->dte_latest, dte_latest, sizeof(struct tm));
+		sta->dte_latest = sta->dte_implemntatation;
+		if (sta->dte_modif > sta->dte_latest)
+			sta->dte_latest = sta->dte_modif;
+		if (sta->dte_en_service > sta->dte_latest)
+			sta->dte_latest = sta->dte_en_service;
 
 		/* update latest station date, except if date is more recent than now (incoherent data) */
-		if (tm_diff(&conf.now, dte_latest) > 0 && tm_diff(dte_latest, &stations->latest) > 0)
-			memcpy(&stations->latest, dte_latest, sizeof(struct tm));
+		if (sta->dte_latest < conf.now) {
+			if (sta->dte_latest > stations->latest)
+				stations->latest = sta->dte_latest;
+		} else if (!stations->has_future || sta->dte_latest < stations->future) {
+			stations->future = sta->dte_latest;
+			stations->has_future = 1;
+		}
 
 		/* insert the station in maching zone of departement */
 		if (!stations->depts[sta->sta_nm.dept]) {
-			stations->depts[sta->sta_nm.dept] = xmalloc_zero(sizeof(struct station_dept));
+			stations->depts[sta->sta_nm.dept] = arena_alloc_zero(&stations->arena, sizeof(struct station_dept));
 			stations->dept_count++;
 		}
 		dept = stations->depts[sta->sta_nm.dept];
+		if (idx_pos(&dept->stations, STATION_KEY(&sta->sta_nm)) >= 0) {
+			warn_incoherent_data("line %d: station %s already exists, ignoring", csv->line_count, sta->sta_nm.str);
+			arena_pop(&stations->arena, sta);
+			continue;
+		}
+		idx_put(&dept->stations, STATION_KEY(&sta->sta_nm), sta);
 		if (!dept->zones[sta->sta_nm.zone]) {
-			dept->zones[sta->sta_nm.zone] = xmalloc_zero(sizeof(struct station_zone));
+			dept->zones[sta->sta_nm.zone] = 1;
 			dept->zone_count++;
 			stations->zone_count++;
 		}
-		zone = dept->zones[sta->sta_nm.zone];
-		if (zone->stations[sta->sta_nm.id]) {
-			warn_incoherent_data("line %d: station %s already exists, ignoring", csv->line_count, sta->sta_nm.str);
-			free(sta);
-			continue;
-		}
-		zone->stations[sta->sta_nm.id] = sta;
 		stations->station_count++;
-		zone->station_count++;
 	}
-	printf("%d stations in %d departement and %d zones\n", stations->station_count, stations->dept_count, stations->zone_count);
+	msg("%d stations in %d departement and %d zones\n", stations->station_count, stations->dept_count, stations->zone_count);
 
 	return stations;
 }
@@ -723,35 +2044,42 @@ stations_load(char *path)
 void
 stations_free(struct f_station *stations)
 {
-	int ndept, nzone, id;
+	int d;
+
+	for (d=0; d<STATION_DEPT_MAX; d++)
+		if (stations->depts[d])
+			idx_free(&stations->depts[d]->stations);
+	arena_free(&stations->arena);
+	csv_close(&stations->csv);
+	free(stations);
+}
+
+void
+stations_snapshot(struct snap *snap, struct f_station *stations)
+{
 	struct station_dept *dept;
-	struct station_zone *zone;
 	struct station *sta;
-	int freed_stations = 0;
+	int d, n;
 
-	for (ndept=0; ndept < STATION_DEPT_MAX; ndept++) {
-		dept = stations->depts[ndept];
-		if (!dept)
+	snap_region(snap, stations, sizeof(struct f_station));
+	csv_snapshot(snap, &stations->csv);
+	arena_snapshot(snap, &stations->arena);
+	for (d=0; d<STATION_DEPT_MAX; d++) {
+		if (!(dept = stations->depts[d]))
 			continue;
-		for (nzone=0; nzone < STATION_ZONE_MAX; nzone++) {
-			zone = dept->zones[nzone];
-			if (!zone)
-				continue;
-			for (id=0; id < STATION_ID_MAX; id++) {
-				sta = zone->stations[id];
-				if (!sta)
-					continue;
-				free(sta);
-				freed_stations++;
-			}
-			free(zone);
+		snap_ptr(snap, &stations->depts[d]);
+		idx_snapshot(snap, &dept->stations);
+		for (n=0; n<dept->stations.count; n++) {
+			sta = dept->stations.items[n];
+			snap_ptr(snap, &sta->sta_nm.str);
+			snap_ptr(snap, &sta->dem_nm_consis_str);
+			snap_ptr(snap, &sta->dte_implemntatation_str);
+			snap_ptr(snap, &sta->dte_modif_str);
+			snap_ptr(snap, &sta->dte_en_service_str);
+			snap_ptr(snap, &sta->emetteurs);
+			snap_ptr(snap, &sta->antennes);
 		}
-		free(dept);
 	}
-	if (stations->station_count != freed_stations)
-		warnx("freed_stations %d != station_count %d", freed_stations, stations->station_count);
-	csv_close(&stations->csv);
-	free(stations);
 }
 
 struct station *
@@ -763,57 +2091,56 @@ station_get(struct f_station *stations, struct sta_nm *nm)
 		warn_incoherent_data("zone %d not found in departement %x when looking for station %s", nm->zone, nm->dept, nm->str);
 		return NULL;
 	}
-	return stations->depts[nm->dept]->zones[nm->zone]->stations[nm->id];
+	return idx_get(&stations->depts[nm->dept]->stations, STATION_KEY(nm));
 }
 
-/* returns the next recently modified or en service station older than 'last' in 'table' sta_nm index
- * in case of equality, station number is compared */
+/* returns the station named 'nm', or NULL without warning */
 struct station *
-station_get_next(struct f_station *stations, struct sta_nm *table, int count, struct station *last)
+station_find(struct f_station *stations, struct sta_nm *nm)
 {
-	struct station *next = NULL, *sta;
-	int n, tmdiff1_last, tmdiff1_next, tmdiff2_last, tmdiff2_next;
-	struct tm *sta_date, *cmp_date;
+	struct station_dept *sdept = stations->depts[nm->dept];
 
-	for (n=0; n<count; n++) {
-		sta = station_get(stations, &table[n]);
-		if (!sta) {
-			warn_incoherent_data("station %s not found, ignoring", table[n].str);
-			continue;
-		}
-		tmdiff1_last = 0;
-		tmdiff1_next = 0;
-		tmdiff2_last = 0;
-		tmdiff2_next = 0;
-		sta_date = (sta->dte_modif_str[0]) ? &sta->dte_modif : &sta->dte_en_service;
-
-		if (last) {
-			cmp_date = (last->dte_modif_str[0]) ? &last->dte_modif : &last->dte_en_service;
-			tmdiff1_last = tm_diff(sta_date, cmp_date);
-			tmdiff2_last = tm_diff(&sta->dte_en_service, &last->dte_en_service);
-		}
-		if (next) {
-			cmp_date = (next->dte_modif_str[0]) ? &next->dte_modif : &next->dte_en_service;
-			tmdiff1_next = tm_diff(sta_date, cmp_date);
-			tmdiff2_next = tm_diff(&sta->dte_en_service, &next->dte_en_service);
-		}
-		if ( (!last || tmdiff1_last < 0 || (tmdiff1_last == 0 && (tmdiff2_last < 0 || (tmdiff2_last == 0 && sta->sta_nm.nm < last->sta_nm.nm))))
-				&& (!next || tmdiff1_next > 0 || (tmdiff1_next == 0 && (tmdiff2_next > 0 || (tmdiff2_next == 0 && sta->sta_nm.nm > next->sta_nm.nm)))) )
-			next = sta;
-	}
+	if (!sdept)
+		return NULL;
+	return idx_get(&sdept->stations, STATION_KEY(nm));
+}
 
-	return next;
+/* orders stations from the most recently modified or en service, then the most recently en service, then by decreasing number */
+int
+station_cmp(struct station *a, struct station *b)
+{
+	int32_t date_a, date_b;
+
+	date_a = (a->dte_modif_str[0]) ? a->dte_modif : a->dte_en_service;
+	date_b = (b->dte_modif_str[0]) ? b->dte_modif : b->dte_en_service;
+	if (date_a != date_b)
+		return date_a > date_b ? -1 : 1;
+	if (a->dte_en_service != b->dte_en_service)
+		return a->dte_en_service > b->dte_en_service ? -1 : 1;
+	return (a->sta_nm.nm < b->sta_nm.nm) - (a->sta_nm.nm > b->sta_nm.nm);
+}
+
+/* orders the emetteurs and antennes of a station by decreasing id */
+void
+station_sort_references(struct station *sta)
+{
+	/* the arrays are NULL while empty, and qsort wants a valid base */
+	if (sta->emetteur_count > 0)
+		qsort(sta->emetteurs, sta->emetteur_count, sizeof(struct emetteur *), emetteur_cmp);
+	if (sta->antenne_count > 0)
+		qsort(sta->antennes, sta->antenne_count, sizeof(struct antenne *), antenne_cmp);
 }
 
 /* appends a text description of a station to 'desc'
  * we use strbuf_*() macros to avoid poor performance of sprintf, as this function loops a lot during kml file generation */
 int
-station_description(struct f_type_antenne *types_antenne, struct station *sta, char *desc)
+station_description(struct anfr_set *set, struct station *sta, char *desc)
 {
 	char *desc_start = desc;
 	struct emetteur *emr;
 	struct bande *ban;
 	struct antenne *aer;
+	const char *rayon;
 	int n, b, e;
 
 	/* summary */
@@ -831,15 +2158,14 @@ station_description(struct f_type_antenne *types_antenne, struct station *sta, c
 	strbuf_chr(desc, '\n');
 
 	/* emetteurs list */
-	emr = NULL;
 	for (n=0; n<sta->emetteur_count; n++) {
-		emr = emetteur_get_next(sta->emetteurs, sta->emetteur_count, emr);
+		emr = sta->emetteurs[n];
 		strbuf_chr(desc, '>');
 		strbuf_int(desc, n+1);
 		strbuf_chr(desc, ' ');
 		strbuf_str(desc, emr->emr_id_str);
 		strbuf_chr(desc, ' ');
-		strbuf_str(desc, emr->emr_lb_systeme);
+		strbuf_str(desc, dict_label(&set->emetteurs->systemes, emr->systeme_id));
 		strbuf_chr(desc, ' ');
 		strbuf_str(desc, emr->emr_dt_service_str);
 		strbuf_chr(desc, ' ');
@@ -848,7 +2174,7 @@ station_description(struct f_type_antenne *types_antenne, struct station *sta, c
 			strbuf_str(desc, ban->ban_nb_f_deb_str);
 			strbuf_chr(desc, '-');
 			strbuf_str(desc, ban->ban_nb_f_fin_str);
-			strbuf_str(desc, ban->ban_fg_unite);
+			strbuf_str(desc, dict_label(&set->bandes->unites, ban->ban_fg_unite));
 			strbuf_chr(desc, ' ');
 		}
 		strbuf_chr(desc, '\n');
@@ -860,21 +2186,21 @@ station_description(struct f_type_antenne *types_antenne, struct station *sta, c
 	if (sta->antenne_count > 1)
 		strbuf_chr(desc, 's');
 	strbuf_chr(desc, '\n');
-	aer = NULL;
 	for (n=0; n<sta->antenne_count; n++) {
-		aer = antenne_get_next(sta->antennes, sta->antenne_count, aer);
+		aer = sta->antennes[n];
 		strbuf_chr(desc, '>');
 		strbuf_int(desc, n+1);
 		strbuf_chr(desc, ' ');
 		strbuf_str(desc, aer->aer_id_str);
 		strbuf_chr(desc, ' ');
-		strbuf_str(desc, type_antenne_get(types_antenne, aer->tae_id));
+		strbuf_str(desc, type_antenne_get(set->types_antenne, aer->tae_id));
 		strbuf_chr(desc, ' ');
 		strbuf_str(desc, aer->aer_nb_dimension_str);
 		strbuf_chr(desc, 'm');
-		if (aer->aer_fg_rayon[0] == 'D')
+		rayon = dict_label(&set->antennes->rayons, aer->aer_fg_rayon);
+		if (rayon[0] == 'D')
 			strbuf_str(desc, " Directional ");
-		else if (aer->aer_fg_rayon[0] == 'N')
+		else if (rayon[0] == 'N')
 			strbuf_str(desc, " Omnidirectional ");
 		strbuf_str(desc, aer->aer_nb_azimut_str);
 		strbuf_chr(desc, 'd');
@@ -893,7 +2219,7 @@ station_description(struct f_type_antenne *types_antenne, struct station *sta, c
 				emr = aer->emetteurs[e];
 				strbuf_str(desc, emr->emr_id_str);
 				strbuf_chr(desc, ' ');
-				strbuf_str(desc, emr->emr_lb_systeme);
+				strbuf_str(desc, dict_label(&set->emetteurs->systemes, emr->systeme_id));
 			}
 			strbuf_chr(desc, '\n');
 		}
@@ -907,19 +2233,23 @@ int
 station_systemes(struct f_emetteur *emetteurs, struct station *sta, char *desc)
 {
 	char *desc_start = desc;
-	int id = 0, count = 0;
-	char *lb = NULL;
+	struct histo_entry ranked[SYSTEMES_ID_MAX];
+	int systeme_count[SYSTEMES_ID_MAX];
+	int n, count;
 
-	while ( (count = next_smallest_positive_int(sta->systeme_count, SYSTEMES_ID_MAX, count, id, &id)) > 0 ) {
-		if (lb) {
+	bzero(systeme_count, sizeof(systeme_count));
+	for (n=0; n<sta->emetteur_count; n++)
+		systeme_count[sta->emetteurs[n]->systeme_id]++;
+	count = histo_rank(systeme_count, SYSTEMES_ID_MAX, ranked);
+	for (n=0; n<count; n++) {
+		if (n > 0) {
 			strbuf_chr(desc, ',');
 			strbuf_chr(desc, ' ');
 		}
-		lb = emetteurs->systemes_lb[id];
-		strbuf_str(desc, lb);
+		strbuf_str(desc, dict_label(&emetteurs->systemes, ranked[n].index));
 		strbuf_chr(desc, ' ');
 		strbuf_chr(desc, '(');
-		strbuf_int(desc, count);
+		strbuf_int(desc, ranked[n].count);
 		strbuf_chr(desc, ')');
 	}
 	strbuf_chr(desc, '\n');
@@ -950,14 +2280,14 @@ exploitants_load(char *path)
 			continue;
 		}
 
-		exploitant = malloc(sizeof(struct exploitant));
+		exploitant = arena_alloc(&exploitants->arena, sizeof(struct exploitant));
 		exploitant->adm_id = adm_id;
 		csv_str(csv, &exploitant->adm_lb_nom);
 		verb("exploitant id %d : %s\n", adm_id, exploitant->adm_lb_nom);
 		exploitants->table[exploitant->adm_id] = exploitant;
 		exploitants->count++;
 	}
-	printf("%d exploitants\n", exploitants->count);
+	msg("%d exploitants\n", exploitants->count);
 
 	return exploitants;
 }
@@ -965,15 +2295,28 @@ exploitants_load(char *path)
 void
 exploitants_free(struct f_exploitant *exploitants)
 {
-	int n;
-
-	for (n=0; n<EXPLOITANT_ID_MAX; n++)
-		if (exploitants->table[n])
-			free(exploitants->table[n]);
+	arena_free(&exploitants->arena);
 	csv_close(&exploitants->csv);
 	free(exploitants);
 }
 
+void
+exploitants_snapshot(struct snap *snap, struct f_exploitant *exploitants)
+{
+	struct exploitant *exploitant;
+	int n;
+
+	snap_region(snap, exploitants, sizeof(struct f_exploitant));
+	csv_snapshot(snap, &exploitants->csv);
+	arena_snapshot(snap, &exploitants->arena);
+	for (n=0; n<EXPLOITANT_ID_MAX; n++) {
+		if (!(exploitant = exploitants->table[n]))
+			continue;
+		snap_ptr(snap, &exploitants->table[n]);
+		snap_ptr(snap, &exploitant->adm_lb_nom);
+	}
+}
+
 const char *
 exploitant_get_name(struct f_exploitant *f, int adm_id)
 {
@@ -984,82 +2327,89 @@ exploitant_get_name(struct f_exploitant *f, int adm_id)
 	return f->table[adm_id]->adm_lb_nom;
 }
 
-struct f_emetteur *
-emetteurs_load(char *path, struct f_station *stations, struct f_antenne *antennes)
+void
+emetteurs_parse(void *arg, int n)
 {
-	struct f_emetteur *emetteurs;
-	struct csv *csv;
+	struct csv_batch *batch = (struct csv_batch *)arg + n;
+	struct csv *csv = &batch->csv;
 	struct emetteur *emr;
-	int emr_id, sys_id;
-	char *emr_id_str;
-	struct station *sta;
-	struct antenne *aer;
-
-	emetteurs = xmalloc_zero(sizeof(struct f_emetteur));
-	csv = &emetteurs->csv;
-	csv_open(csv, path, CSV_NORMAL, ';', 0);
 
 	while (csv_line(csv)) {
 		if (!isdigit(csv->line[0]))
 			continue; /* comment or header */
-		csv_int(csv, &emr_id, &emr_id_str);
-		if (emr_id >= EMETTEUR_ID_MAX)
-			errx(1, "emetteur id too big: %d", emr_id);
-		if (emetteurs->table[emr_id]) {
-			warn_incoherent_data("line %d: emetteur %d already exists, ignoring", csv->line_count, emr_id);
-			continue;
-		}
-
-		emr = malloc(sizeof(struct emetteur));
-		emr->emr_id = emr_id;
-		emr->emr_id_str = emr_id_str;
-		csv_str(csv, &emr->emr_lb_systeme);
+		emr = arena_alloc(&batch->arena, sizeof(struct emetteur));
+		csv_int(csv, &emr->emr_id, &emr->emr_id_str);
+		csv_dict(csv, &batch->dict, &emr->systeme_id);
 		csv_stanm(csv, &emr->sta_nm);
 		csv_int(csv, &emr->aer_id, NULL);
 		csv_date(csv, NULL, &emr->emr_dt_service_str);
+		emr->bandes = NULL;
 		emr->bande_count = 0;
+		csv_batch_add(batch, emr);
+	}
+}
 
-		/* lookup the systeme of this emetteur and link it to emetteur */
-		for (sys_id=0; sys_id<emetteurs->systeme_count; sys_id++)
-			if (!strcmp(emr->emr_lb_systeme, emetteurs->systemes_lb[sys_id]))
-				break;
-		if (sys_id == emetteurs->systeme_count) {
-			/* add a new systeme */
+struct f_emetteur *
+emetteurs_load(char *path, struct f_station *stations, struct f_antenne *antennes)
+{
+	struct f_emetteur *emetteurs;
+	struct csv_batch *batches, *batch;
+	struct emetteur *emr;
+	int batch_count, offset, n, r, sys_id;
+	struct station *sta;
+	struct antenne *aer;
+
+	emetteurs = xmalloc_zero(sizeof(struct f_emetteur));
+	csv_open(&emetteurs->csv, path, CSV_NORMAL, ';', 0);
+
+	/* parse chunks of the file in parallel, then link the rows in file order */
+	batch_count = conf.jobs > 1 ? conf.jobs * 4 : 1;
+	batches = csv_batches(&emetteurs->csv, &batch_count);
+	parallel_for(batch_count, conf.jobs, emetteurs_parse, batches);
+
+	offset = emetteurs->csv.line_count;
+	for (n=0; n<batch_count; n++) {
+		batch = &batches[n];
+		for (r=0; r<batch->count; r++) {
+			emr = batch->rows[r];
+			if (idx_pos(&emetteurs->index, emr->emr_id) >= 0) {
+				warn_incoherent_data("line %d: emetteur %d already exists, ignoring", offset + batch->lines[r], emr->emr_id);
+				bzero(emr, sizeof(struct emetteur)); /* stays in the arena, without pointers for the snapshot */
+				continue;
+			}
+
+			/* code the systeme of this emetteur by order of appearance in the file */
+			sys_id = csv_batch_code(batch, &emetteurs->systemes, emr->systeme_id);
 			if (sys_id >= SYSTEMES_ID_MAX)
 				errx(1, "exceeded system id %d", sys_id);
-			emetteurs->systemes_lb[emetteurs->systeme_count] = emr->emr_lb_systeme;
-			emetteurs->systeme_count++;
-		}
-		emr->systeme_id = sys_id;
-		emetteurs->systemes_count[sys_id]++;
+			emr->systeme_id = sys_id;
+			emetteurs->systemes_count[sys_id]++;
 
-		/* update related station */
-		sta = station_get(stations, &emr->sta_nm);
-		if (!sta) {
-			warn_incoherent_data("station %s not found for emetteur %d, ignoring", emr->sta_nm.str, emr_id);
-			free(emr);
-			continue;
+			/* update related station */
+			sta = station_get(stations, &emr->sta_nm);
+			if (!sta) {
+				warn_incoherent_data("station %s not found for emetteur %d, ignoring", emr->sta_nm.str, emr->emr_id);
+				bzero(emr, sizeof(struct emetteur));
+				continue;
+			}
+			csr_link(&emetteurs->station_emetteurs, sta, emr);
+
+			/* link to antenne */
+			aer = idx_get(&antennes->index, emr->aer_id);
+			if (aer)
+				csr_link(&emetteurs->antenne_emetteurs, aer, emr);
+			else
+				warn_incoherent_data("emetteur %d refers to non-existing antenne %d", emr->emr_id, emr->aer_id);
+
+			idx_put(&emetteurs->index, emr->emr_id, emr);
+			emetteurs->count++;
 		}
-		if (sta->emetteur_count == STATION_EMETTEUR_MAX)
-			errx(1, "maximum emetteur count %d reached for station %s", STATION_EMETTEUR_MAX, sta->sta_nm.str);
-		sta->emetteurs[sta->emetteur_count] = emr;
-		sta->emetteur_count++;
-		sta->systeme_count[sys_id]++;
-
-		/* link to antenne */
-		aer = antennes->table[emr->aer_id];
-		if (aer) {
-			if (aer->emetteur_count == ANTENNE_EMETTEUR_MAX)
-				errx(1, "maximum number of emetteurs %d reached for antenne %d", ANTENNE_EMETTEUR_MAX, aer->aer_id);
-			aer->emetteurs[aer->emetteur_count] = emr;
-			aer->emetteur_count++;
-		} else
-			warn_incoherent_data("emetteur %d refers to non-existing antenne %d", emr_id, emr->aer_id);
-
-		emetteurs->table[emr->emr_id] = emr;
-		emetteurs->count++;
-	}
-	printf("%d emetteurs and %d systemes\n", emetteurs->count, emetteurs->systeme_count);
+		offset += batch->csv.line_count;
+	}
+	csv_batches_free(batches, batch_count, &emetteurs->arena);
+	csr_build(&emetteurs->station_emetteurs, offsetof(struct station, emetteurs), offsetof(struct station, emetteur_count));
+	csr_build(&emetteurs->antenne_emetteurs, offsetof(struct antenne, emetteurs), offsetof(struct antenne, emetteur_count));
+	msg("%d emetteurs and %d systemes\n", emetteurs->count, emetteurs->systemes.count);
 
 	return emetteurs;
 }
@@ -1067,25 +2417,48 @@ emetteurs_load(char *path, struct f_station *stations, struct f_antenne *antenne
 void
 emetteurs_free(struct f_emetteur *emetteurs)
 {
-	int n;
-
-	for (n=0; n<EMETTEUR_ID_MAX; n++)
-		if (emetteurs->table[n])
-			free(emetteurs->table[n]);
+	arena_free(&emetteurs->arena);
+	idx_free(&emetteurs->index);
+	csr_free(&emetteurs->station_emetteurs);
+	csr_free(&emetteurs->antenne_emetteurs);
 	csv_close(&emetteurs->csv);
 	free(emetteurs);
 }
 
+void
+emetteurs_snapshot(struct snap *snap, struct f_emetteur *emetteurs)
+{
+	struct emetteur *emr;
+	int n;
+
+	snap_region(snap, emetteurs, sizeof(struct f_emetteur));
+	csv_snapshot(snap, &emetteurs->csv);
+	arena_snapshot(snap, &emetteurs->arena);
+	idx_snapshot(snap, &emetteurs->index);
+	dict_snapshot(snap, &emetteurs->systemes);
+	csr_snapshot(snap, &emetteurs->station_emetteurs);
+	csr_snapshot(snap, &emetteurs->antenne_emetteurs);
+	for (n=0; n<emetteurs->index.count; n++) {
+		emr = emetteurs->index.items[n];
+		snap_ptr(snap, &emr->emr_id_str);
+		snap_ptr(snap, &emr->sta_nm.str);
+		snap_ptr(snap, &emr->emr_dt_service_str);
+		snap_ptr(snap, &emr->bandes);
+	}
+}
+
 const char *
 emetteurs_stats(struct f_emetteur *emetteurs)
 {
 	static char buf[2048];
 	char buf2[1024];
-	int sys_id = 0, count = 0;
+	struct histo_entry ranked[SYSTEMES_ID_MAX];
+	int n, count;
 
 	buf[0] = '\0';
-	while ( (count = next_smallest_positive_int(emetteurs->systemes_count, SYSTEMES_ID_MAX, count, sys_id, &sys_id)) > 0 ) {
-		snprintf(buf2, sizeof(buf2), "%6d %s\n", count, emetteurs->systemes_lb[sys_id]);
+	count = histo_rank(emetteurs->systemes_count, SYSTEMES_ID_MAX, ranked);
+	for (n=0; n<count; n++) {
+		snprintf(buf2, sizeof(buf2), "%6d %s\n", ranked[n].count, dict_label(&emetteurs->systemes, ranked[n].index));
 		strcat(buf, buf2);
 	}
 
@@ -1095,113 +2468,193 @@ emetteurs_stats(struct f_emetteur *emetteurs)
 struct emetteur *
 emetteur_get(struct f_emetteur *emetteurs, int emr_id)
 {
-	if (emr_id > EMETTEUR_ID_MAX)
-		errx(1, "too big emetteur id %d", emr_id);
+	return idx_get(&emetteurs->index, emr_id);
+}
+
+int
+emetteur_cmp(const void *a, const void *b)
+{
+	const struct emetteur *emr_a = *(struct emetteur **)a, *emr_b = *(struct emetteur **)b;
 
-	return emetteurs->table[emr_id];
+	return (emr_a->emr_id < emr_b->emr_id) - (emr_a->emr_id > emr_b->emr_id);
 }
 
-/* returns the next emetteur with smallest id larger than 'last' in 'table' */
-struct emetteur *
-emetteur_get_next(struct emetteur **table, int count, struct emetteur *last)
+void
+bandes_parse(void *arg, int n)
 {
-	struct emetteur *next = NULL, *emr;
-	int n;
+	struct csv_batch *batch = (struct csv_batch *)arg + n;
+	struct csv *csv = &batch->csv;
+	struct bande *ban;
 
-	for (n=0; n<count; n++) {
-		emr = table[n];
-		if ( (!last || emr->emr_id < last->emr_id)
-				&& (!next || emr->emr_id > next->emr_id) )
-			next = emr;
+	while (csv_line(csv)) {
+		if (!isdigit(csv->line[0]))
+			continue; /* comment or header */
+		ban = arena_alloc(&batch->arena, sizeof(struct bande));
+		csv_stanm(csv, &ban->sta_nm);
+		csv_int(csv, &ban->ban_id, NULL);
+		csv_int(csv, &ban->emr_id, NULL);
+		csv_float(csv, NULL, &ban->ban_nb_f_deb_str);
+		csv_float(csv, NULL, &ban->ban_nb_f_fin_str);
+		csv_dict(csv, &batch->dict, &ban->ban_fg_unite);
+		csv_batch_add(batch, ban);
 	}
-
-	return next;
 }
 
 struct f_bande *
 bandes_load(char *path, struct f_emetteur *emetteurs)
 {
 	struct f_bande *bandes;
-	struct csv *csv;
+	struct csv_batch *batches, *batch;
 	struct bande *ban;
-	struct sta_nm sta_nm;
 	struct emetteur *emr;
-	int ban_id;
-	double deb, fin;
+	struct bande_columns *cols;
+	struct bande_fill fill;
+	int batch_count, n, r;
 
 	bandes = xmalloc_zero(sizeof(struct f_bande));
-	csv = &bandes->csv;
-	csv_open(csv, path, CSV_NORMAL, ';', 0);
-
-	while (csv_line(csv)) {
-		if (!isdigit(csv->line[0]))
-			continue; /* comment or header */
-		csv_stanm(csv, &sta_nm);
-		csv_int(csv, &ban_id, NULL);
-		if (ban_id >= BANDE_ID_MAX)
-			errx(1, "bande id too big: %d", ban_id);
-
-		ban = malloc(sizeof(struct bande));
-		memcpy(&ban->sta_nm, &sta_nm, sizeof(sta_nm));
-		ban->ban_id = ban_id;
-		csv_int(csv, &ban->emr_id, NULL);
-		csv_float(csv, &deb, &ban->ban_nb_f_deb_str);
-		csv_float(csv, &fin, &ban->ban_nb_f_fin_str);
-		csv_str(csv, &ban->ban_fg_unite);
-		if (ban->ban_fg_unite) {
-			switch (ban->ban_fg_unite[0]) {
-			case 'K':
-				ban->ban_nb_f_deb = deb * 1000;
-				ban->ban_nb_f_fin = fin * 1000;
-				break;
-			case 'M':
-				ban->ban_nb_f_deb = deb * 1000000;
-				ban->ban_nb_f_fin = fin * 1000000;
-				break;
-			case 'G':
-				ban->ban_nb_f_deb = deb * 1000000000;
-				ban->ban_nb_f_fin = fin * 1000000000;
-				break;
+	csv_open(&bandes->csv, path, CSV_NORMAL, ';', 0);
+
+	/* parse chunks of the file in parallel, then link the rows in file order */
+	batch_count = conf.jobs > 1 ? conf.jobs * 4 : 1;
+	batches = csv_batches(&bandes->csv, &batch_count);
+	parallel_for(batch_count, conf.jobs, bandes_parse, batches);
+
+	for (n=0; n<batch_count; n++) {
+		batch = &batches[n];
+		for (r=0; r<batch->count; r++) {
+			ban = batch->rows[r];
+			emr = emetteur_get(emetteurs, ban->emr_id);
+			if (!emr) {
+				warn_incoherent_data("emetteur %d not found for bande %d, ignoring", ban->emr_id, ban->ban_id);
+				bzero(ban, sizeof(struct bande)); /* stays in the arena, without pointers for the snapshot */
+				continue;
 			}
+			csr_link(&bandes->emetteur_bandes, emr, ban);
+			ban->ban_fg_unite = csv_batch_code(batch, &bandes->unites, ban->ban_fg_unite);
+
+			idx_put(&bandes->index, ban->ban_id, ban);
+			bandes->count++;
 		}
+	}
+	csv_batches_free(batches, batch_count, &bandes->arena);
+	csr_build(&bandes->emetteur_bandes, offsetof(struct emetteur, bandes), offsetof(struct emetteur, bande_count));
+
+	/* frequencies columns, filled in parallel by ranges of emetteurs */
+	cols = &bandes->columns;
+	cols->count = bandes->emetteur_bandes.count;
+	cols->f_deb = malloc((cols->count + 1) * sizeof(uint64_t));
+	cols->f_fin = malloc((cols->count + 1) * sizeof(uint64_t));
+	cols->emr_pos = malloc((cols->count + 1) * sizeof(int));
+	if (!cols->f_deb || !cols->f_fin || !cols->emr_pos)
+		err(1, "malloc");
+	fill.bandes = bandes;
+	fill.emetteurs = emetteurs;
+	parallel_for((emetteurs->index.count + BANDE_FILL_CHUNK - 1) / BANDE_FILL_CHUNK, conf.jobs, bandes_fill, &fill);
+	msg("%d bandes\n", bandes->count);
+
+	return bandes;
+}
 
-		emr = emetteur_get(emetteurs, ban->emr_id);
-		if (!emr) {
-			warn_incoherent_data("emetteur %d not found for bande %d, ignoring", ban->emr_id, ban_id);
-			free(ban);
+/* fills the frequencies columns for the bandes of chunk 'n' of the emetteurs index */
+void
+bandes_fill(void *arg, int n)
+{
+	struct bande_fill *fill = arg;
+	struct bande_columns *cols = &fill->bandes->columns;
+	struct idx *index = &fill->emetteurs->index;
+	struct emetteur *emr;
+	struct bande *ban;
+	int e, b, pos, end;
+	char unite;
+
+	end = (n + 1) * BANDE_FILL_CHUNK < index->count ? (n + 1) * BANDE_FILL_CHUNK : index->count;
+	for (e=n*BANDE_FILL_CHUNK; e<end; e++) {
+		emr = index->items[e];
+		if (emr->bande_count == 0)
 			continue;
+		pos = emetteur_bandes_pos(fill->bandes, emr);
+		for (b=0; b<emr->bande_count; b++, pos++) {
+			ban = emr->bandes[b];
+			unite = dict_label(&fill->bandes->unites, ban->ban_fg_unite)[0];
+			cols->f_deb[pos] = bande_hz(ban->ban_nb_f_deb_str, unite);
+			cols->f_fin[pos] = bande_hz(ban->ban_nb_f_fin_str, unite);
+			cols->emr_pos[pos] = e;
 		}
-		if (emr->bande_count == EMETTEUR_BAND_MAX)
-			errx(1, "maximum band count %d reached for emetteur %d", EMETTEUR_BAND_MAX, emr->emr_id);
-		emr->bandes[emr->bande_count] = ban;
-		emr->bande_count++;
+	}
+}
 
-		bandes->table[ban_id] = ban;
-		bandes->count++;
+/* returns frequency 'str' of unit 'unite' (K, M or G) in Hz, 0 when unknown */
+uint64_t
+bande_hz(char *str, char unite)
+{
+	double f;
+
+	if (!str)
+		return 0;
+	f = atof_fast(str);
+	switch (unite) {
+	case 'K':
+		return f * 1000;
+	case 'M':
+		return f * 1000000;
+	case 'G':
+		return f * 1000000000;
 	}
-	printf("%d bandes\n", bandes->count);
+	return 0;
+}
 
-	return bandes;
+/* position in the f_bande columns of the first bande of 'emr', which must have bandes */
+int
+emetteur_bandes_pos(struct f_bande *bandes, struct emetteur *emr)
+{
+	return emr->bandes - (struct bande **)bandes->emetteur_bandes.children;
 }
 
 void
 bandes_free(struct f_bande *bandes)
 {
-	int n;
-
-	for (n=0; n<BANDE_ID_MAX; n++)
-		if (bandes->table[n])
-			free(bandes->table[n]);
+	arena_free(&bandes->arena);
+	idx_free(&bandes->index);
+	csr_free(&bandes->emetteur_bandes);
+	free(bandes->columns.f_deb);
+	free(bandes->columns.f_fin);
+	free(bandes->columns.emr_pos);
 	csv_close(&bandes->csv);
 	free(bandes);
 }
 
+void
+bandes_snapshot(struct snap *snap, struct f_bande *bandes)
+{
+	struct bande *ban;
+	int n;
+
+	snap_region(snap, bandes, sizeof(struct f_bande));
+	csv_snapshot(snap, &bandes->csv);
+	arena_snapshot(snap, &bandes->arena);
+	idx_snapshot(snap, &bandes->index);
+	csr_snapshot(snap, &bandes->emetteur_bandes);
+	snap_data(snap, bandes->columns.f_deb, (bandes->columns.count + 1) * sizeof(uint64_t));
+	snap_data(snap, bandes->columns.f_fin, (bandes->columns.count + 1) * sizeof(uint64_t));
+	snap_data(snap, bandes->columns.emr_pos, (bandes->columns.count + 1) * sizeof(int));
+	snap_ptr(snap, &bandes->columns.f_deb);
+	snap_ptr(snap, &bandes->columns.f_fin);
+	snap_ptr(snap, &bandes->columns.emr_pos);
+	for (n=0; n<bandes->index.count; n++) {
+		ban = bandes->index.items[n];
+		snap_ptr(snap, &ban->sta_nm.str);
+		snap_ptr(snap, &ban->ban_nb_f_deb_str);
+		snap_ptr(snap, &ban->ban_nb_f_fin_str);
+	}
+	dict_snapshot(snap, &bandes->unites);
+}
+
 struct f_antenne *
 antennes_load(char *path, struct f_station *stations)
 {
 	struct f_antenne *antennes;
 	struct csv *csv;
-	struct antenne *aer;
+	struct antenne *aer, *known;
 	struct station *sta;
 	struct sta_nm sta_nm;
 	int aer_id;
@@ -1216,22 +2669,22 @@ antennes_load(char *path, struct f_station *stations)
 			continue; /* comment or header */
 		csv_stanm(csv, &sta_nm);
 		csv_int(csv, &aer_id, &aer_id_str);
-		if (aer_id >= ANTENNE_ID_MAX)
-			errx(1, "antenne id too big: %d", aer_id);
 
-		if (antennes->table[aer_id]) {
-			aer = antennes->table[aer_id];
+		known = idx_get(&antennes->index, aer_id);
+		if (known) {
+			aer = known;
 		} else {
-			aer = malloc(sizeof(struct antenne));
+			aer = arena_alloc(&antennes->arena, sizeof(struct antenne));
 			memcpy(&aer->sta_nm, &sta_nm, sizeof(sta_nm));
 			aer->aer_id = aer_id;
 			aer->aer_id_str = aer_id_str;
 			csv_int(csv, &aer->tae_id, NULL);
 			csv_str(csv, &aer->aer_nb_dimension_str); // we may need csv_float() in the future
-			csv_str(csv, &aer->aer_fg_rayon);
+			csv_dict(csv, &antennes->rayons, &aer->aer_fg_rayon);
 			csv_str(csv, &aer->aer_nb_azimut_str); // we may need csv_float() in the future
 			csv_str(csv, &aer->aer_nb_alt_bas_str); // we may need csv_float() in the future
 			csv_int(csv, NULL, &aer->sup_id_str);
+			aer->emetteurs = NULL;
 			aer->emetteur_count = 0;
 		}
 
@@ -1239,22 +2692,20 @@ antennes_load(char *path, struct f_station *stations)
 		sta = station_get(stations, &sta_nm);
 		if (!sta) {
 			warn_incoherent_data("station %s not found for antenne %d, ignoring", sta_nm.str, aer_id);
-			if (!antennes->table[aer_id])
-				free(aer); /* free only if it is new antenne, not attached to other stations */
+			if (!known)
+				arena_pop(&antennes->arena, aer); /* free only if it is new antenne, not attached to other stations */
 			continue;
 		}
-		if (sta->antenne_count == STATION_ANTENNE_MAX)
-			errx(1, "maximum antenne count %d reached for station %s", STATION_ANTENNE_MAX, sta_nm.str);
-		sta->antennes[sta->antenne_count] = aer;
-		sta->antenne_count++;
+		csr_link(&antennes->station_antennes, sta, aer);
 
-		if (!antennes->table[aer_id]) {
+		if (!known) {
 			/* multiple antennes with same ID is allowed, we store it once for reference */
-			antennes->table[aer_id] = aer;
+			idx_put(&antennes->index, aer_id, aer);
 			antennes->count++;
 		}
 	}
-	printf("%d antennes\n", antennes->count);
+	csr_build(&antennes->station_antennes, offsetof(struct station, antennes), offsetof(struct station, antenne_count));
+	msg("%d antennes\n", antennes->count);
 
 	return antennes;
 }
@@ -1262,35 +2713,43 @@ antennes_load(char *path, struct f_station *stations)
 void
 antennes_free(struct f_antenne *antennes)
 {
-	int n, freed_antennes = 0;
-
-	for (n=0; n<ANTENNE_ID_MAX; n++) {
-		if (antennes->table[n]) {
-			free(antennes->table[n]);
-			freed_antennes++;
-		}
-	}
-	if (antennes->count != freed_antennes)
-		warnx("freed_antennes %d != antennes count %d", freed_antennes, antennes->count);
+	arena_free(&antennes->arena);
+	idx_free(&antennes->index);
+	csr_free(&antennes->station_antennes);
 	csv_close(&antennes->csv);
 	free(antennes);
 }
 
-/* returns the next antenne with smallest id larger than 'last' in 'table' */
-struct antenne *
-antenne_get_next(struct antenne **table, int count, struct antenne *last)
+void
+antennes_snapshot(struct snap *snap, struct f_antenne *antennes)
 {
-	struct antenne *next = NULL, *aer;
+	struct antenne *aer;
 	int n;
 
-	for (n=0; n<count; n++) {
-		aer = table[n];
-		if ( (!last || aer->aer_id < last->aer_id)
-				&& (!next || aer->aer_id > next->aer_id) )
-			next = aer;
+	snap_region(snap, antennes, sizeof(struct f_antenne));
+	csv_snapshot(snap, &antennes->csv);
+	arena_snapshot(snap, &antennes->arena);
+	idx_snapshot(snap, &antennes->index);
+	csr_snapshot(snap, &antennes->station_antennes);
+	for (n=0; n<antennes->index.count; n++) {
+		aer = antennes->index.items[n];
+		snap_ptr(snap, &aer->sta_nm.str);
+		snap_ptr(snap, &aer->aer_id_str);
+		snap_ptr(snap, &aer->aer_nb_dimension_str);
+		snap_ptr(snap, &aer->aer_nb_azimut_str);
+		snap_ptr(snap, &aer->aer_nb_alt_bas_str);
+		snap_ptr(snap, &aer->sup_id_str);
+		snap_ptr(snap, &aer->emetteurs);
 	}
+	dict_snapshot(snap, &antennes->rayons);
+}
 
-	return next;
+int
+antenne_cmp(const void *a, const void *b)
+{
+	const struct antenne *aer_a = *(struct antenne **)a, *aer_b = *(struct antenne **)b;
+
+	return (aer_a->aer_id < aer_b->aer_id) - (aer_a->aer_id > aer_b->aer_id);
 }
 
 struct f_type_antenne *
@@ -1315,7 +2774,7 @@ types_antenne_load(char *path)
 		csv_str(csv, &types_antenne->table[tae_id]);
 		types_antenne->count++;
 	}
-	printf("%d types of antenne\n", types_antenne->count);
+	msg("%d types of antenne\n", types_antenne->count);
 
 	return types_antenne;
 }
@@ -1327,6 +2786,17 @@ types_antenne_free(struct f_type_antenne *types_antenne)
 	free(types_antenne);
 }
 
+void
+types_antenne_snapshot(struct snap *snap, struct f_type_antenne *types_antenne)
+{
+	int n;
+
+	snap_region(snap, types_antenne, sizeof(struct f_type_antenne));
+	csv_snapshot(snap, &types_antenne->csv);
+	for (n=0; n<TYPE_ANTENNE_ID_MAX; n++)
+		snap_ptr(snap, &types_antenne->table[n]);
+}
+
 char *
 type_antenne_get(struct f_type_antenne *types, int tae_id)
 {
@@ -1337,315 +2807,1574 @@ type_antenne_get(struct f_type_antenne *types, int tae_id)
 	return types->table[tae_id];
 }
 
+/* renders the placemarks of a chunk of supports, to be appended to the kml files in sup_id order by output_kml_write().
+ * all kml files but the light one share the same placemark text for a support */
 void
-output_kml(struct anfr_set *set, const char *output_dir, const char *source_name)
+output_kml_render(void *arg)
 {
-	int idx, sup_count, n, e, len_stalist, len_desc, kml_count, style, diff;
+	struct kml_chunk *chunk = arg;
+	struct anfr_set *set = chunk->out->set;
+	struct kml_rendered *rendered;
+	int idx, n, i, e, len_stalist, len_desc, style;
 	int sup_systeme_ids[SYSTEMES_ID_MAX];
 	struct support *sup;
 	char desc[SUPPORT_DESCRIPTION_BUF_SIZE], stalist[SUPPORT_DESCRIPTION_BUF_SIZE];
-	char path[PATH_MAX], buf[1024], buf2[128], expllist[4096];
-	struct kml *kmls_tpo[PROPRIETAIRE_ID_MAX];
-	struct kml *kmls_dept[SUPPORT_CP_DEPT_MAX];
-	struct kml *kmls_sys[SYSTEMES_ID_MAX];
-	struct kml *ka_tpo, *ka_dept, *ka_dept_light, *k_tpo, *k_dept, *k_sys;
+	char name[4096], *p, *namep, *expllist;
 	const char *tpo_name, *exploitant_name;
-	struct stat fstat;
-	struct station *sta;
+	struct station *sta, *prev;
 	struct emetteur *emr;
-	struct tm *ts_begin;
-
-	if (stat(output_dir, &fstat) == -1)
-		mkdir(output_dir, 0755);
-	snprintf(path, sizeof(path), "%s/anfr_proprietaire", output_dir);
-	if (stat(path, &fstat) == -1)
-		mkdir(path, 0755);
-	snprintf(path, sizeof(path), "%s/anfr_departement", output_dir);
-	if (stat(path, &fstat) == -1)
-		mkdir(path, 0755);
-	snprintf(path, sizeof(path), "%s/anfr_systeme", output_dir);
-	if (stat(path, &fstat) == -1)
-		mkdir(path, 0755);
-	bzero(kmls_tpo, sizeof(kmls_tpo));
-	bzero(kmls_dept, sizeof(kmls_dept));
-	bzero(kmls_sys, sizeof(kmls_sys));
-
-	/* open the main kml files */
-	snprintf(path, sizeof(path), "%s/anfr_proprietaires.kml", output_dir);
-	snprintf(buf, sizeof(buf), "ANFR antennes %s per proprietaire", source_name);
-	ka_tpo = kml_open(path, buf, KML_ANFR_DESCRIPTION);
-	snprintf(path, sizeof(path), "%s/anfr_departements.kml", output_dir);
-	snprintf(buf, sizeof(buf), "ANFR antennes %s per departement", source_name);
-	ka_dept = kml_open(path, buf, KML_ANFR_DESCRIPTION);
-	snprintf(path, sizeof(path), "%s/anfr_departements_light.kml", output_dir);
-	snprintf(buf, sizeof(buf), "ANFR antennes %s per departement (light)", source_name);
-	ka_dept_light = kml_open(path, buf, KML_ANFR_DESCRIPTION);
-	kml_count = 3;
-
-	/* iterate over supports and append to aggregated and per-proprietaire kml files */
-	for (idx=0, sup_count=0;
-			idx < SUPPORTS_ID_MAX && sup_count < set->supports->count;
-			idx++) {
-		sup = set->supports->table[idx];
-		if (!sup)
-			continue;
-		sup_count++;
+	int32_t ts_begin;
+	struct iovec desc_parts[2];
+
+	chunk->rendered = xmalloc_zero(chunk->count * sizeof(struct kml_rendered));
+	chunk->systemes = xmalloc_zero(chunk->count * SYSTEMES_ID_MAX * sizeof(int));
+	for (idx=0; idx<chunk->count; idx++) {
+		sup = set->supports->index.items[chunk->out->sups[chunk->first + idx]];
+		rendered = &chunk->rendered[idx];
 		tpo_name = proprietaire_get_name(set->proprietaires, sup->tpo_id);
 
-		/* find kml file matching the proprietaire */
-		if (!kmls_tpo[sup->tpo_id]) {
-			snprintf(path, sizeof(path), "%s/anfr_proprietaire/anfr_proprietaire_%d_%s.kml", output_dir, sup->tpo_id, pathable(tpo_name));
-			snprintf(buf, sizeof(buf), "ANFR antennes %s %s (%d)", source_name, pathable(tpo_name), sup->tpo_id);
-			kmls_tpo[sup->tpo_id] = kml_open(path, buf, KML_ANFR_DESCRIPTION);
-			kml_count++;
-		}
-		k_tpo = kmls_tpo[sup->tpo_id];
-		/* find kml file matching the departement */
-		if (!kmls_dept[sup->dept]) {
-			snprintf(path, sizeof(path), "%s/anfr_departement/anfr_departement_%02X.kml", output_dir, sup->dept);
-			snprintf(buf, sizeof(buf), "ANFR antennes %s %02X", source_name, sup->dept);
-			kmls_dept[sup->dept] = kml_open(path, buf, KML_ANFR_DESCRIPTION);
-			kml_count++;
-		}
-		k_dept = kmls_dept[sup->dept];
-
-		/* write kml files content */
 		/* description summary */
-		len_desc = snprintf(desc, sizeof(desc), "support %d '%s' %s\n", sup->sup_id, tpo_name, nature_get_name(set->natures, sup->nat_id));
+		p = desc;
+		strbuf_lit(p, "support ");
+		strbuf_int(p, sup->sup_id);
+		strbuf_lit(p, " '");
+		strbuf_str(p, tpo_name);
+		strbuf_lit(p, "' ");
+		strbuf_str(p, nature_get_name(set->natures, sup->nat_id));
+		strbuf_chr(p, '\n');
+		len_desc = p - desc;
 		len_desc += append_not_empty(desc+len_desc, sup->adr_lb_add0);
 		len_desc += append_not_empty(desc+len_desc, sup->adr_lb_add2);
 		len_desc += append_not_empty(desc+len_desc, sup->adr_lb_add3);
 		len_desc += append_not_empty(desc+len_desc, sup->adr_lb_lieu);
 		len_desc += append_not_empty(desc+len_desc, sup->adr_nm_cp_str);
-		/* description station list summary and full station list */
-		stalist[0] = '\0';
-		expllist[0] = '\0';
+		/* description station list summary and full station list, and name with the list of exploitants */
 		len_stalist = 0;
-		if (conf.no_color == 1)
-			style = KML_STYLE_DISABLED;
-		else
-			style = KML_STYLE_1_BLUE;
-		sta = NULL;
-		ts_begin = NULL;
-		for (n=0; n<sup->sta_count; n++) {
-			sta = station_get_next(set->stations, sup->sta_nm_anfr, sup->sta_count, sta);
+		namep = name;
+		if (sup->sta_count > 1) {
+			strbuf_chr(namep, '[');
+			strbuf_int(namep, sup->sta_count);
+			strbuf_lit(namep, "] ");
+		}
+		expllist = namep;
+		style = support_style(set, sup);
+		prev = NULL;
+		ts_begin = DAY_NONE;
+		for (n=0, i=0; n<sup->sta_count; n++) {
+			/* stations are ordered by set_finalize() */
+			sta = station_get(set->stations, sup->sta_nm_anfr[n]);
 			if (!sta) {
-				warn_incoherent_data("missing stations for support %d, ignoring", sup->sup_id);
+				warn_incoherent_data("station %s not found for support %d, ignoring", sup->sta_nm_anfr[n]->str, sup->sup_id);
 				continue;
 			}
+			if (sta == prev)
+				continue; /* listed twice */
+			prev = sta;
+			i++;
 			exploitant_name = exploitant_get_name(set->exploitants, sta->adm_id);
-			if (expllist[0] != '\0')
-				strcat(expllist, ", ");
-			snprintf(buf, sizeof(buf), "%s (%d)", exploitant_name, sta->emetteur_count);
-			strcat(expllist, buf);
-			len_desc += sprintf(desc+len_desc, "#%d %s '%s' %s %s (%d)\n    ",
-					n+1, sta->sta_nm.str, exploitant_name, sta->dte_modif_str, sta->dte_en_service_str, sta->emetteur_count);
-			len_desc += station_systemes(set->emetteurs, sta, desc+len_desc);
-			len_stalist += sprintf(stalist+len_stalist, "-------------------\nstation #%d %s '%s'\n",
-					n+1, sta->sta_nm.str, exploitant_name);
-			len_stalist += station_description(set->types_antenne, sta, stalist + len_stalist);
+			if (namep - name + strlen(exploitant_name) + 16 >= sizeof(name))
+				errx(1, "output_kml: name of support %d exceeded buffer size %lu", sup->sup_id, sizeof(name));
+			if (namep != expllist)
+				strbuf_lit(namep, ", ");
+			strbuf_str(namep, exploitant_name);
+			strbuf_lit(namep, " (");
+			strbuf_int(namep, sta->emetteur_count);
+			strbuf_chr(namep, ')');
+			p = desc + len_desc;
+			strbuf_chr(p, '#');
+			strbuf_int(p, i);
+			strbuf_chr(p, ' ');
+			strbuf_str(p, sta->sta_nm.str);
+			strbuf_lit(p, " '");
+			strbuf_str(p, exploitant_name);
+			strbuf_lit(p, "' ");
+			strbuf_str(p, sta->dte_modif_str);
+			strbuf_chr(p, ' ');
+			strbuf_str(p, sta->dte_en_service_str);
+			strbuf_lit(p, " (");
+			strbuf_int(p, sta->emetteur_count);
+			strbuf_lit(p, ")\n    ");
+			p += station_systemes(set->emetteurs, sta, p);
+			len_desc = p - desc;
+			p = stalist + len_stalist;
+			strbuf_lit(p, "-------------------\nstation #");
+			strbuf_int(p, i);
+			strbuf_chr(p, ' ');
+			strbuf_str(p, sta->sta_nm.str);
+			strbuf_lit(p, " '");
+			strbuf_str(p, exploitant_name);
+			strbuf_lit(p, "'\n");
+			p += station_description(set, sta, p);
+			len_stalist = p - stalist;
 			if (len_stalist >= sizeof(stalist))
 				errx(1, "output_kml: description station list output size %d exceeded buffer size %lu", len_stalist, sizeof(stalist));
-			/* update support style based of station time */
-			if (style != KML_STYLE_DISABLED && style < KML_STYLE_3_RED) {
-				diff = tm_diff(&conf.now, &sta->dte_latest);
-				if (diff < 0) {
-					style = KML_STYLE_3_RED; /* if support latest date is more recent than now, mark it as recent anyway */
-				} else {
-					diff = tm_diff(&set->stations->latest, &sta->dte_latest);
-					if (diff < 30)
-						style = KML_STYLE_3_RED;
-					else if (style == KML_STYLE_1_BLUE && diff < 90)
-						style = KML_STYLE_2_ORANGE;
-				}
-			}
-			/* update support timespan begin */
-			if (!ts_begin || tm_diff(&sta->dte_implemntatation, ts_begin) < 0)
-				ts_begin = &sta->dte_implemntatation;
+			/* update support timespan begin, from the known implementation dates */
+			if (sta->dte_implemntatation != DAY_NONE && (ts_begin == DAY_NONE || sta->dte_implemntatation < ts_begin))
+				ts_begin = sta->dte_implemntatation;
 		}
-		memcpy(desc+len_desc, stalist, len_stalist+1);
-		len_desc += len_stalist;
 		if (len_desc >= sizeof(desc))
 			errx(1, "output_kml: description output size %d exceeded buffer size %lu", len_desc, sizeof(desc));
-		/* name */
-		buf2[0] = '\0';
-		if (sup->sta_count > 1)
-			snprintf(buf2, sizeof(buf2), "[%d] ", sup->sta_count);
-		snprintf(buf, sizeof(buf), "%s%s", buf2, expllist);
-		/* append placemark to kmls */
-		kml_add_placemark_point(k_tpo,  sup->tpo_id, tpo_name, sup->sup_id, buf, desc, sup->lat, sup->lon, (float)sup->sup_nm_haut, "relativeToGround", KML_STYLES[style], ts_begin);
-		kml_add_placemark_point(ka_tpo,   sup->tpo_id, tpo_name, sup->sup_id, buf, desc, sup->lat, sup->lon, (float)sup->sup_nm_haut, "relativeToGround", KML_STYLES[style], ts_begin);
-		kml_add_placemark_point(k_dept, sup->tpo_id, tpo_name, sup->sup_id, buf, desc, sup->lat, sup->lon, (float)sup->sup_nm_haut, "relativeToGround", KML_STYLES[style], ts_begin);
-		kml_add_placemark_point(ka_dept, sup->dept, sup->dept_name, sup->sup_id, buf, desc, sup->lat, sup->lon, (float)sup->sup_nm_haut, "relativeToGround", KML_STYLES[style], ts_begin);
-		kml_add_placemark_point(ka_dept_light, sup->dept, sup->dept_name, sup->sup_id, "", "", sup->lat, sup->lon, (float)sup->sup_nm_haut, "relativeToGround", KML_STYLES[style], ts_begin);
-		/* append placemark to systeme kmls */
+		desc_parts[0].iov_base = desc;
+		desc_parts[0].iov_len = len_desc;
+		desc_parts[1].iov_base = stalist;
+		desc_parts[1].iov_len = len_stalist;
+		/* name, limited to 1023 characters */
+		*namep = '\0';
+		if (namep - name > 1023)
+			name[1023] = '\0';
+
+		/* placemarks */
+		if (chunk->text_alloc - chunk->text_len < 2 * KML_PLACEMARK_BUF_SIZE) {
+			chunk->text_alloc = chunk->text_alloc * 2 + 2 * KML_PLACEMARK_BUF_SIZE;
+			chunk->text = realloc(chunk->text, chunk->text_alloc);
+			if (!chunk->text)
+				err(1, "realloc");
+		}
+		rendered->full = chunk->text_len;
+		rendered->full_len = kml_placemark_point(chunk->text + chunk->text_len, KML_PLACEMARK_BUF_SIZE,
+				sup->sup_id, name, desc_parts, 2, sup->lat, sup->lon, (float)sup->sup_nm_haut, "relativeToGround", KML_STYLES[style], ts_begin);
+		chunk->text_len += rendered->full_len;
+		rendered->light = chunk->text_len;
+		rendered->light_len = kml_placemark_point(chunk->text + chunk->text_len, KML_PLACEMARK_BUF_SIZE,
+				sup->sup_id, "", NULL, 0, sup->lat, sup->lon, (float)sup->sup_nm_haut, "relativeToGround", KML_STYLES[style], ts_begin);
+		chunk->text_len += rendered->light_len;
+
+		/* systemes of the support, in order of appearance */
 		bzero(sup_systeme_ids, sizeof(sup_systeme_ids));
+		rendered->systemes = chunk->systemes + idx * SYSTEMES_ID_MAX;
 		for (n=0; n<sup->sta_count; n++) {
-			sta = station_get(set->stations, &sup->sta_nm_anfr[n]);
+			sta = station_get(set->stations, sup->sta_nm_anfr[n]);
 			if (!sta)
 				continue;
 			for (e=0; e<sta->emetteur_count; e++) {
 				emr = sta->emetteurs[e];
 				if (sup_systeme_ids[emr->systeme_id])
 					continue; // support already recorded in that systeme id
-				/* find kml file matching the systeme */
-				if (!kmls_sys[emr->systeme_id]) {
-					strncpy(buf2, emr->emr_lb_systeme, sizeof(buf2));
-					strreplace(buf2, sizeof(buf2), '/', '_');
-					snprintf(path, sizeof(path), "%s/anfr_systeme/anfr_systeme_%s.kml", output_dir, buf2);
-					snprintf(buf2, sizeof(buf2), "ANFR antennes %s %s", source_name, emr->emr_lb_systeme);
-					kmls_sys[emr->systeme_id] = kml_open(path, buf2, KML_ANFR_DESCRIPTION);
-					kml_count++;
-				}
-				k_sys = kmls_sys[emr->systeme_id];
-				snprintf(buf2, sizeof(buf2), "%s, %s", sup->dept_name, emr->emr_lb_systeme);
-				kml_add_placemark_point(k_sys, sup->dept, buf2, sup->sup_id, buf, desc, sup->lat, sup->lon, (float)sup->sup_nm_haut, "relativeToGround", KML_STYLES[style], ts_begin);
+				rendered->systemes[rendered->systemes_count] = emr->systeme_id;
+				rendered->systemes_count++;
 				sup_systeme_ids[emr->systeme_id] = 1;
 			}
 		}
 	}
+}
 
-	/* close all kml files */
-	for (idx=0; idx<PROPRIETAIRE_ID_MAX; idx++) {
-		if (!kmls_tpo[idx])
-			continue;
-		kml_close(kmls_tpo[idx]);
-	}
-	for (idx=0; idx<SUPPORT_CP_DEPT_MAX; idx++) {
-		if (!kmls_dept[idx])
-			continue;
-		kml_close(kmls_dept[idx]);
-	}
-	for (idx=0; idx<SYSTEMES_ID_MAX; idx++) {
-		if (!kmls_sys[idx])
+/* returns the style of the placemark of support 'sup', from the most recent date of its stations
+ * relative to the most recent date of the set */
+int
+support_style(struct anfr_set *set, struct support *sup)
+{
+	struct station *sta;
+	int n, style, diff;
+
+	if (conf.no_color == 1)
+		return KML_STYLE_DISABLED;
+	style = KML_STYLE_1_BLUE;
+	for (n=0; n<sup->sta_count && style < KML_STYLE_3_RED; n++) {
+		sta = station_find(set->stations, sup->sta_nm_anfr[n]);
+		if (!sta || sta->dte_latest == DAY_NONE)
 			continue;
-		kml_close(kmls_sys[idx]);
+		if (sta->dte_latest > conf.now) {
+			style = KML_STYLE_3_RED; /* if support latest date is more recent than now, mark it as recent anyway */
+		} else {
+			diff = set->stations->latest - sta->dte_latest;
+			if (diff < 30)
+				style = KML_STYLE_3_RED;
+			else if (style == KML_STYLE_1_BLUE && diff < 90)
+				style = KML_STYLE_2_ORANGE;
+		}
 	}
-	kml_close(ka_tpo);
-	kml_close(ka_dept);
-	kml_close(ka_dept_light);
 
-	info("created %d kml files\n", kml_count);
+	return style;
 }
 
-/* create one csv file per exploitant containing all the bands sorted by frequency together with their emetteur count and systemes sorted by count
- * <expoitant>_bands.csv
- * freq_min;freq_max;emr_count;systeme1_name;systeme1_count;systeme2_name;systeme2_count[...] */
+/* appends the placemarks rendered by output_kml_render() to the spill file, in sup_id order */
 void
-output_bands(struct anfr_set *set, const char *output_dir, const char *source_name)
+output_kml_spill(void *arg)
 {
-	struct bande_tree tree[EXPLOITANT_ID_MAX];
-	struct bande_tree *ce, *ne, *pe;
-	int count[EXPLOITANT_ID_MAX];
+	struct kml_chunk *chunk = arg;
+	struct kml_output *out = chunk->out;
+	struct kml_rendered *rendered;
+	struct kml_placemark *placemark;
 	struct support *sup;
-	struct station *sta;
-	struct emetteur *emr;
-	struct bande *ban;
-	int prepend, append, s, sc, n, e, b;
-	struct stat fstat;
-	const char *exploitant_name;
-	char *lb;
-	int id;
-	char path[PATH_MAX];
-	FILE *csv;
-
+	int idx, pos;
+
+	if (fwrite(chunk->text, 1, chunk->text_len, out->spill) != chunk->text_len)
+		err(1, "output_kml: could not write placemarks spill file");
+	for (idx=0; idx<chunk->count; idx++) {
+		pos = out->sups[chunk->first + idx];
+		sup = out->set->supports->index.items[pos];
+		rendered = &chunk->rendered[idx];
+		placemark = &out->placemarks[pos];
+		placemark->full = out->spill_len + rendered->full;
+		placemark->full_len = rendered->full_len;
+		placemark->light = out->spill_len + rendered->light;
+		placemark->light_len = rendered->light_len;
+		if (out->systemes_count + rendered->systemes_count > out->systemes_alloc) {
+			out->systemes_alloc = out->systemes_alloc * 2 + SYSTEMES_ID_MAX;
+			out->systemes = realloc(out->systemes, out->systemes_alloc * sizeof(int));
+			if (!out->systemes)
+				err(1, "realloc");
+		}
+		placemark->systemes = out->systemes_count;
+		placemark->systemes_count = rendered->systemes_count;
+		memcpy(out->systemes + out->systemes_count, rendered->systemes, rendered->systemes_count * sizeof(int));
+		out->systemes_count += rendered->systemes_count;
+		if (sup->tpo_id < 0 || sup->tpo_id >= PROPRIETAIRE_ID_MAX)
+			errx(1, "output_kml: invalid proprietaire id %d for support %d", sup->tpo_id, sup->sup_id);
+		out->tpos[pos] = sup->tpo_id;
+		out->depts[pos] = sup->dept;
+	}
+	out->spill_len += chunk->text_len;
 
-	bzero(tree, sizeof(tree));
-	bzero(count, sizeof(count));
-	if (stat(output_dir, &fstat) == -1)
-		mkdir(output_dir, 0755);
+	free(chunk->text);
+	free(chunk->rendered);
+	free(chunk->systemes);
+}
 
-	/* for all stations, insert bands in the exploitants bands tree */
-	for (s=0, sc=0;
-			s < SUPPORTS_ID_MAX && sc < set->supports->count;
-			s++) {
-		sup = set->supports->table[s];
-		if (!sup)
-			continue;
-		for (n=0; n<sup->sta_count; n++) {
-			sta = station_get(set->stations, &sup->sta_nm_anfr[n]);
+/* renders the placemarks of the first 'count' support positions of out->sups to the spill file, and maps it */
+void
+output_kml_placemarks(struct kml_output *out, int count)
+{
+	struct kml_chunk *chunks;
+	struct task *tasks;
+	char path[PATH_MAX];
+	int idx, chunk_count, sup_count, fd;
+
+	sup_count = out->set->supports->index.count;
+	out->placemarks = xmalloc_zero((sup_count + 1) * sizeof(struct kml_placemark));
+	out->tpos = xmalloc_zero((sup_count + 1) * sizeof(int));
+	out->depts = xmalloc_zero((sup_count + 1) * sizeof(int));
+	snprintf(path, sizeof(path), "%s/.antennes_placemarks.XXXXXX", out->output_dir);
+	fd = mkstemp(path);
+	if (fd == -1 || !(out->spill = fdopen(fd, "w+")))
+		err(1, "output_kml: could not create placemarks spill file %s", path);
+	unlink(path);
+
+	/* render supports in sup_id order to the spill file */
+	chunk_count = (count + KML_CHUNK_SUPPORTS - 1) / KML_CHUNK_SUPPORTS;
+	chunks = xmalloc_zero((chunk_count + 1) * sizeof(struct kml_chunk));
+	tasks = xmalloc_zero((chunk_count + 1) * sizeof(struct task));
+	for (idx=0; idx<chunk_count; idx++) {
+		chunks[idx].out = out;
+		chunks[idx].first = idx * KML_CHUNK_SUPPORTS;
+		chunks[idx].count = count - chunks[idx].first;
+		if (chunks[idx].count > KML_CHUNK_SUPPORTS)
+			chunks[idx].count = KML_CHUNK_SUPPORTS;
+		tasks[idx].fn = output_kml_render;
+		tasks[idx].done = output_kml_spill;
+		tasks[idx].arg = &chunks[idx];
+	}
+	tasks_run(tasks, chunk_count, conf.jobs);
+	free(tasks);
+	free(chunks);
+	if (fflush(out->spill) != 0)
+		err(1, "output_kml: could not write placemarks spill file");
+	if (out->spill_len > 0) {
+		out->map = mmap(NULL, out->spill_len, PROT_READ, MAP_SHARED, fileno(out->spill), 0);
+		if (out->map == MAP_FAILED)
+			err(1, "output_kml: could not map placemarks spill file");
+	}
+}
+
+void
+output_kml_free(struct kml_output *out)
+{
+	if (out->map)
+		munmap(out->map, out->spill_len);
+	fclose(out->spill);
+	free(out->placemarks);
+	free(out->tpos);
+	free(out->depts);
+	free(out->systemes);
+}
+
+/* orders the 'count' support positions of 'sups' in 'sorted' by group of same key, groups in order of first appearance
+ * and supports in their original order within a group. 'keys' is the key of each support position, lower than 'key_max'.
+ * returns the number of groups, group 'g' being from sorted[starts[g]] to sorted[starts[g+1]-1] */
+int
+output_kml_groups(int *sups, int count, int *keys, int key_max, int *sorted, int *starts)
+{
+	int *rank, *next;
+	int n, groups = 0;
+
+	rank = malloc(key_max * sizeof(int));
+	next = xmalloc_zero((key_max + 1) * sizeof(int));
+	if (!rank)
+		err(1, "malloc");
+	memset(rank, -1, key_max * sizeof(int));
+	for (n=0; n<count; n++) {
+		if (rank[keys[sups[n]]] < 0)
+			rank[keys[sups[n]]] = groups++;
+		next[rank[keys[sups[n]]] + 1]++;
+	}
+	for (n=0; n<groups; n++)
+		next[n+1] += next[n];
+	memcpy(starts, next, (groups + 1) * sizeof(int));
+	for (n=0; n<count; n++)
+		sorted[next[rank[keys[sups[n]]]]++] = sups[n];
+	free(rank);
+	free(next);
+
+	return groups;
+}
+
+/* formats in 'buf' of 'size' bytes the id of document number 'id' of a kml file with supports of 'set', and of 'other'
+ * when not NULL. documents have their number as id, prefixed by 'kind' only when it is also the id of a support,
+ * as placemarks have the support id */
+void
+output_kml_doc_id(struct anfr_set *set, struct anfr_set *other, const char *kind, int id, char *buf, size_t size)
+{
+	if (idx_get(&set->supports->index, id) || (other && idx_get(&other->supports->index, id)))
+		snprintf(buf, size, "%s%d", kind, id);
+	else
+		snprintf(buf, size, "%d", id);
+}
+
+/* writes a document of 'kml' with the full or light placemarks of the 'count' support positions of 'sups'.
+ * placemarks are written from the spill file mapping, contiguous ones with a single write */
+void
+output_kml_doc(struct kml_output *out, struct kml *kml, const char *doc_id, const char *doc_name, int *sups, int count, int light)
+{
+	struct kml_placemark *placemark;
+	int n;
+
+	kml_doc_begin(kml, doc_id, doc_name);
+	for (n=0; n<count; n++) {
+		placemark = &out->placemarks[sups[n]];
+		if (light)
+			kml_add_placemark(kml, out->map + placemark->light, placemark->light_len);
+		else
+			kml_add_placemark(kml, out->map + placemark->full, placemark->full_len);
+	}
+	kml_doc_end(kml);
+}
+
+/* releases the pages of the spill file mapping read by the kml files written so far */
+void
+output_kml_release(struct kml_output *out)
+{
+	if (out->map)
+		madvise(out->map, out->spill_len, MADV_DONTNEED);
+}
+
+/* supports are rendered by chunks on conf.jobs threads, each thread taking the next chunk when done with the previous one.
+ * chunks are written to the spill file in sup_id order, so the output does not depend on the number of threads.
+ * kml files are then written one at a time, with their supports grouped by document, so that memory usage does not
+ * depend on the size of the kml files.
+ * only the 'sel_count' support positions of 'sel', in increasing order, are exported, or all supports if 'sel' is NULL */
+void
+output_kml(struct anfr_set *set, const char *output_dir, const char *source_name, const int *sel, int sel_count)
+{
+	struct kml_output out;
+	struct kml *kml;
+	struct kml_placemark *placemark;
+	struct manifest *manifest;
+	char path[PATH_MAX], buf[1024], buf2[128], doc_id[16];
+	struct stat fstat;
+	const char *tpo_name, *lb;
+	int *all, *by_tpo, *by_dept, *sub, *by_sys;
+	int tpo_starts[PROPRIETAIRE_ID_MAX+1], dept_starts[256+1], sub_starts[256+1], sys_starts[SYSTEMES_ID_MAX+1];
+	int count, sup_count, tpo_groups, dept_groups, sub_groups, g, t, n, sys_id;
+
+	if (stat(output_dir, &fstat) == -1)
+		mkdir(output_dir, 0755);
+	snprintf(path, sizeof(path), "%s/anfr_proprietaire", output_dir);
+	if (stat(path, &fstat) == -1)
+		mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/anfr_departement", output_dir);
+	if (stat(path, &fstat) == -1)
+		mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/anfr_systeme", output_dir);
+	if (stat(path, &fstat) == -1)
+		mkdir(path, 0755);
+	manifest = conf.incremental ? manifest_load(output_dir) : NULL;
+
+	sup_count = set->supports->index.count;
+	all = xmalloc_zero((sup_count + 1) * sizeof(int));
+	if (sel) {
+		memcpy(all, sel, sel_count * sizeof(int));
+		count = sel_count;
+	} else {
+		for (n=0; n<sup_count; n++)
+			all[n] = n;
+		count = sup_count;
+	}
+	bzero(&out, sizeof(out));
+	out.set = set;
+	out.sups = all;
+	out.output_dir = output_dir;
+	out.source_name = source_name;
+	output_kml_placemarks(&out, count);
+
+	/* group supports by proprietaire and by departement */
+	by_tpo = xmalloc_zero((count + 1) * sizeof(int));
+	by_dept = xmalloc_zero((count + 1) * sizeof(int));
+	sub = xmalloc_zero((count + 1) * sizeof(int));
+	tpo_groups = output_kml_groups(all, count, out.tpos, PROPRIETAIRE_ID_MAX, by_tpo, tpo_starts);
+	dept_groups = output_kml_groups(all, count, out.depts, 256, by_dept, dept_starts);
+
+	/* all supports in a single file, one document per proprietaire, and one file per proprietaire */
+	snprintf(path, sizeof(path), "%s/anfr_proprietaires.kml", output_dir);
+	snprintf(buf, sizeof(buf), "ANFR antennes %s per proprietaire", source_name);
+	kml = kml_open(path, buf, KML_ANFR_DESCRIPTION, manifest);
+	for (g=0; g<tpo_groups; g++) {
+		t = out.tpos[by_tpo[tpo_starts[g]]];
+		output_kml_doc_id(set, NULL, "tpo", t, doc_id, sizeof(doc_id));
+		output_kml_doc(&out, kml, doc_id, proprietaire_get_name(set->proprietaires, t), by_tpo + tpo_starts[g], tpo_starts[g+1] - tpo_starts[g], 0);
+	}
+	kml_close(kml);
+	out.kml_count++;
+	for (g=0; g<tpo_groups; g++) {
+		t = out.tpos[by_tpo[tpo_starts[g]]];
+		tpo_name = proprietaire_get_name(set->proprietaires, t);
+		snprintf(path, sizeof(path), "%s/anfr_proprietaire/anfr_proprietaire_%d_%s.kml", output_dir, t, pathable(tpo_name));
+		snprintf(buf, sizeof(buf), "ANFR antennes %s %s (%d)", source_name, pathable(tpo_name), t);
+		kml = kml_open(path, buf, KML_ANFR_DESCRIPTION, manifest);
+		output_kml_doc_id(set, NULL, "tpo", t, doc_id, sizeof(doc_id));
+		output_kml_doc(&out, kml, doc_id, tpo_name, by_tpo + tpo_starts[g], tpo_starts[g+1] - tpo_starts[g], 0);
+		kml_close(kml);
+		out.kml_count++;
+	}
+	output_kml_release(&out);
+
+	/* all supports in a single file, one document per departement, with and without descriptions */
+	for (n=0; n<2; n++) {
+		snprintf(path, sizeof(path), n ? "%s/anfr_departements_light.kml" : "%s/anfr_departements.kml", output_dir);
+		snprintf(buf, sizeof(buf), n ? "ANFR antennes %s per departement (light)" : "ANFR antennes %s per departement", source_name);
+		kml = kml_open(path, buf, KML_ANFR_DESCRIPTION, manifest);
+		for (g=0; g<dept_groups; g++) {
+			output_kml_doc_id(set, NULL, "dept", out.depts[by_dept[dept_starts[g]]], doc_id, sizeof(doc_id));
+			output_kml_doc(&out, kml, doc_id, ((struct support *)set->supports->index.items[by_dept[dept_starts[g]]])->dept_name,
+					by_dept + dept_starts[g], dept_starts[g+1] - dept_starts[g], n);
+		}
+		kml_close(kml);
+		out.kml_count++;
+		output_kml_release(&out);
+	}
+
+	/* one file per departement, one document per proprietaire */
+	for (g=0; g<dept_groups; g++) {
+		snprintf(path, sizeof(path), "%s/anfr_departement/anfr_departement_%02X.kml", output_dir, out.depts[by_dept[dept_starts[g]]]);
+		snprintf(buf, sizeof(buf), "ANFR antennes %s %02X", source_name, out.depts[by_dept[dept_starts[g]]]);
+		kml = kml_open(path, buf, KML_ANFR_DESCRIPTION, manifest);
+		sub_groups = output_kml_groups(by_dept + dept_starts[g], dept_starts[g+1] - dept_starts[g], out.tpos, PROPRIETAIRE_ID_MAX, sub, sub_starts);
+		for (t=0; t<sub_groups; t++) {
+			output_kml_doc_id(set, NULL, "tpo", out.tpos[sub[sub_starts[t]]], doc_id, sizeof(doc_id));
+			output_kml_doc(&out, kml, doc_id, proprietaire_get_name(set->proprietaires, out.tpos[sub[sub_starts[t]]]),
+					sub + sub_starts[t], sub_starts[t+1] - sub_starts[t], 0);
+		}
+		kml_close(kml);
+		out.kml_count++;
+	}
+	output_kml_release(&out);
+
+	/* one file per systeme, one document per departement */
+	by_sys = xmalloc_zero((out.systemes_count + 1) * sizeof(int));
+	bzero(sys_starts, sizeof(sys_starts));
+	for (n=0; n<out.systemes_count; n++)
+		sys_starts[out.systemes[n] + 1]++;
+	for (sys_id=0; sys_id<SYSTEMES_ID_MAX; sys_id++)
+		sys_starts[sys_id+1] += sys_starts[sys_id];
+	for (n=0; n<count; n++) {
+		placemark = &out.placemarks[all[n]];
+		for (t=0; t<placemark->systemes_count; t++)
+			by_sys[sys_starts[out.systemes[placemark->systemes + t]]++] = all[n];
+	}
+	for (sys_id=SYSTEMES_ID_MAX; sys_id>0; sys_id--)
+		sys_starts[sys_id] = sys_starts[sys_id-1];
+	sys_starts[0] = 0;
+	for (sys_id=0; sys_id<SYSTEMES_ID_MAX; sys_id++) {
+		if (sys_starts[sys_id+1] == sys_starts[sys_id])
+			continue;
+		lb = dict_label(&set->emetteurs->systemes, sys_id);
+		strncpy(buf2, lb, sizeof(buf2));
+		strreplace(buf2, sizeof(buf2), '/', '_');
+		snprintf(path, sizeof(path), "%s/anfr_systeme/anfr_systeme_%s.kml", output_dir, buf2);
+		snprintf(buf2, sizeof(buf2), "ANFR antennes %s %s", source_name, lb);
+		kml = kml_open(path, buf2, KML_ANFR_DESCRIPTION, manifest);
+		sub_groups = output_kml_groups(by_sys + sys_starts[sys_id], sys_starts[sys_id+1] - sys_starts[sys_id], out.depts, 256, sub, sub_starts);
+		for (g=0; g<sub_groups; g++) {
+			snprintf(buf2, sizeof(buf2), "%s, %s", ((struct support *)set->supports->index.items[sub[sub_starts[g]]])->dept_name, lb);
+			output_kml_doc_id(set, NULL, "dept", out.depts[sub[sub_starts[g]]], doc_id, sizeof(doc_id));
+			output_kml_doc(&out, kml, doc_id, buf2, sub + sub_starts[g], sub_starts[g+1] - sub_starts[g], 0);
+		}
+		kml_close(kml);
+		out.kml_count++;
+	}
+
+	output_kml_free(&out);
+	free(all);
+	free(by_tpo);
+	free(by_dept);
+	free(by_sys);
+	free(sub);
+
+	info("created %d kml files\n", out.kml_count);
+	if (manifest) {
+		manifest_save(manifest);
+		info("%d kml files unchanged, %d replaced, %d removed\n", manifest->unchanged, manifest->replaced, manifest->removed);
+		manifest_free(manifest);
+	}
+}
+
+/* exports the 'sel_count' support positions of 'sel', or all supports if 'sel' is NULL, as a super-overlay: anfr_tiles.kml
+ * is the root tile, and links to the tiles of the next level in anfr_tiles/, each of them linking to the next one.
+ * clients only load the tiles of the visible regions, so they do not have to display all supports at once */
+void
+output_tiles(struct anfr_set *set, const char *output_dir, const char *source_name, const int *sel, int sel_count)
+{
+	struct kml_output out;
+	struct tile_output to;
+	char path[PATH_MAX];
+	struct stat fstat;
+	int *all;
+	int count, sup_count, n;
+
+	if (stat(output_dir, &fstat) == -1)
+		mkdir(output_dir, 0755);
+	snprintf(path, sizeof(path), "%s/anfr_tiles", output_dir);
+	if (stat(path, &fstat) == -1)
+		mkdir(path, 0755);
+
+	sup_count = set->supports->index.count;
+	all = xmalloc_zero((sup_count + 1) * sizeof(int));
+	if (sel) {
+		memcpy(all, sel, sel_count * sizeof(int));
+		count = sel_count;
+	} else {
+		for (n=0; n<sup_count; n++)
+			all[n] = n;
+		count = sup_count;
+	}
+	bzero(&out, sizeof(out));
+	out.set = set;
+	out.sups = all;
+	out.output_dir = output_dir;
+	out.source_name = source_name;
+	output_kml_placemarks(&out, count);
+
+	bzero(&to, sizeof(to));
+	to.out = &out;
+	to.manifest = conf.incremental ? manifest_load(output_dir) : NULL;
+	to.tmp = xmalloc_zero((count + 1) * sizeof(int));
+	to.quadrants = xmalloc_zero(count + 1);
+	/* the root tile covers the world rather than the extent of the supports, so that a tile keeps its area and its
+	 * name from one data set to the next, the overseas departements spreading the supports over most longitudes anyway */
+	to.root.north = 90;
+	to.root.south = -90;
+	to.root.east = 180;
+	to.root.west = -180;
+	output_tiles_node(&to, 0, 0, 0, all, count);
+
+	output_kml_free(&out);
+	free(all);
+	free(to.tmp);
+	free(to.quadrants);
+
+	info("created %d kml tiles with %d clusters\n", to.tile_count, to.cluster_count);
+	if (to.manifest) {
+		manifest_save(to.manifest);
+		info("%d kml files unchanged, %d replaced, %d removed\n", to.manifest->unchanged, to.manifest->replaced, to.manifest->removed);
+		manifest_free(to.manifest);
+	}
+}
+
+/* sets 'region' to the area of tile 'x', 'y' of level 'z', x and y counted from the west and south of the root tile */
+void
+output_tiles_region(struct tile_output *to, int z, int x, int y, struct kml_region *region)
+{
+	double width = (to->root.east - to->root.west) / (1 << z);
+	double height = (to->root.north - to->root.south) / (1 << z);
+
+	region->west = to->root.west + x * width;
+	region->east = to->root.west + (x + 1) * width;
+	region->south = to->root.south + y * height;
+	region->north = to->root.south + (y + 1) * height;
+	region->min_lod = z ? TILES_LOD_MIN : 0;
+	region->max_lod = -1;
+}
+
+/* writes tile 'x', 'y' of level 'z' with its 'count' support positions 'sups', and the tiles of the next levels.
+ * 'sups' is reordered by quadrant of the tile, keeping the order of the supports within a quadrant */
+void
+output_tiles_node(struct tile_output *to, int z, int x, int y, int *sups, int count)
+{
+	struct kml_output *out = to->out;
+	struct kml_placemark *placemark;
+	struct kml_region region, sub;
+	struct support *sup;
+	struct kml *kml;
+	char path[PATH_MAX], name[1024], href[64];
+	int cells[TILES_CLUSTER_GRID * TILES_CLUSTER_GRID];
+	double cells_lat[TILES_CLUSTER_GRID * TILES_CLUSTER_GRID], cells_lon[TILES_CLUSTER_GRID * TILES_CLUSTER_GRID];
+	int starts[4+1], next[4];
+	int n, q, cx, cy;
+
+	output_tiles_region(to, z, x, y, &region);
+	if (z == 0) {
+		snprintf(path, sizeof(path), "%s/anfr_tiles.kml", out->output_dir);
+		snprintf(name, sizeof(name), "ANFR antennes %s tiles", out->source_name);
+	} else {
+		snprintf(path, sizeof(path), "%s/anfr_tiles/%d_%d_%d.kml", out->output_dir, z, x, y);
+		snprintf(name, sizeof(name), "ANFR antennes %s tile %d_%d_%d", out->source_name, z, x, y);
+	}
+	kml = kml_tile_open(path, name, KML_ANFR_DESCRIPTION, &region, to->manifest);
+	to->tile_count++;
+
+	if (count <= TILES_SUPPORTS_MAX || z == TILES_DEPTH_MAX) {
+		for (n=0; n<count; n++) {
+			placemark = &out->placemarks[sups[n]];
+			kml_add_placemark(kml, out->map + placemark->full, placemark->full_len);
+		}
+		kml_tile_close(kml);
+		return;
+	}
+
+	/* clusters at the average location of the supports of each cell, until the next level is shown */
+	bzero(cells, sizeof(cells));
+	bzero(cells_lat, sizeof(cells_lat));
+	bzero(cells_lon, sizeof(cells_lon));
+	for (n=0; n<count; n++) {
+		sup = out->set->supports->index.items[sups[n]];
+		cx = (sup->lon - region.west) / (region.east - region.west) * TILES_CLUSTER_GRID;
+		cy = (sup->lat - region.south) / (region.north - region.south) * TILES_CLUSTER_GRID;
+		cx = cx < 0 ? 0 : cx >= TILES_CLUSTER_GRID ? TILES_CLUSTER_GRID - 1 : cx;
+		cy = cy < 0 ? 0 : cy >= TILES_CLUSTER_GRID ? TILES_CLUSTER_GRID - 1 : cy;
+		cells[cy * TILES_CLUSTER_GRID + cx]++;
+		cells_lat[cy * TILES_CLUSTER_GRID + cx] += sup->lat;
+		cells_lon[cy * TILES_CLUSTER_GRID + cx] += sup->lon;
+	}
+	sub = region;
+	sub.max_lod = 2 * TILES_LOD_MIN;
+	kml_tile_clusters_begin(kml, &sub);
+	for (n=0; n<TILES_CLUSTER_GRID * TILES_CLUSTER_GRID; n++) {
+		if (cells[n] == 0)
+			continue;
+		kml_tile_cluster(kml, cells[n], cells_lat[n] / cells[n], cells_lon[n] / cells[n]);
+		to->cluster_count++;
+	}
+	kml_tile_clusters_end(kml);
+
+	/* split in quadrants, 0 south-west, 1 south-east, 2 north-west, 3 north-east */
+	bzero(starts, sizeof(starts));
+	for (n=0; n<count; n++) {
+		sup = out->set->supports->index.items[sups[n]];
+		to->quadrants[n] = (sup->lon >= (region.west + region.east) / 2) + 2 * (sup->lat >= (region.south + region.north) / 2);
+		starts[to->quadrants[n] + 1]++;
+	}
+	for (q=0; q<4; q++) {
+		starts[q+1] += starts[q];
+		next[q] = starts[q];
+	}
+	for (n=0; n<count; n++)
+		to->tmp[next[to->quadrants[n]]++] = sups[n];
+	memcpy(sups, to->tmp, count * sizeof(int));
+	for (q=0; q<4; q++) {
+		if (starts[q+1] == starts[q])
+			continue;
+		output_tiles_region(to, z + 1, 2 * x + (q & 1), 2 * y + (q >> 1), &sub);
+		snprintf(href, sizeof(href), z ? "%d_%d_%d.kml" : "anfr_tiles/%d_%d_%d.kml", z + 1, 2 * x + (q & 1), 2 * y + (q >> 1));
+		snprintf(name, sizeof(name), "%d supports", starts[q+1] - starts[q]);
+		kml_tile_link(kml, name, href, &sub);
+	}
+	kml_tile_close(kml);
+
+	for (q=0; q<4; q++)
+		if (starts[q+1] > starts[q])
+			output_tiles_node(to, z + 1, 2 * x + (q & 1), 2 * y + (q >> 1), sups + starts[q], starts[q+1] - starts[q]);
+}
+
+/* create one csv file per exploitant containing all the bands sorted by frequency together with their emetteur count and systemes sorted by count
+ * <expoitant>_bands.csv
+ * freq_min;freq_max;emr_count;systeme1_name;systeme1_count;systeme2_name;systeme2_count[...]
+ * stations are first listed per exploitant, then each exploitant is aggregated and written on conf.jobs threads.
+ * only the stations of the 'sel_count' support positions of 'sel' are counted, or of all supports if 'sel' is NULL */
+void
+output_bands(struct anfr_set *set, const char *output_dir, const char *source_name, const int *sel, int sel_count)
+{
+	struct bande_output *out;
+	struct bande_agg *agg;
+	struct support *sup;
+	struct station *sta;
+	struct stat fstat;
+	int s, n;
+
+	if (stat(output_dir, &fstat) == -1)
+		mkdir(output_dir, 0755);
+
+	out = xmalloc_zero(sizeof(struct bande_output));
+	out->set = set;
+	out->output_dir = output_dir;
+	for (s=0; s < (sel ? sel_count : set->supports->index.count); s++) {
+		sup = set->supports->index.items[sel ? sel[s] : s];
+		for (n=0; n<sup->sta_count; n++) {
+			sta = station_get(set->stations, sup->sta_nm_anfr[n]);
 			if (!sta)
 				continue;
-			for (e=0; e<sta->emetteur_count; e++) {
-				emr = sta->emetteurs[e];
-				for (b=0; b<emr->bande_count; b++) {
-					ban = emr->bandes[b];
-					/* insert this station band into exploitant tree */
-					pe = NULL;               /* previous entry */
-					ce = &tree[sta->adm_id]; /* current entry */
-					while (1) {
-						prepend = 0;
-						append = 0;
-						if (ban->ban_nb_f_deb == ce->ban_nb_f_deb && ban->ban_nb_f_fin == ce->ban_nb_f_fin) {
-							/* increment entry counters */
-							ce->emr_count++;
-							ce->systemes_count[emr->systeme_id]++;
-							break;
-						} else if ((ban->ban_nb_f_deb < ce->ban_nb_f_deb) || (ban->ban_nb_f_deb == ce->ban_nb_f_deb && ban->ban_nb_f_fin < ce->ban_nb_f_fin)) {
-							prepend = 1;
-						} else if (!ce->next && ((ban->ban_nb_f_deb > ce->ban_nb_f_deb) || (ban->ban_nb_f_deb == ce->ban_nb_f_deb && ban->ban_nb_f_fin > ce->ban_nb_f_fin))) {
-							append = 1;
-						}
-						if (prepend || append) {
-							/* create new entry */
-							ne = malloc(sizeof(struct bande_tree));
-							ne->emr_count = 1;
-							ne->ban_nb_f_deb = ban->ban_nb_f_deb;
-							ne->ban_nb_f_deb_str = ban->ban_nb_f_deb_str;
-							ne->ban_nb_f_fin = ban->ban_nb_f_fin;
-							ne->ban_nb_f_fin_str = ban->ban_nb_f_fin_str;
-							bzero(ne->systemes_count, sizeof(ne->systemes_count));
-							ne->systemes_count[emr->systeme_id]++;
-							ne->next = NULL;
-							/* insert new entry */
-							if (prepend) {
-								if (!pe)
-									errx(1, "band bellow 0mhz ! deb=%" PRIu64 " fin=%" PRIu64, ban->ban_nb_f_deb, ban->ban_nb_f_fin);
-								pe->next = ne;
-								ne->next = ce;
-							} else {
-								ce->next = ne;
-							}
-							count[sta->adm_id]++;
-							break;
-						}
-						/* search next entry */
-						pe = ce;
-						ce = ce->next;
-					}
-				}
+			if (sta->adm_id < 0 || sta->adm_id >= EXPLOITANT_ID_MAX)
+				errx(1, "output_bands: invalid exploitant id %d for station %s", sta->adm_id, sta->sta_nm.str);
+			agg = &out->aggs[sta->adm_id];
+			if (agg->stations_count == agg->stations_alloc) {
+				agg->stations_alloc = agg->stations_alloc * 2 + 64;
+				agg->stations = realloc(agg->stations, agg->stations_alloc * sizeof(struct station *));
+				if (!agg->stations)
+					err(1, "realloc");
 			}
+			agg->stations[agg->stations_count++] = sta;
+		}
+	}
+	parallel_for(EXPLOITANT_ID_MAX, conf.jobs, output_bands_exploitant, out);
+	free(out);
+}
+
+/* aggregates the bands of the stations of exploitant 'adm_id' and writes its csv file */
+void
+output_bands_exploitant(void *arg, int adm_id)
+{
+	struct bande_output *out = arg;
+	struct bande_agg *agg = &out->aggs[adm_id];
+	struct bande_count *ce;
+	struct bande_systeme *counter;
+	struct bande_columns *cols = &out->set->bandes->columns;
+	struct station *sta;
+	struct emetteur *emr;
+	struct histo_entry ranked[SYSTEMES_ID_MAX];
+	int systemes_count[SYSTEMES_ID_MAX];
+	int n, e, b, s, pos, ranked_count;
+	const char *exploitant_name;
+	char path[PATH_MAX];
+	FILE *csv;
+
+	if (agg->stations_count == 0)
+		return;
+	for (n=0; n<agg->stations_count; n++) {
+		sta = agg->stations[n];
+		for (e=0; e<sta->emetteur_count; e++) {
+			emr = sta->emetteurs[e];
+			if (emr->bande_count == 0)
+				continue;
+			pos = emetteur_bandes_pos(out->set->bandes, emr);
+			for (b=0; b<emr->bande_count; b++)
+				bande_agg_add(agg, cols->f_deb[pos + b], cols->f_fin[pos + b], emr->systeme_id);
 		}
 	}
+	if (agg->count == 0)
+		goto done;
+
+	/* move bands to the start of the table and sort them by frequency */
+	for (n=0, e=0; n<agg->size; n++)
+		if (agg->table[n].emr_count > 0)
+			agg->table[e++] = agg->table[n];
+	qsort(agg->table, agg->count, sizeof(struct bande_count), bande_count_cmp);
 
 	/* write csv */
-	for (n=0; n<EXPLOITANT_ID_MAX; n++) {
-		if (count[n] == 0)
+	exploitant_name = exploitant_get_name(out->set->exploitants, adm_id);
+	snprintf(path, sizeof(path), "%s/%03d_%s_bands.csv", out->output_dir, adm_id, pathable(exploitant_name));
+	csv = fopen(path, "w");
+	if (!csv)
+		err(1, "could not create bands file %s", path);
+	fprintf(csv, "# %d - %s: %d bands\n", adm_id, exploitant_name, agg->count);
+	fprintf(csv, "# freq_min;freq_max;emr_count;systeme1_name;systeme1_count[...]\n");
+	bzero(systemes_count, sizeof(systemes_count));
+	for (n=0; n<agg->count; n++) {
+		ce = &agg->table[n];
+		fprintf(csv, "%" PRIu64 ";%" PRIu64 ";%d", ce->ban_nb_f_deb, ce->ban_nb_f_fin, ce->emr_count);
+		for (s=ce->systemes; s>=0; s=counter->next) {
+			counter = &agg->counters[s];
+			systemes_count[counter->systeme_id] = counter->count;
+		}
+		ranked_count = histo_rank(systemes_count, SYSTEMES_ID_MAX, ranked);
+		for (s=0; s<ranked_count; s++) {
+			fprintf(csv, ";%s;%d", dict_label(&out->set->emetteurs->systemes, ranked[s].index), ranked[s].count);
+			systemes_count[ranked[s].index] = 0;
+		}
+		fprintf(csv, "\n");
+	}
+	if (fclose(csv) != 0)
+		err(1, "could not write bands file %s", path);
+
+done:
+	free(agg->stations);
+	free(agg->table);
+	free(agg->counters);
+}
+
+/* counts band 'f_deb'-'f_fin' of an emetteur of systeme 'systeme_id' in 'agg'.
+ * bands from 0 to 0 are not counted */
+void
+bande_agg_add(struct bande_agg *agg, uint64_t f_deb, uint64_t f_fin, int systeme_id)
+{
+	struct bande_count *ce, *old;
+	struct bande_systeme *counter;
+	uint64_t hash;
+	int n, s, old_size;
+
+	if (f_deb == 0 && f_fin == 0)
+		return;
+	if (agg->count * 2 >= agg->size) {
+		old = agg->table;
+		old_size = agg->size;
+		agg->size = old_size ? old_size * 2 : BANDE_AGG_SIZE_MIN;
+		agg->table = xmalloc_zero(agg->size * sizeof(struct bande_count));
+		agg->count = 0;
+		for (n=0; n<old_size; n++) {
+			if (old[n].emr_count == 0)
+				continue;
+			hash = (old[n].ban_nb_f_deb * 0x9E3779B97F4A7C15ULL) ^ (old[n].ban_nb_f_fin * 0xC2B2AE3D27D4EB4FULL);
+			for (s=(hash >> 32) & (agg->size - 1); agg->table[s].emr_count > 0; s=(s + 1) & (agg->size - 1))
+				;
+			agg->table[s] = old[n];
+			agg->count++;
+		}
+		free(old);
+	}
+
+	/* find or create the band */
+	hash = (f_deb * 0x9E3779B97F4A7C15ULL) ^ (f_fin * 0xC2B2AE3D27D4EB4FULL);
+	for (n=(hash >> 32) & (agg->size - 1); ; n=(n + 1) & (agg->size - 1)) {
+		ce = &agg->table[n];
+		if (ce->emr_count == 0) {
+			ce->ban_nb_f_deb = f_deb;
+			ce->ban_nb_f_fin = f_fin;
+			ce->systemes = -1;
+			agg->count++;
+			break;
+		}
+		if (ce->ban_nb_f_deb == f_deb && ce->ban_nb_f_fin == f_fin)
+			break;
+	}
+	ce->emr_count++;
+
+	/* find or create the systeme counter of the band */
+	for (s=ce->systemes; s>=0; s=agg->counters[s].next)
+		if (agg->counters[s].systeme_id == systeme_id)
+			break;
+	if (s < 0) {
+		if (agg->counters_count == agg->counters_alloc) {
+			agg->counters_alloc = agg->counters_alloc * 2 + 256;
+			agg->counters = realloc(agg->counters, agg->counters_alloc * sizeof(struct bande_systeme));
+			if (!agg->counters)
+				err(1, "realloc");
+		}
+		s = agg->counters_count++;
+		counter = &agg->counters[s];
+		counter->systeme_id = systeme_id;
+		counter->count = 0;
+		counter->next = ce->systemes;
+		ce->systemes = s;
+	}
+	agg->counters[s].count++;
+}
+
+/* orders bands by frequency start then frequency end */
+int
+bande_count_cmp(const void *a, const void *b)
+{
+	const struct bande_count *ban_a = a, *ban_b = b;
+
+	if (ban_a->ban_nb_f_deb != ban_b->ban_nb_f_deb)
+		return ban_a->ban_nb_f_deb < ban_b->ban_nb_f_deb ? -1 : 1;
+	if (ban_a->ban_nb_f_fin != ban_b->ban_nb_f_fin)
+		return ban_a->ban_nb_f_fin < ban_b->ban_nb_f_fin ? -1 : 1;
+	return 0;
+}
+
+/* lists the supports found by spatial query 'query' with arguments 'args', and count 'k' for --knn, nearest first for --near and --knn.
+ * returns their positions in the supports index in increasing order and sets 'count', to restrict the kml export to them */
+int *
+output_geo_query(struct anfr_set *set, int query, float args[4], int k, int *count)
+{
+	struct geo_grid *grid = &set->supports->grid;
+	struct support *sup;
+	struct timespec start, end;
+	uint8_t *found;
+	double *dists;
+	int *items, *sel;
+	int n, sup_count;
+
+	sup_count = set->supports->index.count;
+	items = xmalloc_zero((sup_count + 1) * sizeof(int));
+	dists = xmalloc_zero((sup_count + 1) * sizeof(double));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch (query) {
+	case GEO_QUERY_BBOX:
+		*count = geo_grid_bbox(grid, args[0], args[1], args[2], args[3], items);
+		break;
+	case GEO_QUERY_NEAR:
+		*count = geo_grid_near(grid, args[0], args[1], args[2], items, dists);
+		break;
+	case GEO_QUERY_KNN:
+		*count = geo_grid_knn(grid, args[0], args[1], k, items, dists);
+		break;
+	default:
+		errx(1, "output_geo_query: invalid query %d", query);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* increasing positions, also the order of box results */
+	found = xmalloc_zero(sup_count + 1);
+	sel = xmalloc_zero((*count + 1) * sizeof(int));
+	for (n=0; n<*count; n++)
+		found[items[n]] = 1;
+	for (n=0, *count=0; n<sup_count; n++)
+		if (found[n])
+			sel[(*count)++] = n;
+
+	printf("SUP_ID;LATITUDE;LONGITUDE;DISTANCE\n");
+	for (n=0; n<*count; n++) {
+		sup = set->supports->index.items[query == GEO_QUERY_BBOX ? sel[n] : items[n]];
+		printf("%d;%f;%f;", sup->sup_id, sup->lat, sup->lon);
+		if (query != GEO_QUERY_BBOX)
+			printf("%.0f", dists[n]);
+		printf("\n");
+	}
+	info("%d supports found in %ld us\n", *count,
+		(long)((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000));
+
+	free(items);
+	free(dists);
+	free(found);
+
+	return sel;
+}
+
+/* sets in 'words' the supports having value 'value' of attribute 'key' of a --filter expression */
+void
+filter_value(struct anfr_set *set, const char *key, const char *value, uint64_t *words)
+{
+	struct support_bitmaps *bitmaps = set->bitmaps;
+	int id, n, numeric;
+	int32_t day;
+	char dept[3];
+
+	/* an empty value would match the entries with an empty label */
+	if (value[0] == '\0')
+		errx(1, "filter: unknown %s '%s'", key, value);
+	numeric = strspn(value, "0123456789") == strlen(value);
+	id = -1;
+	if (!strcmp(key, "exploitant")) {
+		for (n=0; n<EXPLOITANT_ID_MAX && id < 0; n++)
+			if (set->exploitants->table[n] && (numeric ? atoi(value) == n : !strcasecmp(value, set->exploitants->table[n]->adm_lb_nom)))
+				id = n;
+		if (id >= 0)
+			bitmap_or_words(&bitmaps->exploitants[id], words);
+	} else if (!strcmp(key, "proprietaire")) {
+		for (n=0; n<PROPRIETAIRE_ID_MAX && id < 0; n++)
+			if (set->proprietaires->table[n] && (numeric ? atoi(value) == n : !strcasecmp(value, set->proprietaires->table[n]->tpo_lb)))
+				id = n;
+		if (id >= 0)
+			bitmap_or_words(&bitmaps->proprietaires[id], words);
+	} else if (!strcmp(key, "nature")) {
+		for (n=0; n<NATURE_ID_MAX && id < 0; n++)
+			if (set->natures->table[n] && (numeric ? atoi(value) == n : !strcasecmp(value, set->natures->table[n]->nat_lb_nom)))
+				id = n;
+		if (id >= 0)
+			bitmap_or_words(&bitmaps->natures[id], words);
+	} else if (!strcmp(key, "systeme")) {
+		for (n=0; n<set->emetteurs->systemes.count && id < 0; n++)
+			if (!strcasecmp(value, dict_label(&set->emetteurs->systemes, n)))
+				id = n;
+		if (id >= 0)
+			bitmap_or_words(&bitmaps->systemes[id], words);
+	} else if (!strcmp(key, "dept")) {
+		for (n=0; n<256 && id < 0; n++) {
+			snprintf(dept, sizeof(dept), "%02X", n);
+			if (!strcasecmp(value, dept))
+				id = n;
+		}
+		if (id >= 0)
+			bitmap_or_words(&bitmaps->depts[id], words);
+	} else if (!strcmp(key, "since")) {
+		day = date_parse(value);
+		if (day == DAY_NONE)
+			errx(1, "filter: invalid date '%s', expected dd/mm/yyyy", value);
+		for (n=0; n<bitmaps->count; n++)
+			if (bitmaps->latest[n] >= day)
+				words[n / 64] |= 1ULL << (n % 64);
+		return;
+	} else
+		errx(1, "filter: unknown attribute '%s'", key);
+	if (id < 0)
+		errx(1, "filter: unknown %s '%s'", key, value);
+}
+
+/* selects the supports matching --filter expression 'expr', terms <attribute>=<value>[,<value>...] joined by '&'.
+ * values of a term are or-ed and terms are and-ed, with the supports of 'sel' when not NULL.
+ * lists them, and returns their positions in the supports index in increasing order and sets 'count' */
+int *
+output_filter(struct anfr_set *set, const char *expr, const int *sel, int sel_count, int *count)
+{
+	struct support_bitmaps *bitmaps = set->bitmaps;
+	struct support *sup;
+	struct timespec start, end;
+	uint64_t *words, *term_words, word;
+	char *buf, *term, *value, *key, *save_term, *values;
+	int *found;
+	int n, w, word_count;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	word_count = ((bitmaps->count >> BITMAP_CHUNK_BITS) + 1) * BITMAP_CHUNK_WORDS;
+	words = xmalloc_zero(word_count * sizeof(uint64_t));
+	term_words = xmalloc_zero(word_count * sizeof(uint64_t));
+	if (sel) {
+		for (n=0; n<sel_count; n++)
+			words[sel[n] / 64] |= 1ULL << (sel[n] % 64);
+	} else {
+		for (n=0; n<bitmaps->count; n++)
+			words[n / 64] |= 1ULL << (n % 64);
+	}
+	buf = strdup(expr);
+	if (!buf)
+		err(1, "strdup");
+	for (term = strtok_r(buf, "&", &save_term); term; term = strtok_r(NULL, "&", &save_term)) {
+		key = term;
+		value = strchr(term, '=');
+		if (!value)
+			errx(1, "filter: expected <attribute>=<value> instead of '%s'", term);
+		*value++ = '\0';
+		bzero(term_words, word_count * sizeof(uint64_t));
+		/* strsep() keeps the empty values, rejected by filter_value() */
+		for (values = value; (value = strsep(&values, ",")); )
+			filter_value(set, key, value, term_words);
+		for (w=0; w<word_count; w++)
+			words[w] &= term_words[w];
+	}
+	found = xmalloc_zero((bitmaps->count + 1) * sizeof(int));
+	*count = 0;
+	for (w=0; w<word_count; w++)
+		for (word=words[w]; word; word&=word-1)
+			found[(*count)++] = w * 64 + __builtin_ctzll(word);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("SUP_ID;LATITUDE;LONGITUDE;DEPT;PROPRIETAIRE;NATURE\n");
+	for (n=0; n<*count; n++) {
+		sup = set->supports->index.items[found[n]];
+		printf("%d;%f;%f;%s;%s;%s\n", sup->sup_id, sup->lat, sup->lon, sup->dept_name,
+			proprietaire_get_name(set->proprietaires, sup->tpo_id), nature_get_name(set->natures, sup->nat_id));
+	}
+	info("%d supports found in %ld us\n", *count,
+		(long)((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000));
+
+	free(buf);
+	free(words);
+	free(term_words);
+
+	return found;
+}
+
+/* compares 'set' to the older set 'old': supports, stations, emetteurs and bandes are matched by id, and listed as added,
+ * removed or modified when their fingerprints differ. a support is modified when any record of its placemark is.
+ * with 'output_dir', the changed supports are exported to anfr_changes.kml, and to anfr_update.kml as an update of
+ * anfr_departements.kml of the older set, deleting the removed and modified placemarks and creating the added and modified ones.
+ * placemarks cannot be created in the documents of departements absent from the older set, so they are left out with a warning */
+void
+output_diff(struct anfr_set *old, struct anfr_set *set, const char *output_dir, const char *source_name)
+{
+	static const char *change_names[DIFF_CHANGES] = { "same", "added", "removed", "modified" };
+	struct set_diff diff;
+	struct kml_output out, out_old;
+	struct kml *kml;
+	struct kml_placemark *placemark;
+	struct support *sup;
+	struct stat fstat;
+	struct timespec start, end;
+	char path[PATH_MAX], buf[1024], doc_id[16];
+	uint8_t old_depts[256];
+	int *changed, *removed, *sel, *by_dept, dept_starts[256+1];
+	int n, r, g, dept, change, count, removed_count, sel_count, dept_groups, max;
+	struct idx *idxs[DIFF_RECORDS][2] = {
+		{ &old->supports->index, &set->supports->index },
+		{ NULL, NULL },
+		{ &old->emetteurs->index, &set->emetteurs->index },
+		{ &old->bandes->index, &set->bandes->index },
+	};
+	void (*tasks[DIFF_RECORDS])(void *, int) = { diff_supports, diff_stations, diff_emetteurs, diff_bandes };
+
+	bzero(&diff, sizeof(diff));
+	diff.old = old;
+	diff.set = set;
+	diff.sup_changes = xmalloc_zero(set->supports->index.count + 1);
+	diff.sup_removed = xmalloc_zero(old->supports->index.count + 1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r=0; r<DIFF_RECORDS; r++) {
+		if (!idxs[r][0]) {
+			parallel_for(STATION_DEPT_MAX, conf.jobs, tasks[r], &diff);
+			continue;
+		}
+		max = idxs[r][0]->count > idxs[r][1]->count ? idxs[r][0]->count : idxs[r][1]->count;
+		parallel_for((max + DIFF_CHUNK - 1) / DIFF_CHUNK, conf.jobs, tasks[r], &diff);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("RECORDS;ADDED;REMOVED;MODIFIED\n");
+	for (r=0; r<DIFF_RECORDS; r++)
+		printf("%s;%d;%d;%d\n", DIFF_RECORD_NAMES[r], diff.counts[r][DIFF_ADDED], diff.counts[r][DIFF_REMOVED], diff.counts[r][DIFF_MODIFIED]);
+	info("compared in %ld us\n", (long)((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000));
+	if (!output_dir)
+		goto done;
+
+	if (stat(output_dir, &fstat) == -1)
+		mkdir(output_dir, 0755);
+	changed = xmalloc_zero((set->supports->index.count + 1) * sizeof(int));
+	sel = xmalloc_zero((set->supports->index.count + 1) * sizeof(int));
+	by_dept = xmalloc_zero((set->supports->index.count + 1) * sizeof(int));
+	removed = xmalloc_zero((old->supports->index.count + 1) * sizeof(int));
+	for (n=0, count=0; n<set->supports->index.count; n++)
+		if (diff.sup_changes[n] != DIFF_SAME)
+			changed[count++] = n;
+	for (n=0, removed_count=0; n<old->supports->index.count; n++)
+		if (diff.sup_removed[n])
+			removed[removed_count++] = n;
+	bzero(&out, sizeof(out));
+	out.set = set;
+	out.sups = changed;
+	out.output_dir = output_dir;
+	out.source_name = source_name;
+	output_kml_placemarks(&out, count);
+	bzero(&out_old, sizeof(out_old));
+	out_old.set = old;
+	out_old.sups = removed;
+	out_old.output_dir = output_dir;
+	out_old.source_name = source_name;
+	output_kml_placemarks(&out_old, removed_count);
+
+	/* one document per change, removed supports as they were in the older set */
+	snprintf(path, sizeof(path), "%s/anfr_changes.kml", output_dir);
+	snprintf(buf, sizeof(buf), "ANFR antennes %s changes", source_name);
+	kml = kml_open(path, buf, KML_ANFR_DESCRIPTION, NULL);
+	for (change=DIFF_ADDED; change<DIFF_CHANGES; change++) {
+		if (change == DIFF_REMOVED) {
+			output_kml_doc_id(set, old, "change", change, doc_id, sizeof(doc_id));
+			output_kml_doc(&out_old, kml, doc_id, change_names[change], removed, removed_count, 0);
+			continue;
+		}
+		for (n=0, sel_count=0; n<count; n++)
+			if (diff.sup_changes[changed[n]] == change)
+				sel[sel_count++] = changed[n];
+		output_kml_doc_id(set, old, "change", change, doc_id, sizeof(doc_id));
+		output_kml_doc(&out, kml, doc_id, change_names[change], sel, sel_count, 0);
+	}
+	kml_close(kml);
+
+	/* modified placemarks are replaced, as they may have moved to another departement.
+	 * the documents of the departements without supports in the older set do not exist in its anfr_departements.kml */
+	bzero(old_depts, sizeof(old_depts));
+	for (n=0; n<old->supports->index.count; n++)
+		old_depts[((struct support *)old->supports->index.items[n])->dept] = 1;
+	snprintf(path, sizeof(path), "%s/anfr_update.kml", output_dir);
+	kml = kml_update_open(path, "anfr_departements.kml");
+	for (n=0; n<removed_count; n++) {
+		sup = old->supports->index.items[removed[n]];
+		kml_update_delete(kml, sup->sup_id);
+	}
+	for (n=0; n<count; n++) {
+		if (diff.sup_changes[changed[n]] != DIFF_MODIFIED)
 			continue;
+		sup = set->supports->index.items[changed[n]];
+		kml_update_delete(kml, sup->sup_id);
+	}
+	dept_groups = output_kml_groups(changed, count, out.depts, 256, by_dept, dept_starts);
+	for (g=0; g<dept_groups; g++) {
+		dept = out.depts[by_dept[dept_starts[g]]];
+		if (!old_depts[dept]) {
+			warnx_out("departement %02X is new, its %d supports are not in anfr_update.kml, reload anfr_departements.kml",
+					dept, dept_starts[g+1] - dept_starts[g]);
+			continue;
+		}
+		output_kml_doc_id(old, NULL, "dept", dept, doc_id, sizeof(doc_id)); /* as in anfr_departements.kml of the older set */
+		kml_update_create(kml, doc_id);
+		for (n=dept_starts[g]; n<dept_starts[g+1]; n++) {
+			placemark = &out.placemarks[by_dept[n]];
+			kml_add_placemark(kml, out.map + placemark->full, placemark->full_len);
+		}
+	}
+	kml_update_close(kml);
+	info("created 2 kml files\n");
+
+	output_kml_free(&out);
+	output_kml_free(&out_old);
+	free(changed);
+	free(sel);
+	free(by_dept);
+	free(removed);
+done:
+	free(diff.sup_changes);
+	free(diff.sup_removed);
+}
 
-		exploitant_name = exploitant_get_name(set->exploitants, n);
-		snprintf(path, sizeof(path), "%s/%03d_%s_bands.csv", output_dir, n, pathable(exploitant_name));
+/* compares the records from position chunk * DIFF_CHUNK of the indexes 'old' and 'idx' of the older and newer sets,
+ * counting them as records 'records'. the change of each position of 'idx' is stored in 'changes', and the removed
+ * positions of 'old' are set in 'removed', when not NULL */
+void
+diff_index(struct set_diff *diff, int records, struct idx *old, struct idx *idx, uint64_t (*fingerprint)(struct anfr_set *, void *),
+		uint8_t *changes, uint8_t *removed, int chunk)
+{
+	int counts[DIFF_CHANGES];
+	int pos, old_pos, change;
+
+	bzero(counts, sizeof(counts));
+	for (pos=chunk*DIFF_CHUNK; pos<(chunk+1)*DIFF_CHUNK && pos<idx->count; pos++) {
+		old_pos = idx_pos(old, idx->ids[pos]);
+		if (old_pos < 0)
+			change = DIFF_ADDED;
+		else if (fingerprint(diff->set, idx->items[pos]) != fingerprint(diff->old, old->items[old_pos]))
+			change = DIFF_MODIFIED;
+		else
+			change = DIFF_SAME;
+		counts[change]++;
+		if (changes)
+			changes[pos] = change;
+	}
+	for (pos=chunk*DIFF_CHUNK; pos<(chunk+1)*DIFF_CHUNK && pos<old->count; pos++) {
+		if (idx_pos(idx, old->ids[pos]) >= 0)
+			continue;
+		counts[DIFF_REMOVED]++;
+		if (removed)
+			removed[pos] = 1;
+	}
+	for (change=0; change<DIFF_CHANGES; change++)
+		__atomic_add_fetch(&diff->counts[records][change], counts[change], __ATOMIC_RELAXED);
+}
 
-		csv = fopen(path, "w");
-		fprintf(csv, "# %d - %s: %d bands\n", n, exploitant_name, count[n]);
-		fprintf(csv, "# freq_min;freq_max;emr_count;systeme1_name;systeme1_count[...]\n");
+void
+diff_supports(void *arg, int chunk)
+{
+	struct set_diff *diff = arg;
 
-		for (ce=tree[n].next; ce; ce=ce->next) {
-			id = 0;
-			s = 0;
-			fprintf(csv, "%" PRIu64 ";%" PRIu64 ";%d", ce->ban_nb_f_deb, ce->ban_nb_f_fin, ce->emr_count);
-			while ( (s = next_smallest_positive_int(ce->systemes_count, SYSTEMES_ID_MAX, s, id, &id)) > 0 ) {
-				lb = set->emetteurs->systemes_lb[id];
-				fprintf(csv, ";%s;%d", lb, s);
+	diff_index(diff, DIFF_SUPPORTS, &diff->old->supports->index, &diff->set->supports->index, support_fingerprint,
+			diff->sup_changes, diff->sup_removed, chunk);
+}
+
+/* compares the stations of a departement, looked up by name in the other set */
+void
+diff_stations(void *arg, int dept)
+{
+	struct set_diff *diff = arg;
+	struct anfr_set *sets[2] = { diff->set, diff->old };
+	struct station_dept *sdept;
+	struct station *sta, *other;
+	int counts[DIFF_CHANGES];
+	int s, n, change;
+
+	bzero(counts, sizeof(counts));
+	for (s=0; s<2; s++) {
+		sdept = sets[s]->stations->depts[dept];
+		if (!sdept)
+			continue;
+		for (n=0; n<sdept->stations.count; n++) {
+			sta = sdept->stations.items[n];
+			other = station_find(sets[!s]->stations, &sta->sta_nm);
+			if (s == 1) {
+				if (!other)
+					counts[DIFF_REMOVED]++;
+				continue;
 			}
-			fprintf(csv, "\n");
-#ifdef DEBUG
-			free(ce);
-#endif
+			if (!other)
+				change = DIFF_ADDED;
+			else if (station_fingerprint(sta) != station_fingerprint(other))
+				change = DIFF_MODIFIED;
+			else
+				change = DIFF_SAME;
+			counts[change]++;
 		}
+	}
+	for (change=0; change<DIFF_CHANGES; change++)
+		__atomic_add_fetch(&diff->counts[DIFF_STATIONS][change], counts[change], __ATOMIC_RELAXED);
+}
+
+void
+diff_emetteurs(void *arg, int chunk)
+{
+	struct set_diff *diff = arg;
+
+	diff_index(diff, DIFF_EMETTEURS, &diff->old->emetteurs->index, &diff->set->emetteurs->index, emetteur_fingerprint, NULL, NULL, chunk);
+}
+
+void
+diff_bandes(void *arg, int chunk)
+{
+	struct set_diff *diff = arg;
 
-		fclose(csv);
+	diff_index(diff, DIFF_BANDES, &diff->old->bandes->index, &diff->set->bandes->index, bande_fingerprint, NULL, NULL, chunk);
+}
+
+/* fingerprint of a support and of all the records rendered in its placemark: its style, its stations with their
+ * exploitant, emetteurs, bandes and antennes. dictionary codes differ between sets, so their labels are fingerprinted instead */
+uint64_t
+support_fingerprint(struct anfr_set *set, void *record)
+{
+	struct support *sup = record;
+	struct station *sta;
+	struct emetteur *emr;
+	uint64_t fp = FINGERPRINT_INIT;
+	int n, e, b, a;
+
+	fp = fingerprint_int(fp, sup->sup_id);
+	fp = fingerprint_str(fp, nature_get_name(set->natures, sup->nat_id));
+	fp = fingerprint_int(fp, (int64_t)(sup->lat * 1000000));
+	fp = fingerprint_int(fp, (int64_t)(sup->lon * 1000000));
+	fp = fingerprint_int(fp, sup->sup_nm_haut);
+	fp = fingerprint_str(fp, proprietaire_get_name(set->proprietaires, sup->tpo_id));
+	fp = fingerprint_str(fp, sup->adr_lb_lieu);
+	fp = fingerprint_str(fp, sup->adr_lb_add0);
+	fp = fingerprint_str(fp, sup->adr_lb_add2);
+	fp = fingerprint_str(fp, sup->adr_lb_add3);
+	fp = fingerprint_str(fp, sup->adr_nm_cp_str);
+	fp = fingerprint_int(fp, sup->com_cd_insee);
+	/* the style also depends on the most recent date of the set, which changes between sets */
+	fp = fingerprint_int(fp, support_style(set, sup));
+	for (n=0; n<sup->sta_count; n++) {
+		fp = fingerprint_int(fp, sup->sta_nm_anfr[n]->nm);
+		sta = station_find(set->stations, sup->sta_nm_anfr[n]);
+		if (!sta)
+			continue;
+		fp = fingerprint_int(fp, station_fingerprint(sta));
+		fp = fingerprint_str(fp, exploitant_get_name(set->exploitants, sta->adm_id));
+		for (e=0; e<sta->emetteur_count; e++) {
+			emr = sta->emetteurs[e];
+			fp = fingerprint_int(fp, emetteur_fingerprint(set, emr));
+			for (b=0; b<emr->bande_count; b++)
+				fp = fingerprint_int(fp, bande_fingerprint(set, emr->bandes[b]));
+		}
+		for (a=0; a<sta->antenne_count; a++)
+			fp = fingerprint_int(fp, antenne_fingerprint(set, sta->antennes[a]));
 	}
+
+	return fp;
+}
+
+/* fingerprint of the fields of a station and of the ids of its emetteurs and antennes */
+uint64_t
+station_fingerprint(struct station *sta)
+{
+	uint64_t fp = FINGERPRINT_INIT;
+	int n;
+
+	fp = fingerprint_int(fp, sta->sta_nm.nm);
+	fp = fingerprint_int(fp, sta->adm_id);
+	fp = fingerprint_str(fp, sta->dem_nm_consis_str);
+	fp = fingerprint_int(fp, sta->dte_implemntatation);
+	fp = fingerprint_int(fp, sta->dte_modif);
+	fp = fingerprint_int(fp, sta->dte_en_service);
+	for (n=0; n<sta->emetteur_count; n++)
+		fp = fingerprint_int(fp, sta->emetteurs[n]->emr_id);
+	for (n=0; n<sta->antenne_count; n++)
+		fp = fingerprint_int(fp, sta->antennes[n]->aer_id);
+
+	return fp;
+}
+
+/* fingerprint of the fields of an emetteur and of the ids of its bandes */
+uint64_t
+emetteur_fingerprint(struct anfr_set *set, void *record)
+{
+	struct emetteur *emr = record;
+	uint64_t fp = FINGERPRINT_INIT;
+	int n;
+
+	fp = fingerprint_int(fp, emr->emr_id);
+	fp = fingerprint_str(fp, dict_label(&set->emetteurs->systemes, emr->systeme_id));
+	fp = fingerprint_int(fp, emr->sta_nm.nm);
+	fp = fingerprint_int(fp, emr->aer_id);
+	fp = fingerprint_str(fp, emr->emr_dt_service_str);
+	for (n=0; n<emr->bande_count; n++)
+		fp = fingerprint_int(fp, emr->bandes[n]->ban_id);
+
+	return fp;
+}
+
+uint64_t
+bande_fingerprint(struct anfr_set *set, void *record)
+{
+	struct bande *ban = record;
+	uint64_t fp = FINGERPRINT_INIT;
+
+	fp = fingerprint_int(fp, ban->ban_id);
+	fp = fingerprint_int(fp, ban->emr_id);
+	fp = fingerprint_int(fp, ban->sta_nm.nm);
+	fp = fingerprint_str(fp, ban->ban_nb_f_deb_str);
+	fp = fingerprint_str(fp, ban->ban_nb_f_fin_str);
+	fp = fingerprint_str(fp, dict_label(&set->bandes->unites, ban->ban_fg_unite));
+
+	return fp;
+}
+
+uint64_t
+antenne_fingerprint(struct anfr_set *set, void *record)
+{
+	struct antenne *aer = record;
+	uint64_t fp = FINGERPRINT_INIT;
+	int n;
+
+	fp = fingerprint_int(fp, aer->aer_id);
+	fp = fingerprint_int(fp, aer->tae_id);
+	fp = fingerprint_str(fp, aer->aer_nb_dimension_str);
+	fp = fingerprint_str(fp, dict_label(&set->antennes->rayons, aer->aer_fg_rayon));
+	fp = fingerprint_str(fp, aer->aer_nb_azimut_str);
+	fp = fingerprint_str(fp, aer->aer_nb_alt_bas_str);
+	for (n=0; n<aer->emetteur_count; n++)
+		fp = fingerprint_int(fp, aer->emetteurs[n]->emr_id);
+
+	return fp;
+}
+
+/* parses frequency range '<min>-<max>', each a number of Hz with an optional k, M or G suffix.
+ * returns -1 when invalid, negative, or above UINT64_MAX / 1e6 Hz (about 18 THz) */
+int
+frequency_range_parse(const char *str, uint64_t *min, uint64_t *max)
+{
+	const char *p = str;
+	char *end;
+	double f;
+	int n;
+
+	for (n=0; n<2; n++) {
+		f = strtod(p, &end);
+		if (end == p || !isfinite(f) || f < 0)
+			return -1;
+		switch (*end) {
+		case 'k':
+		case 'K':
+			f *= 1e3;
+			end++;
+			break;
+		case 'M':
+			f *= 1e6;
+			end++;
+			break;
+		case 'G':
+			f *= 1e9;
+			end++;
+			break;
+		}
+		if (*end != (n == 0 ? '-' : '\0'))
+			return -1;
+		if (f > (double)UINT64_MAX / 1e6)
+			return -1;
+		*(n == 0 ? min : max) = f;
+		p = end + 1;
+	}
+
+	return *min <= *max ? 0 : -1;
+}
+
+/* parses 'count' comma separated coordinates or distances of 'str' in 'args',
+ * followed by an integer in 'k' when not NULL.
+ * returns -1 when a value is missing, not finite, or followed by garbage */
+int
+geo_args_parse(const char *str, float *args, int count, int *k)
+{
+	const char *p = str;
+	char *end;
+	long l;
+	int n;
+
+	for (n=0; n<count; n++) {
+		args[n] = strtof(p, &end);
+		if (end == p || !isfinite(args[n]))
+			return -1;
+		if (*end != (n < count - 1 || k ? ',' : '\0'))
+			return -1;
+		p = end + 1;
+	}
+	if (k) {
+		errno = 0;
+		l = strtol(p, &end, 10);
+		if (end == p || *end != '\0' || errno || l < INT_MIN || l > INT_MAX)
+			return -1;
+		*k = l;
+	}
+
+	return 0;
+}
+
+/* lists the bandes overlapping frequencies 'min'-'max' in Hz, with their emetteur, station and support */
+void
+output_frequencies(struct anfr_set *set, uint64_t min, uint64_t max)
+{
+	struct frequency_scan scan;
+	struct bande_columns *cols = &set->bandes->columns;
+	struct support *sup;
+	struct station *sta, *prev;
+	struct emetteur *emr;
+	struct bande *ban;
+	uint64_t word;
+	int chunks, words, n, s, e, b, pos, last, found, sta_found;
+	int bandes_count = 0, emetteurs_count = 0, stations_count = 0, supports_count = 0;
+
+	/* scan the frequencies columns in parallel, into a bitmap of matching bandes */
+	chunks = (cols->count + FREQUENCY_SCAN_CHUNK - 1) / FREQUENCY_SCAN_CHUNK;
+	words = (cols->count + 63) / 64;
+	scan.cols = cols;
+	scan.min = min;
+	scan.max = max;
+	scan.bitmap = xmalloc_zero((words + 1) * sizeof(uint64_t));
+	scan.matches = xmalloc_zero((chunks + 1) * sizeof(int));
+	parallel_for(chunks, conf.jobs, frequencies_scan, &scan);
+	for (n=0; n<chunks; n++)
+		bandes_count += scan.matches[n];
+
+	/* the bandes of an emetteur are contiguous, so distinct emetteurs are counted on consecutive matches */
+	for (n=0, last=-1; n<words; n++) {
+		for (word=scan.bitmap[n]; word; word&=word-1) {
+			pos = n * 64 + __builtin_ctzll(word);
+			if (cols->emr_pos[pos] != last) {
+				last = cols->emr_pos[pos];
+				emetteurs_count++;
+			}
+		}
+	}
+
+	printf("SUP_ID;STA_NM_ANFR;ADM_LB_NOM;EMR_ID;EMR_LB_SYSTEME;BAN_NB_F_DEB;BAN_NB_F_FIN;BAN_FG_UNITE\n");
+	for (n=0; n<set->supports->index.count && bandes_count > 0; n++) {
+		sup = set->supports->index.items[n];
+		found = 0;
+		for (s=0, prev=NULL; s<sup->sta_count; s++) {
+			sta = station_find(set->stations, sup->sta_nm_anfr[s]);
+			if (!sta || sta == prev)
+				continue;
+			prev = sta;
+			sta_found = 0;
+			for (e=0; e<sta->emetteur_count; e++) {
+				emr = sta->emetteurs[e];
+				if (emr->bande_count == 0)
+					continue;
+				pos = emetteur_bandes_pos(set->bandes, emr);
+				for (b=0; b<emr->bande_count; b++, pos++) {
+					if (!(scan.bitmap[pos / 64] & (1ULL << (pos % 64))))
+						continue;
+					ban = emr->bandes[b];
+					printf("%d;%s;%s;%d;%s;%s;%s;%s\n", sup->sup_id, sta->sta_nm.str,
+						exploitant_get_name(set->exploitants, sta->adm_id), emr->emr_id,
+						dict_label(&set->emetteurs->systemes, emr->systeme_id),
+						ban->ban_nb_f_deb_str, ban->ban_nb_f_fin_str, dict_label(&set->bandes->unites, ban->ban_fg_unite));
+					sta_found = 1;
+				}
+			}
+			if (sta_found) {
+				stations_count++;
+				found = 1;
+			}
+		}
+		supports_count += found;
+	}
+	info("%d bandes of %d emetteurs between %" PRIu64 " and %" PRIu64 " Hz, listed on %d stations of %d supports\n",
+		bandes_count, emetteurs_count, min, max, stations_count, supports_count);
+
+	free(scan.bitmap);
+	free(scan.matches);
+}
+
+/* scans chunk 'n' of the frequencies columns */
+void
+frequencies_scan(void *arg, int n)
+{
+	struct frequency_scan *scan = arg;
+	int start = n * FREQUENCY_SCAN_CHUNK;
+	int count = scan->cols->count - start < FREQUENCY_SCAN_CHUNK ? scan->cols->count - start : FREQUENCY_SCAN_CHUNK;
+
+	scan->matches[n] = range_scan(scan->cols->f_deb + start, scan->cols->f_fin + start, count,
+		scan->min, scan->max, scan->bitmap + start / 64);
 }
 
 void
@@ -1659,7 +4388,7 @@ csv_stanm(struct csv *csv, struct sta_nm *sta_nm)
 		sta_nm->nm = atoi16_fast(tok);
 		memcpy(val, tok, STA_NM_LEN+1);
 		sta_nm->id = atoi_fast(val+STA_NM_DEPT_LEN+STA_NM_ZONE_LEN);
-		if (sta_nm->id < 0 || sta_nm->id > STATION_ID_MAX)
+		if (sta_nm->id < 0 || sta_nm->id >= STATION_ID_MAX)
 			errx(1, "invalid sta_nm id %d", sta_nm->id);
 		val[STA_NM_DEPT_LEN+STA_NM_ZONE_LEN] = '\0';
 		sta_nm->zone = atoi_fast(val+STA_NM_DEPT_LEN);
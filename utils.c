@@ -1,299 +1,2935 @@
 #ifdef __linux__
-#define _XOPEN_SOURCE /* for strptime() */
-#define _DEFAULT_SOURCE /* for strsep() and strdup() */
+#define _DEFAULT_SOURCE /* for strdup() */
+#define _GNU_SOURCE /* for program_invocation_short_name */
 #endif
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <err.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <limits.h>
+#include <math.h>
+#include <zlib.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "utils.h"
+
+/* KML templates, expanded at build time to copies of their literal segments and to field encoders writing to a strbuf.
+ * the literal segments and the numbers of a template take at most KML_TEMPLATE_FIXED_MAX bytes */
+#define KML_TEMPLATE_FIXED_MAX 1024
+
+/* KML colors : AABBGGRR */
+#define KML_HEADER_STYLES \
+	"\t<Style id=\"blue\">\n" \
+	"\t\t<IconStyle><color>ffff0000</color></IconStyle>\n" \
+	"\t</Style>\n" \
+	"\t<Style id=\"orange\">\n" \
+	"\t\t<IconStyle><color>ff0088ff</color></IconStyle>\n" \
+	"\t</Style>\n" \
+	"\t<Style id=\"red\">\n" \
+	"\t\t<IconStyle><color>ff0000ff</color></IconStyle>\n" \
+	"\t</Style>\n"
+
+#define KML_HEADER(buf, name, desc, date) do { \
+	strbuf_lit(buf, "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n" \
+		"<kml xmlns=\"http://www.opengis.net/kml/2.2\" xmlns:gx=\"http://www.google.com/kml/ext/2.2\">\n" \
+		"<Folder id=\""); \
+	strbuf_str(buf, name); \
+	strbuf_lit(buf, "\">\n" \
+		"\t<name>"); \
+	strbuf_str(buf, name); \
+	strbuf_lit(buf, "</name>\n" \
+		"\t<Snippet>"); \
+	strbuf_str(buf, desc); \
+	strbuf_lit(buf, "</Snippet>\n" \
+		"\t<description>Generated by https://github.com/looran/antennes"); \
+	if (date[0]) { \
+		strbuf_lit(buf, " on "); \
+		strbuf_str(buf, date); \
+	} \
+	strbuf_lit(buf, "</description>\n" \
+		KML_HEADER_STYLES); \
+} while (0)
+
+#define KML_DOC_START(buf, id, name) do { \
+	strbuf_lit(buf, "\t<Document id=\""); \
+	strbuf_str(buf, id); \
+	strbuf_lit(buf, "\">\n" \
+		"\t\t<name>"); \
+	strbuf_str(buf, name); \
+	strbuf_lit(buf, "</name>\n"); \
+} while (0)
+
+#define KML_PLACEMARK_POINT_START(buf, id, name) do { \
+	strbuf_lit(buf, "\t\t<Placemark id=\""); \
+	strbuf_int(buf, id); \
+	strbuf_lit(buf, "\">\n" \
+		"\t\t\t<name>"); \
+	strbuf_str(buf, name); \
+	strbuf_lit(buf, "</name>\n" \
+		"\t\t\t<description><![CDATA["); \
+} while (0)
+/* description is copied between KML_PLACEMARK_POINT_START and KML_PLACEMARK_POINT_END */
+#define KML_PLACEMARK_POINT_END(buf, styleurl, id, ts_begin, haut_mode, lon, lat, haut) do { \
+	strbuf_lit(buf, "]]></description>\n"); \
+	if (styleurl) { \
+		strbuf_lit(buf, "\t\t\t<styleUrl>#"); \
+		strbuf_str(buf, styleurl); \
+		strbuf_lit(buf, "</styleUrl>\n"); \
+	} \
+	if (ts_begin != DAY_NONE) { \
+		strbuf_lit(buf, "\t\t\t<TimeSpan id=\"ts"); \
+		strbuf_int(buf, id); \
+		strbuf_lit(buf, "\">\n" \
+			"\t\t\t  <begin>"); \
+		strbuf_date(buf, ts_begin); \
+		strbuf_lit(buf, "</begin>\n" \
+			"\t\t\t</TimeSpan>\n"); \
+	} \
+	strbuf_lit(buf, "\t\t\t<Point>\n" \
+		"\t\t\t\t<altitudeMode>"); \
+	strbuf_str(buf, haut_mode); \
+	strbuf_lit(buf, "</altitudeMode>\n" \
+		"\t\t\t\t<coordinates>"); \
+	strbuf_float6(buf, lon); \
+	strbuf_chr(buf, ','); \
+	strbuf_float6(buf, lat); \
+	strbuf_chr(buf, ','); \
+	strbuf_float6(buf, haut); \
+	strbuf_lit(buf, "</coordinates>\n" \
+		"\t\t\t</Point>\n" \
+		"\t\t</Placemark>\n"); \
+} while (0)
+
+#define KML_DOC_END \
+	"\t</Document>\n"
+
+#define KML_FOOTER \
+	"</Folder>\n" \
+	"</kml>\n"
+
+/* update files change the placemarks of a kml file already loaded by a client, see kml_update_open() */
+#define KML_UPDATE_HEADER(buf, href) do { \
+	strbuf_lit(buf, "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n" \
+		"<kml xmlns=\"http://www.opengis.net/kml/2.2\" xmlns:gx=\"http://www.google.com/kml/ext/2.2\">\n" \
+		"<NetworkLinkControl>\n" \
+		"\t<Update>\n" \
+		"\t\t<targetHref>"); \
+	strbuf_str(buf, href); \
+	strbuf_lit(buf, "</targetHref>\n"); \
+} while (0)
+
+#define KML_UPDATE_DELETE(buf, id) do { \
+	strbuf_lit(buf, "\t\t\t<Placemark targetId=\""); \
+	strbuf_int(buf, id); \
+	strbuf_lit(buf, "\"/>\n"); \
+} while (0)
+
+#define KML_UPDATE_CREATE(buf, id) do { \
+	strbuf_lit(buf, "\t\t<Create>\n" \
+		"\t\t\t<Document targetId=\""); \
+	strbuf_str(buf, id); \
+	strbuf_lit(buf, "\">\n"); \
+} while (0)
+
+#define KML_UPDATE_DELETE_START \
+	"\t\t<Delete>\n"
+#define KML_UPDATE_DELETE_END \
+	"\t\t</Delete>\n"
+#define KML_UPDATE_CREATE_END \
+	"\t\t\t</Document>\n" \
+	"\t\t</Create>\n"
+#define KML_UPDATE_SECTION_NONE 0
+#define KML_UPDATE_SECTION_DELETE 1
+#define KML_UPDATE_SECTION_CREATE 2
+#define KML_UPDATE_FOOTER \
+	"\t</Update>\n" \
+	"</NetworkLinkControl>\n" \
+	"</kml>\n"
+
+/* tiles of a super-overlay are documents with a region, linking to the tiles of the next level, see kml_tile_open() */
+#define KML_TILE_HEADER(buf, name, desc, date) do { \
+	strbuf_lit(buf, "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n" \
+		"<kml xmlns=\"http://www.opengis.net/kml/2.2\" xmlns:gx=\"http://www.google.com/kml/ext/2.2\">\n" \
+		"<Document>\n" \
+		"\t<name>"); \
+	strbuf_str(buf, name); \
+	strbuf_lit(buf, "</name>\n" \
+		"\t<Snippet>"); \
+	strbuf_str(buf, desc); \
+	strbuf_lit(buf, "</Snippet>\n" \
+		"\t<description>Generated by https://github.com/looran/antennes"); \
+	if (date[0]) { \
+		strbuf_lit(buf, " on "); \
+		strbuf_str(buf, date); \
+	} \
+	strbuf_lit(buf, "</description>\n" \
+		KML_HEADER_STYLES \
+		"\t<Style id=\"cluster\">\n" \
+		"\t\t<IconStyle><color>ff00ffff</color><scale>1.4</scale></IconStyle>\n" \
+		"\t</Style>\n"); \
+} while (0)
+
+#define KML_REGION(buf, indent, region) do { \
+	strbuf_str(buf, indent); \
+	strbuf_lit(buf, "<Region>\n"); \
+	strbuf_str(buf, indent); \
+	strbuf_lit(buf, "\t<LatLonAltBox><north>"); \
+	strbuf_float6(buf, (region)->north); \
+	strbuf_lit(buf, "</north><south>"); \
+	strbuf_float6(buf, (region)->south); \
+	strbuf_lit(buf, "</south><east>"); \
+	strbuf_float6(buf, (region)->east); \
+	strbuf_lit(buf, "</east><west>"); \
+	strbuf_float6(buf, (region)->west); \
+	strbuf_lit(buf, "</west></LatLonAltBox>\n"); \
+	strbuf_str(buf, indent); \
+	strbuf_lit(buf, "\t<Lod><minLodPixels>"); \
+	strbuf_int(buf, (region)->min_lod); \
+	strbuf_lit(buf, "</minLodPixels><maxLodPixels>"); \
+	strbuf_int(buf, (region)->max_lod); \
+	strbuf_lit(buf, "</maxLodPixels></Lod>\n"); \
+	strbuf_str(buf, indent); \
+	strbuf_lit(buf, "</Region>\n"); \
+} while (0)
+
+#define KML_TILE_CLUSTERS_START \
+	"\t<Folder>\n" \
+	"\t\t<name>clusters</name>\n"
+
+#define KML_TILE_CLUSTER(buf, count, lon, lat) do { \
+	strbuf_lit(buf, "\t\t<Placemark>\n" \
+		"\t\t\t<name>"); \
+	strbuf_int(buf, count); \
+	strbuf_lit(buf, " supports</name>\n" \
+		"\t\t\t<styleUrl>#cluster</styleUrl>\n" \
+		"\t\t\t<Point><coordinates>"); \
+	strbuf_float6(buf, lon); \
+	strbuf_chr(buf, ','); \
+	strbuf_float6(buf, lat); \
+	strbuf_lit(buf, ",0</coordinates></Point>\n" \
+		"\t\t</Placemark>\n"); \
+} while (0)
+
+#define KML_TILE_CLUSTERS_END \
+	"\t</Folder>\n"
+
+#define KML_TILE_LINK(buf, name, href, region) do { \
+	strbuf_lit(buf, "\t<NetworkLink>\n" \
+		"\t\t<name>"); \
+	strbuf_str(buf, name); \
+	strbuf_lit(buf, "</name>\n"); \
+	KML_REGION(buf, "\t\t", region); \
+	strbuf_lit(buf, "\t\t<Link><href>"); \
+	strbuf_str(buf, href); \
+	strbuf_lit(buf, "</href><viewRefreshMode>onRegion</viewRefreshMode></Link>\n" \
+		"\t</NetworkLink>\n"); \
+} while (0)
+
+#define KML_TILE_FOOTER \
+	"</Document>\n" \
+	"</kml>\n"
+
+#ifdef __linux__
+#define getprogname() program_invocation_short_name
+#endif
+
+extern struct conf conf;
+
+#define CSV_READ_SIZE (1024 * 1024)
+
+/* reads a non regular file (pipe, character device) into a heap buffer, aligned and padded to CSV_SCAN_SIZE bytes
+ * so that the block scanner never reads outside of it */
+static void
+csv_read(struct csv *csv, int f, char *path)
+{
+	size_t alloc = CSV_READ_SIZE;
+	ssize_t len;
+	char *buf;
+
+	if (posix_memalign((void **)&csv->file, CSV_SCAN_SIZE, alloc + CSV_SCAN_SIZE) != 0)
+		errx(1, "could not allocate csv buffer: %s", path);
+	csv->size = 0;
+	while (1) {
+		len = read(f, csv->file + csv->size, alloc - csv->size);
+		if (len == -1)
+			err(1, "could not read csv: %s", path);
+		if (len == 0)
+			break;
+		csv->size += len;
+		if (csv->size == alloc) {
+			alloc *= 2;
+			if (posix_memalign((void **)&buf, CSV_SCAN_SIZE, alloc + CSV_SCAN_SIZE) != 0)
+				errx(1, "could not allocate csv buffer: %s", path);
+			memcpy(buf, csv->file, csv->size);
+			free(csv->file);
+			csv->file = buf;
+		}
+	}
+	memset(csv->file + csv->size, 0, CSV_SCAN_SIZE);
+	csv->map_size = 0;
+}
+
+/* maps the file privately and writable, so that the parser can terminate fields in place without copying the file.
+ * the mapping is placed at the start of an anonymous reservation one byte larger than the file, which provides
+ * a writable terminating null byte even when the file size is a multiple of the page size. */
+static int
+csv_map(struct csv *csv, int f, size_t size)
+{
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	char *ptr;
+
+	csv->map_size = (size + 1 + pagesize - 1) & ~(pagesize - 1);
+	ptr = mmap(NULL, csv->map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+		return -1;
+	if (mmap(ptr, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, f, 0) == MAP_FAILED) {
+		munmap(ptr, csv->map_size);
+		return -1;
+	}
+	madvise(ptr, size, MADV_SEQUENTIAL);
+	madvise(ptr, size, MADV_WILLNEED);
+	csv->file = ptr;
+	csv->size = size;
+
+	return 0;
+}
+
+/* csv_scan_*() return a bitmask of the bytes of the CSV_SCAN_SIZE aligned block that are a separator,
+ * a newline, a quote or a null byte.
+ * the file buffer is aligned and padded to CSV_SCAN_SIZE, so aligned loads stay inside of it. blocks shared with
+ * the chunk of another parser thread are scanned by csv_scan_shared() instead, see csv_batches(). */
+#ifdef __x86_64__
+static uint32_t
+csv_scan_sse2(const char *block, char sep, char quote)
+{
+	__m128i vsep = _mm_set1_epi8(sep), vquote = _mm_set1_epi8(quote);
+	__m128i vnl = _mm_set1_epi8('\n'), vnul = _mm_setzero_si128();
+	__m128i lo = _mm_load_si128((const __m128i *)block);
+	__m128i hi = _mm_load_si128((const __m128i *)(block + 16));
+	__m128i mlo, mhi;
+
+	mlo = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lo, vsep), _mm_cmpeq_epi8(lo, vnl)),
+		_mm_or_si128(_mm_cmpeq_epi8(lo, vquote), _mm_cmpeq_epi8(lo, vnul)));
+	mhi = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(hi, vsep), _mm_cmpeq_epi8(hi, vnl)),
+		_mm_or_si128(_mm_cmpeq_epi8(hi, vquote), _mm_cmpeq_epi8(hi, vnul)));
+	return (uint32_t)_mm_movemask_epi8(mlo) | ((uint32_t)_mm_movemask_epi8(mhi) << 16);
+}
+
+__attribute__((target("avx2"))) static uint32_t
+csv_scan_avx2(const char *block, char sep, char quote)
+{
+	__m256i v = _mm256_load_si256((const __m256i *)block);
+	__m256i m;
+
+	m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(sep)), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+		_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(quote)), _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+	return (uint32_t)_mm256_movemask_epi8(m);
+}
+#else
+static uint32_t
+csv_scan_generic(const char *block, char sep, char quote)
+{
+	uint32_t mask = 0;
+	int n;
+
+	for (n=0; n<CSV_SCAN_SIZE; n++)
+		if (block[n] == sep || block[n] == '\n' || block[n] == quote || block[n] == '\0')
+			mask |= 1U << n;
+	return mask;
+}
+#endif
+
+/* scans a block partly outside of the bytes of the csv chunk, reading only these bytes */
+static uint32_t
+csv_scan_shared(struct csv *csv, const char *block)
+{
+	uint32_t mask = 0;
+	int n;
+
+	for (n=0; n<CSV_SCAN_SIZE; n++) {
+		if (block + n < csv->scan_start || block + n >= csv->scan_end)
+			continue;
+		if (block[n] == csv->sep[0] || block[n] == '\n' || block[n] == csv->quote[0] || block[n] == '\0')
+			mask |= 1U << n;
+	}
+	return mask;
+}
+
+static inline uint32_t
+csv_scan(struct csv *csv, const char *block)
+{
+	if (block < csv->scan_start || block + CSV_SCAN_SIZE > csv->scan_end)
+		return csv_scan_shared(csv, block);
+	return csv->scan(block, csv->sep[0], csv->quote[0]);
+}
+
+void
+csv_open(struct csv *csv, char *path, int conv, char sep, char quote)
+{
+	int f;
+	struct stat fstat;
+
+	if (stat(path, &fstat) == -1)
+		errx(1, "could not find csv: %s", path);
+	f = open(path, O_RDONLY);
+	if (f == -1)
+		err(1, "could not open csv: %s", path);
+	if (!S_ISREG(fstat.st_mode) || fstat.st_size == 0 || csv_map(csv, f, fstat.st_size) == -1)
+		csv_read(csv, f, path);
+	close(f);
+	csv->file[csv->size] = '\0';
+	csv->p = csv->file;
+	csv->scan_start = csv->file;
+	csv->scan_end = csv->file + ((csv->size + CSV_SCAN_SIZE) & ~(size_t)(CSV_SCAN_SIZE - 1));
+	csv->conv = conv;
+	csv->sep[0] = sep;
+	csv->sep[1] = '\0';
+	csv->quote[0] = quote;
+	csv->quote[1] = '\0';
+#ifdef __x86_64__
+	csv->scan = __builtin_cpu_supports("avx2") ? csv_scan_avx2 : csv_scan_sse2;
+#else
+	csv->scan = csv_scan_generic;
+#endif
+}
+
+void
+csv_close(struct csv *csv)
+{
+	if (csv->map_size)
+		munmap(csv->file, csv->map_size);
+	else
+		free(csv->file);
+}
+
+/* reads the next line and splits it in fields, terminating each of them in place.
+ * the line is scanned CSV_SCAN_SIZE bytes at a time for separators, newlines and quotes.
+ * returns 0 at the end of the file or at the first empty line. */
+int
+csv_line(struct csv *csv)
+{
+	char *p, *block, *c, *open = NULL;
+	uint32_t mask;
+
+	p = csv->p;
+	csv->line = p;
+	if (!p || *p == '\0' || *p == '\n') {
+		if (p && *p == '\n')
+			csv->p = p + 1;
+		return 0;
+	}
+	csv->line_count++;
+	csv->field_count = 0;
+	csv->fields[0] = p;
+	csv->fields_count = 1;
+	if (csv->quote[0] && *p == csv->quote[0]) {
+		open = p;
+		csv->fields[0] = p + 1;
+	}
+
+	block = (char *)((uintptr_t)p & ~(uintptr_t)(CSV_SCAN_SIZE - 1));
+	mask = csv_scan(csv, block) & (~0U << (p - block));
+	while (1) {
+		while (!mask) {
+			block += CSV_SCAN_SIZE;
+			mask = csv_scan(csv, block);
+		}
+		c = block + __builtin_ctz(mask);
+		mask &= mask - 1;
+		if (*c == '\n' || *c == '\0') {
+			/* end of line, also ends an unterminated quoted field */
+			csv->p = (*c == '\n') ? c + 1 : NULL;
+			*c = '\0';
+			if (c > p && *(c-1) == '\r')
+				*(c-1) = '\0'; /* remove \r */
+			return 1;
+		}
+		if (*c == csv->sep[0]) {
+			if (open || csv->fields_count == CSV_FIELDS_MAX)
+				continue; /* separator inside a quoted field, or too many fields */
+			*c = '\0';
+			csv->fields[csv->fields_count] = c + 1;
+			if (csv->quote[0] && *(c+1) == csv->quote[0]) {
+				open = c + 1;
+				csv->fields[csv->fields_count] = c + 2;
+			}
+			csv->fields_count++;
+			continue;
+		}
+		/* quote: terminates a quoted field if followed by a separator or the end of the line */
+		if (!open || c == open)
+			continue;
+		if (*(c+1) == csv->sep[0] || *(c+1) == '\n' || *(c+1) == '\0'
+				|| (*(c+1) == '\r' && (*(c+2) == '\n' || *(c+2) == '\0'))) {
+			*c = '\0';
+			open = NULL;
+		}
+	}
+}
+
+/* returns field 'n' of the current line, or an empty string if the line has less fields (old csv format).
+ * the empty string is the terminating null byte of the file, so that all fields belong to the file buffer */
+char *
+csv_field_at(struct csv *csv, int n)
+{
+	if (n >= csv->fields_count)
+		return csv->file + csv->size;
+	return csv->fields[n];
+}
+
+char *
+csv_field(struct csv *csv)
+{
+	return csv_field_at(csv, csv->field_count++);
+}
+
+/* splits the remaining lines of 'csv' in up to '*count' chunks, to be parsed in parallel.
+ * chunks end at the first empty line, like csv_line() does. the block scanner of a chunk only reads its bytes and
+ * its terminating null byte, as the bytes of the other chunks are written by their threads */
+struct csv_batch *
+csv_batches(struct csv *csv, int *count)
+{
+	struct csv_batch *batches;
+	char *start, *end, *cut, *p;
+	size_t len;
+	int n;
+
+	start = csv->p ? csv->p : "";
+	len = strlen(start);
+	if (start[0] == '\n')
+		len = 0;
+	else if ((p = memmem(start, len, "\n\n", 2)))
+		len = p - start + 1;
+	end = start + len;
+
+	batches = xmalloc_zero(*count * sizeof(struct csv_batch));
+	for (n=0; n<*count && start < end; n++) {
+		memcpy(&batches[n].csv, csv, sizeof(struct csv));
+		batches[n].csv.p = start;
+		batches[n].csv.line_count = 0;
+		/* cut the chunk at the end of the line following its share of the file */
+		batches[n].csv.scan_start = start;
+		cut = (n == *count - 1) ? NULL : memchr(start + (end - start) / (*count - n), '\n', end - start - (end - start) / (*count - n));
+		if (!cut) {
+			*end = '\0';
+			batches[n].csv.scan_end = end + 1;
+			start = end;
+			continue;
+		}
+		*cut = '\0';
+		batches[n].csv.scan_end = cut + 1;
+		if (cut > start && *(cut-1) == '\r')
+			*(cut-1) = '\0'; /* remove \r */
+		start = cut + 1;
+	}
+	*count = n;
+	csv->p = NULL;
+
+	return batches;
+}
+
+/* records 'row' parsed from the current line of the batch */
+void
+csv_batch_add(struct csv_batch *batch, void *row)
+{
+	if (batch->count == batch->alloc) {
+		batch->alloc = batch->alloc ? batch->alloc * 2 : 4096;
+		batch->rows = realloc(batch->rows, batch->alloc * sizeof(void *));
+		batch->lines = realloc(batch->lines, batch->alloc * sizeof(int));
+		if (!batch->rows || !batch->lines)
+			err(1, "realloc");
+	}
+	batch->rows[batch->count] = row;
+	batch->lines[batch->count] = batch->csv.line_count;
+	batch->count++;
+}
+
+/* returns the code in 'dict' of the value coded 'code' in the dictionary of 'batch'.
+ * called while linking rows in file order, values are coded in 'dict' by order of appearance in the file */
+int
+csv_batch_code(struct csv_batch *batch, struct dict *dict, int code)
+{
+	if (batch->dict_codes[code] == 0)
+		batch->dict_codes[code] = dict_code(dict, dict_label(&batch->dict, code)) + 1;
+
+	return batch->dict_codes[code] - 1;
+}
+
+/* frees batches, handing their rows storage over to 'arena' */
+void
+csv_batches_free(struct csv_batch *batches, int count, struct arena *arena)
+{
+	int n;
+
+	for (n=0; n<count; n++) {
+		arena_merge(arena, &batches[n].arena);
+		free(batches[n].rows);
+		free(batches[n].lines);
+	}
+	free(batches);
+}
+
+/* adds the file buffer to snapshot 'snap', the parser state is not kept */
+void
+csv_snapshot(struct snap *snap, struct csv *csv)
+{
+	snap_data(snap, csv->file, csv->size + 1);
+	snap_zero(snap, csv, sizeof(struct csv));
+}
+
+void
+csv_int(struct csv *csv, int *val, char **orig)
+{
+	char *tok = csv_field(csv);
+
+	if (tok) {
+		if (orig)
+			*orig = tok;
+		if (val)
+			*val = atoi_fast(tok);
+	}
+}
+
+void
+csv_int16(struct csv *csv, uint32_t *val, char **orig)
+{
+	char *tok = csv_field(csv);
+
+	if (tok) {
+		if (orig)
+			*orig = tok;
+		if (val)
+			*val = atoi16_fast(tok);
+	}
+}
+
+void
+csv_float(struct csv *csv, double *val, char **orig)
+{
+	char *tok = csv_field(csv);
+
+	if (tok) {
+		if (orig)
+			*orig = tok;
+		if (val)
+			*val = atof_fast(tok);
+	}
+}
+
+void
+csv_str(struct csv *csv, char **s)
+{
+	char *tok = csv_field(csv);
+
+	if (tok) {
+		if (csv->conv == CSV_CONV_UTF8_TO_ISO8859)
+			utf8_to_iso8859(tok);
+		*s = tok;
+	}
+}
+
+void
+csv_date(struct csv *csv, int32_t *val, char **orig)
+{
+	char *tok = csv_field(csv);
+
+	if (tok) {
+		if (orig)
+			*orig = tok;
+		if (val)
+			*val = date_parse(tok);
+	}
+}
+
+/* codes the next field in 'dict' */
+void
+csv_dict(struct csv *csv, struct dict *dict, uint8_t *code)
+{
+	char *tok = csv_field(csv);
+
+	if (csv->conv == CSV_CONV_UTF8_TO_ISO8859)
+		utf8_to_iso8859(tok);
+	*code = dict_code(dict, tok);
+}
+
+/* creates a file of a kml, which must not exist unless the kml is in 'manifest' */
+static void
+kml_file_open(struct kml_file *file, const char *path, struct manifest *manifest)
+{
+	struct stat fstat;
+
+	file->path = strdup(path);
+	if (manifest) {
+		if (asprintf(&file->tmp_path, "%s.XXXXXX", path) == -1)
+			err(1, "asprintf");
+		file->fd = mkstemp(file->tmp_path);
+		if (file->fd == -1 || fchmod(file->fd, 0644) == -1)
+			err(1, "could not create kml file %s", file->tmp_path);
+		sha256_init(&file->sha);
+	} else {
+		if (stat(path, &fstat) >= 0)
+			errx(1, "kml file already exists: %s", path);
+		file->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+		if (file->fd == -1)
+			errx(1, "could not create kml file %s\n", path);
+	}
+}
+
+static void
+kml_file_write(struct kml_file *file, struct manifest *manifest, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t n;
+
+	if (manifest)
+		sha256_update(&file->sha, data, len);
+	file->size += len;
+	while (len > 0) {
+		n = write(file->fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "could not write kml file %s", file->path);
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+/* closes a file of a kml, keeping the previous file if it is the same */
+static void
+kml_file_close(struct kml_file *file, struct manifest *manifest)
+{
+	uint8_t digest[SHA256_LEN];
+
+	if (close(file->fd) == -1)
+		err(1, "could not write kml file %s", file->path);
+	if (manifest) {
+		sha256_final(&file->sha, digest);
+		manifest_commit(manifest, file->path, file->tmp_path, digest, file->size);
+		free(file->tmp_path);
+	}
+	free(file->path);
+}
+
+static unsigned char *
+le_put(unsigned char *p, uint32_t value, int bytes)
+{
+	int n;
+
+	for (n=0; n<bytes; n++, value >>= 8)
+		*p++ = value & 0xff;
+
+	return p;
+}
+
+#define KMZ_ENTRY "doc.kml"
+#define KMZ_DOS_DATE 0x21 /* 1980-01-01, so that archives of the same kml are identical */
+
+/* creates the compressed copies of the kml at 'path' enabled in conf.compress, and writes their headers */
+static struct kml_deflate *
+kml_deflate_open(const char *path, struct manifest *manifest)
+{
+	struct kml_deflate *deflate;
+	unsigned char header[64], *p;
+	char cpath[PATH_MAX];
+	size_t len;
+	int n;
+
+	deflate = xmalloc_zero(sizeof(struct kml_deflate));
+	deflate->manifest = manifest;
+	len = strlen(path);
+	if (len > 4 && !strcmp(path + len - 4, ".kml"))
+		len -= 4;
+	if (conf.compress & KML_COMPRESS_GZ) {
+		deflate->gz = xmalloc_zero(sizeof(struct kml_file));
+		snprintf(cpath, sizeof(cpath), "%.*s.kml.gz", (int)len, path);
+		kml_file_open(deflate->gz, cpath, manifest);
+		p = header;
+		*p++ = 0x1f; *p++ = 0x8b; *p++ = 8; *p++ = 0; /* deflate, no flags */
+		p = le_put(p, 0, 4); /* no modification time */
+		*p++ = 0; *p++ = 3; /* unix */
+		kml_file_write(deflate->gz, manifest, header, p - header);
+	}
+	if (conf.compress & KML_COMPRESS_KMZ) {
+		deflate->kmz = xmalloc_zero(sizeof(struct kml_file));
+		snprintf(cpath, sizeof(cpath), "%.*s.kmz", (int)len, path);
+		kml_file_open(deflate->kmz, cpath, manifest);
+		/* local file header, sizes and crc follow the data in a data descriptor */
+		p = le_put(header, 0x04034b50, 4);
+		p = le_put(p, 20, 2); /* version needed */
+		p = le_put(p, 0x0008, 2); /* data descriptor */
+		p = le_put(p, 8, 2); /* deflate */
+		p = le_put(p, 0, 2);
+		p = le_put(p, KMZ_DOS_DATE, 2);
+		p = le_put(p, 0, 4);
+		p = le_put(p, 0, 4);
+		p = le_put(p, 0, 4);
+		p = le_put(p, sizeof(KMZ_ENTRY) - 1, 2);
+		p = le_put(p, 0, 2);
+		memcpy(p, KMZ_ENTRY, sizeof(KMZ_ENTRY) - 1);
+		p += sizeof(KMZ_ENTRY) - 1;
+		kml_file_write(deflate->kmz, manifest, header, p - header);
+	}
+	deflate->block_count = conf.jobs;
+	deflate->blocks = xmalloc_zero(deflate->block_count * sizeof(struct kml_deflate_block));
+	for (n=0; n<deflate->block_count; n++) {
+		deflate->blocks[n].in = malloc(KML_DEFLATE_DICT + KML_DEFLATE_BLOCK);
+		if (!deflate->blocks[n].in)
+			err(1, "malloc");
+	}
+	deflate->crc = crc32(0, NULL, 0);
+
+	return deflate;
+}
+
+/* deflates block 'n', as raw deflate data ending on a byte boundary, or with the final block of the stream if last */
+static void
+kml_deflate_block(void *arg, int n)
+{
+	struct kml_deflate *kd = arg;
+	struct kml_deflate_block *block = &kd->blocks[n];
+	unsigned char *in = block->in + KML_DEFLATE_DICT;
+	z_stream zs;
+	size_t bound;
+
+	bzero(&zs, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		errx(1, "deflateInit2 failed");
+	if (block->dict_len > 0)
+		deflateSetDictionary(&zs, in - block->dict_len, block->dict_len);
+	bound = deflateBound(&zs, block->in_len) + 16;
+	if (bound > block->out_alloc) {
+		free(block->out);
+		block->out = malloc(bound);
+		if (!block->out)
+			err(1, "malloc");
+		block->out_alloc = bound;
+	}
+	zs.next_in = in;
+	zs.avail_in = block->in_len;
+	zs.next_out = block->out;
+	zs.avail_out = block->out_alloc;
+	if (deflate(&zs, block->last ? Z_FINISH : Z_SYNC_FLUSH) == Z_STREAM_ERROR || zs.avail_in != 0)
+		errx(1, "deflate failed");
+	block->out_len = zs.total_out;
+	block->crc = crc32(0, in, block->in_len);
+	deflateEnd(&zs);
+}
+
+/* deflates the filled blocks in parallel and appends them in order to the compressed copies.
+ * the end of the last block is kept as dictionary of the next first block */
+static void
+kml_deflate_flush(struct kml_deflate *deflate, int last)
+{
+	struct kml_deflate_block *block, *first;
+	size_t dict_len;
+	int n;
+
+	if (deflate->filled == 0)
+		deflate->filled = 1; /* empty final block */
+	if (last)
+		deflate->blocks[deflate->filled - 1].last = 1;
+	parallel_for(deflate->filled, conf.jobs, kml_deflate_block, deflate);
+	for (n=0; n<deflate->filled; n++) {
+		block = &deflate->blocks[n];
+		deflate->crc = crc32_combine(deflate->crc, block->crc, block->in_len);
+		deflate->in_size += block->in_len;
+		deflate->out_size += block->out_len;
+		if (deflate->gz)
+			kml_file_write(deflate->gz, deflate->manifest, block->out, block->out_len);
+		if (deflate->kmz)
+			kml_file_write(deflate->kmz, deflate->manifest, block->out, block->out_len);
+	}
+	block = &deflate->blocks[deflate->filled - 1];
+	first = &deflate->blocks[0];
+	dict_len = block->dict_len + block->in_len < KML_DEFLATE_DICT ? block->dict_len + block->in_len : KML_DEFLATE_DICT;
+	memmove(first->in + KML_DEFLATE_DICT - dict_len, block->in + KML_DEFLATE_DICT + block->in_len - dict_len, dict_len);
+	first->dict_len = dict_len;
+	first->in_len = 0;
+	deflate->filled = 0;
+}
+
+/* copies 'len' bytes of kml text to the blocks to deflate, deflating them when they are all full */
+static void
+kml_deflate_add(struct kml_deflate *deflate, const void *data, size_t len)
+{
+	struct kml_deflate_block *block, *prev;
+	const char *p = data;
+	size_t n;
+
+	while (len > 0) {
+		if (deflate->filled == 0)
+			deflate->filled = 1;
+		block = &deflate->blocks[deflate->filled - 1];
+		if (block->in_len == KML_DEFLATE_BLOCK) {
+			if (deflate->filled == deflate->block_count) {
+				kml_deflate_flush(deflate, 0);
+				continue;
+			}
+			/* next block, with the end of this one as dictionary */
+			prev = block;
+			block = &deflate->blocks[deflate->filled++];
+			block->dict_len = KML_DEFLATE_DICT;
+			memcpy(block->in, prev->in + KML_DEFLATE_BLOCK, KML_DEFLATE_DICT);
+			block->in_len = 0;
+		}
+		n = KML_DEFLATE_BLOCK - block->in_len;
+		if (n > len)
+			n = len;
+		memcpy(block->in + KML_DEFLATE_DICT + block->in_len, p, n);
+		block->in_len += n;
+		p += n;
+		len -= n;
+	}
+}
+
+/* deflates the remaining text, writes the trailers of the compressed copies and closes them */
+static void
+kml_deflate_close(struct kml_deflate *deflate)
+{
+	unsigned char trailer[128], *p;
+	uint32_t cd_offset;
+	int n;
+
+	kml_deflate_flush(deflate, 1);
+	if (deflate->gz) {
+		p = le_put(trailer, deflate->crc, 4);
+		p = le_put(p, deflate->in_size, 4); /* modulo 2^32 */
+		kml_file_write(deflate->gz, deflate->manifest, trailer, p - trailer);
+		kml_file_close(deflate->gz, deflate->manifest);
+		free(deflate->gz);
+	}
+	if (deflate->kmz) {
+		if (deflate->in_size > UINT32_MAX || deflate->kmz->size > UINT32_MAX - 256)
+			errx(1, "kmz file too large for zip format without zip64: %s", deflate->kmz->path);
+		/* data descriptor */
+		p = le_put(trailer, 0x08074b50, 4);
+		p = le_put(p, deflate->crc, 4);
+		p = le_put(p, deflate->out_size, 4);
+		p = le_put(p, deflate->in_size, 4);
+		cd_offset = deflate->kmz->size + (p - trailer);
+		/* central directory */
+		p = le_put(p, 0x02014b50, 4);
+		p = le_put(p, 0x0314, 2); /* made by unix, version 2.0 */
+		p = le_put(p, 20, 2);
+		p = le_put(p, 0x0008, 2);
+		p = le_put(p, 8, 2);
+		p = le_put(p, 0, 2);
+		p = le_put(p, KMZ_DOS_DATE, 2);
+		p = le_put(p, deflate->crc, 4);
+		p = le_put(p, deflate->out_size, 4);
+		p = le_put(p, deflate->in_size, 4);
+		p = le_put(p, sizeof(KMZ_ENTRY) - 1, 2);
+		p = le_put(p, 0, 2); /* extra */
+		p = le_put(p, 0, 2); /* comment */
+		p = le_put(p, 0, 2); /* disk */
+		p = le_put(p, 0, 2); /* internal attributes */
+		p = le_put(p, 0100644U << 16, 4); /* external attributes: unix mode */
+		p = le_put(p, 0, 4); /* local header offset */
+		memcpy(p, KMZ_ENTRY, sizeof(KMZ_ENTRY) - 1);
+		p += sizeof(KMZ_ENTRY) - 1;
+		/* end of central directory */
+		n = p - trailer - (cd_offset - deflate->kmz->size);
+		p = le_put(p, 0x06054b50, 4);
+		p = le_put(p, 0, 2);
+		p = le_put(p, 0, 2);
+		p = le_put(p, 1, 2);
+		p = le_put(p, 1, 2);
+		p = le_put(p, n, 4);
+		p = le_put(p, cd_offset, 4);
+		p = le_put(p, 0, 2);
+		kml_file_write(deflate->kmz, deflate->manifest, trailer, p - trailer);
+		kml_file_close(deflate->kmz, deflate->manifest);
+		free(deflate->kmz);
+	}
+	for (n=0; n<deflate->block_count; n++) {
+		free(deflate->blocks[n].in);
+		free(deflate->blocks[n].out);
+	}
+	free(deflate->blocks);
+	free(deflate);
+}
+
+/* writes the pending data of 'kml' with writev(), and to its compressed copies */
+static void
+kml_flush(struct kml *kml)
+{
+	struct iovec *iov = kml->iov;
+	int count = kml->iov_count;
+	ssize_t len;
+	int n;
+
+	for (n=0; n<count; n++) {
+		if (kml->manifest)
+			sha256_update(&kml->file.sha, iov[n].iov_base, iov[n].iov_len);
+		if (kml->deflate)
+			kml_deflate_add(kml->deflate, iov[n].iov_base, iov[n].iov_len);
+		kml->file.size += iov[n].iov_len;
+	}
+	while (count > 0) {
+		len = writev(kml->file.fd, iov, count);
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "could not write kml file %s", kml->file.path);
+		}
+		for (; count > 0 && (size_t)len >= iov->iov_len; iov++, count--)
+			len -= iov->iov_len;
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+	kml->iov_count = 0;
+	kml->text_len = 0;
+}
+
+/* queues 'len' bytes at 'data' for writing, without copying them */
+static void
+kml_ref(struct kml *kml, const void *data, size_t len)
+{
+	struct iovec *last;
+
+	if (len == 0)
+		return;
+	if (kml->iov_count > 0) {
+		last = &kml->iov[kml->iov_count - 1];
+		if ((const char *)last->iov_base + last->iov_len == data) {
+			last->iov_len += len;
+			return;
+		}
+	}
+	if (kml->iov_count == KML_IOV_MAX)
+		kml_flush(kml);
+	kml->iov[kml->iov_count].iov_base = (void *)data;
+	kml->iov[kml->iov_count].iov_len = len;
+	kml->iov_count++;
+}
+
+/* returns room for 'len' bytes of text to format, queued for writing by kml_commit() */
+static char *
+kml_reserve(struct kml *kml, size_t len)
+{
+	if (len > KML_TEXT_BUF_SIZE)
+		errx(1, "kml text size %zu exceeded buffer size %d", len, KML_TEXT_BUF_SIZE);
+	if (kml->text_len + len > KML_TEXT_BUF_SIZE)
+		kml_flush(kml);
+
+	return kml->text + kml->text_len;
+}
+
+/* queues the text formatted from kml_reserve() up to 'end' for writing */
+static void
+kml_commit(struct kml *kml, char *end)
+{
+	size_t len = end - (kml->text + kml->text_len);
+
+	kml_ref(kml, kml->text + kml->text_len, len);
+	kml->text_len += len;
+}
+
+/* creates a kml and its compressed copies */
+static struct kml *
+kml_create(const char *path, struct manifest *manifest)
+{
+	struct kml *kml = xmalloc_zero(sizeof(struct kml));
+
+	verb("creating KML file %s\n", path);
+	kml->manifest = manifest;
+	kml_file_open(&kml->file, path, manifest);
+	if (conf.compress)
+		kml->deflate = kml_deflate_open(path, manifest);
+	kml->text = malloc(KML_TEXT_BUF_SIZE);
+	if (!kml->text)
+		err(1, "malloc");
+
+	return kml;
+}
+
+/* writes the footer of a kml and closes its files */
+static void
+kml_finish(struct kml *kml, const char *footer, size_t len)
+{
+	kml_ref(kml, footer, len);
+	kml_flush(kml);
+
+	if (kml->deflate)
+		kml_deflate_close(kml->deflate);
+	kml_file_close(&kml->file, kml->manifest);
+	free(kml->text);
+	free(kml);
+}
+
+/* opens a kml file. with a manifest, the file is replaced once closed only if it changed since the previous run */
+struct kml *
+kml_open(const char *path, const char *name, const char *desc, struct manifest *manifest)
+{
+	struct kml *kml;
+	char *buf;
+
+	kml = kml_create(path, manifest);
+	buf = kml_reserve(kml, KML_TEMPLATE_FIXED_MAX + 2 * strlen(name) + strlen(desc) + strlen(conf.now_str));
+	KML_HEADER(buf, name, desc, conf.now_str);
+	kml_commit(kml, buf);
+
+	return kml;
+}
+
+void
+kml_close(struct kml *kml)
+{
+	verb("closing kml file %s with %d docs\n", kml->file.path, kml->docs_count);
+
+	if (kml->doc_open)
+		kml_doc_end(kml);
+	kml_finish(kml, KML_FOOTER, sizeof(KML_FOOTER)-1);
+}
+
+/* starts a new document of id 'doc_id', ending the current one */
+void
+kml_doc_begin(struct kml *kml, const char *doc_id, const char *doc_name)
+{
+	char *buf;
+
+	if (kml->doc_open)
+		kml_doc_end(kml);
+	buf = kml_reserve(kml, KML_TEMPLATE_FIXED_MAX + strlen(doc_id) + strlen(doc_name));
+	KML_DOC_START(buf, doc_id, doc_name);
+	kml_commit(kml, buf);
+	kml->doc_open = 1;
+	kml->docs_count++;
+}
+
+void
+kml_doc_end(struct kml *kml)
+{
+	kml_ref(kml, KML_DOC_END, sizeof(KML_DOC_END)-1);
+	kml->doc_open = 0;
+}
+
+/* formats a placemark in 'buf' of 'size' bytes, and returns its length.
+ * the description is the concatenation of the 'desc_count' parts of 'desc' */
+int
+kml_placemark_point(char *buf, size_t size, int id, const char *name, const struct iovec *desc, int desc_count, float lat, float lon, float haut, const char *haut_mode, const char *styleurl, int32_t ts_begin)
+{
+	char *p = buf;
+	size_t len;
+	int n;
+
+	len = KML_TEMPLATE_FIXED_MAX + strlen(name) + strlen(haut_mode) + (styleurl ? strlen(styleurl) : 0);
+	for (n=0; n<desc_count; n++)
+		len += desc[n].iov_len;
+	if (len >= size)
+		errx(1, "kml_placemark_point internal buffer limit reached (%zu)", len);
+
+	KML_PLACEMARK_POINT_START(p, id, name);
+	for (n=0; n<desc_count; n++) {
+		memcpy(p, desc[n].iov_base, desc[n].iov_len);
+		p += desc[n].iov_len;
+	}
+	KML_PLACEMARK_POINT_END(p, styleurl, id, ts_begin, haut_mode, lon, lat, haut);
+
+	return p - buf;
+}
+
+/* appends placemarks formatted by kml_placemark_point() to the current document of 'kml'.
+ * they are not copied, and must stay valid until kml_close() */
+void
+kml_add_placemark(struct kml *kml, const char *placemark, size_t len)
+{
+	kml_ref(kml, placemark, len);
+}
+
+/* opens an update file of the kml file at 'href', made of sections deleting placemarks or creating them in a document.
+ * clients apply it to their copy of 'href' when it is loaded through a NetworkLink */
+struct kml *
+kml_update_open(const char *path, const char *href)
+{
+	struct kml *kml;
+	char *buf;
+
+	kml = kml_create(path, NULL);
+	buf = kml_reserve(kml, KML_TEMPLATE_FIXED_MAX + strlen(href));
+	KML_UPDATE_HEADER(buf, href);
+	kml_commit(kml, buf);
+
+	return kml;
+}
+
+/* ends the current section of an update file */
+static void
+kml_update_end(struct kml *kml)
+{
+	if (kml->update_section == KML_UPDATE_SECTION_DELETE)
+		kml_ref(kml, KML_UPDATE_DELETE_END, sizeof(KML_UPDATE_DELETE_END)-1);
+	else if (kml->update_section == KML_UPDATE_SECTION_CREATE)
+		kml_ref(kml, KML_UPDATE_CREATE_END, sizeof(KML_UPDATE_CREATE_END)-1);
+	kml->update_section = KML_UPDATE_SECTION_NONE;
+}
+
+void
+kml_update_close(struct kml *kml)
+{
+	verb("closing kml update file %s\n", kml->file.path);
+
+	kml_update_end(kml);
+	kml_finish(kml, KML_UPDATE_FOOTER, sizeof(KML_UPDATE_FOOTER)-1);
+}
+
+/* deletes the placemark of id 'id', in the current delete section or a new one */
+void
+kml_update_delete(struct kml *kml, int id)
+{
+	char *buf;
+
+	if (kml->update_section != KML_UPDATE_SECTION_DELETE) {
+		kml_update_end(kml);
+		kml_ref(kml, KML_UPDATE_DELETE_START, sizeof(KML_UPDATE_DELETE_START)-1);
+		kml->update_section = KML_UPDATE_SECTION_DELETE;
+	}
+	buf = kml_reserve(kml, KML_TEMPLATE_FIXED_MAX);
+	KML_UPDATE_DELETE(buf, id);
+	kml_commit(kml, buf);
+}
+
+/* starts a section creating the placemarks added with kml_add_placemark() in the document of id 'doc_id' */
+void
+kml_update_create(struct kml *kml, const char *doc_id)
+{
+	char *buf;
+
+	kml_update_end(kml);
+	buf = kml_reserve(kml, KML_TEMPLATE_FIXED_MAX + strlen(doc_id));
+	KML_UPDATE_CREATE(buf, doc_id);
+	kml_commit(kml, buf);
+	kml->update_section = KML_UPDATE_SECTION_CREATE;
+	kml->docs_count++;
+}
+
+/* opens a tile of a super-overlay, shown while 'region' is active. it holds placemarks added with kml_add_placemark(),
+ * clusters of placemarks, and links to the tiles of the next level loaded by clients once their region is active */
+struct kml *
+kml_tile_open(const char *path, const char *name, const char *desc, const struct kml_region *region, struct manifest *manifest)
+{
+	struct kml *kml;
+	char *buf;
+
+	kml = kml_create(path, manifest);
+	buf = kml_reserve(kml, KML_TEMPLATE_FIXED_MAX + strlen(name) + strlen(desc) + strlen(conf.now_str));
+	KML_TILE_HEADER(buf, name, desc, conf.now_str);
+	KML_REGION(buf, "\t", region);
+	kml_commit(kml, buf);
+
+	return kml;
+}
+
+void
+kml_tile_close(struct kml *kml)
+{
+	verb("closing kml tile %s\n", kml->file.path);
+
+	kml_finish(kml, KML_TILE_FOOTER, sizeof(KML_TILE_FOOTER)-1);
+}
+
+/* starts a folder of clusters, shown only while 'region' is active */
+void
+kml_tile_clusters_begin(struct kml *kml, const struct kml_region *region)
+{
+	char *buf;
+
+	kml_ref(kml, KML_TILE_CLUSTERS_START, sizeof(KML_TILE_CLUSTERS_START)-1);
+	buf = kml_reserve(kml, KML_TEMPLATE_FIXED_MAX);
+	KML_REGION(buf, "\t\t", region);
+	kml_commit(kml, buf);
+}
+
+void
+kml_tile_clusters_end(struct kml *kml)
+{
+	kml_ref(kml, KML_TILE_CLUSTERS_END, sizeof(KML_TILE_CLUSTERS_END)-1);
+}
+
+/* adds a placemark standing for 'count' placemarks around 'lat', 'lon' */
+void
+kml_tile_cluster(struct kml *kml, int count, float lat, float lon)
+{
+	char *buf;
+
+	buf = kml_reserve(kml, KML_TEMPLATE_FIXED_MAX);
+	KML_TILE_CLUSTER(buf, count, lon, lat);
+	kml_commit(kml, buf);
+}
+
+/* links to the tile at 'href', relative to this tile, loaded once 'region' is active */
+void
+kml_tile_link(struct kml *kml, const char *name, const char *href, const struct kml_region *region)
+{
+	char *buf;
+
+	buf = kml_reserve(kml, KML_TEMPLATE_FIXED_MAX + strlen(name) + strlen(href));
+	KML_TILE_LINK(buf, name, href, region);
+	kml_commit(kml, buf);
+}
+
+static int
+manifest_entry_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct manifest_entry *)a)->path, ((const struct manifest_entry *)b)->path);
+}
+
+static struct manifest_entry *
+manifest_add(struct manifest *manifest, const char *path)
+{
+	struct manifest_entry *entry;
+
+	if (manifest->count == manifest->alloc) {
+		manifest->alloc = manifest->alloc * 2 + 64;
+		manifest->entries = realloc(manifest->entries, manifest->alloc * sizeof(struct manifest_entry));
+		if (!manifest->entries)
+			err(1, "realloc");
+	}
+	entry = &manifest->entries[manifest->count++];
+	bzero(entry, sizeof(*entry));
+	entry->path = strdup(path);
+
+	return entry;
+}
+
+/* loads the manifest of output directory 'dir', empty if there was no previous run */
+struct manifest *
+manifest_load(const char *dir)
+{
+	struct manifest *manifest;
+	struct manifest_entry *entry;
+	char path[PATH_MAX], line[PATH_MAX + 128], hex[2*SHA256_LEN+1], file[PATH_MAX];
+	long long size;
+	unsigned int byte;
+	FILE *f;
+	int n;
+
+	manifest = xmalloc_zero(sizeof(struct manifest));
+	manifest->dir = strdup(dir);
+	snprintf(path, sizeof(path), "%s/%s", dir, MANIFEST_FILE);
+	f = fopen(path, "r");
+	if (!f) {
+		if (errno != ENOENT)
+			err(1, "could not read manifest %s", path);
+		return manifest;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%64s %lld %[^\n]", hex, &size, file) != 3 || strlen(hex) != 2*SHA256_LEN)
+			errx(1, "invalid manifest line in %s: %s", path, line);
+		entry = manifest_add(manifest, file);
+		entry->size = size;
+		for (n=0; n<SHA256_LEN; n++) {
+			if (sscanf(hex + 2*n, "%2x", &byte) != 1)
+				errx(1, "invalid manifest digest in %s: %s", path, hex);
+			entry->digest[n] = byte;
+		}
+	}
+	fclose(f);
+	if (manifest->count > 0)
+		qsort(manifest->entries, manifest->count, sizeof(struct manifest_entry), manifest_entry_cmp);
+	manifest->loaded = manifest->count;
+	verb("loaded manifest %s with %d files\n", path, manifest->count);
+
+	return manifest;
+}
+
+/* keeps file 'path' if it has the digest and size it had in the previous run, or replaces it with the file 'tmp_path' */
+void
+manifest_commit(struct manifest *manifest, const char *path, const char *tmp_path, const uint8_t *digest, int64_t size)
+{
+	struct manifest_entry key, *entry;
+	struct stat fstat;
+	size_t dir_len;
+
+	dir_len = strlen(manifest->dir);
+	if (strncmp(path, manifest->dir, dir_len) || path[dir_len] != '/')
+		errx(1, "manifest: file %s is not in %s", path, manifest->dir);
+	key.path = (char *)path + dir_len + 1;
+	entry = NULL;
+	if (manifest->loaded > 0) /* no previous manifest, entries may still be NULL */
+		entry = bsearch(&key, manifest->entries, manifest->loaded, sizeof(struct manifest_entry), manifest_entry_cmp);
+	if (entry && entry->size == size && !memcmp(entry->digest, digest, SHA256_LEN)
+			&& stat(path, &fstat) == 0 && fstat.st_size == size) {
+		verb("unchanged kml file %s\n", path);
+		if (unlink(tmp_path) == -1)
+			err(1, "could not remove %s", tmp_path);
+		manifest->unchanged++;
+	} else {
+		if (rename(tmp_path, path) == -1)
+			err(1, "could not rename %s to %s", tmp_path, path);
+		manifest->replaced++;
+	}
+	if (!entry)
+		entry = manifest_add(manifest, key.path);
+	memcpy(entry->digest, digest, SHA256_LEN);
+	entry->size = size;
+	entry->written = 1;
+}
+
+/* removes the files of the previous run not written by this one, and writes the manifest */
+void
+manifest_save(struct manifest *manifest)
+{
+	struct manifest_entry *entry;
+	char path[PATH_MAX], tmp_path[PATH_MAX + 8];
+	FILE *f;
+	int n, b;
+
+	snprintf(path, sizeof(path), "%s/%s", manifest->dir, MANIFEST_FILE);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	f = fopen(tmp_path, "w");
+	if (!f)
+		err(1, "could not create manifest %s", tmp_path);
+	if (manifest->count > 0)
+		qsort(manifest->entries, manifest->count, sizeof(struct manifest_entry), manifest_entry_cmp);
+	for (n=0; n<manifest->count; n++) {
+		entry = &manifest->entries[n];
+		if (!entry->written) {
+			snprintf(path, sizeof(path), "%s/%s", manifest->dir, entry->path);
+			verb("removing kml file %s\n", path);
+			if (unlink(path) == -1 && errno != ENOENT)
+				err(1, "could not remove %s", path);
+			manifest->removed++;
+		} else {
+			for (b=0; b<SHA256_LEN; b++)
+				fprintf(f, "%02x", entry->digest[b]);
+			fprintf(f, " %lld %s\n", (long long)entry->size, entry->path);
+		}
+	}
+	if (fclose(f) == EOF)
+		err(1, "could not write manifest %s", tmp_path);
+	snprintf(path, sizeof(path), "%s/%s", manifest->dir, MANIFEST_FILE);
+	if (rename(tmp_path, path) == -1)
+		err(1, "could not rename %s to %s", tmp_path, path);
+}
+
+void
+manifest_free(struct manifest *manifest)
+{
+	int n;
+
+	for (n=0; n<manifest->count; n++)
+		free(manifest->entries[n].path);
+	free(manifest->entries);
+	free(manifest->dir);
+	free(manifest);
+}
+
+/* computes the SHA-256 of the file at 'path', returns -1 if it could not be read */
+int
+sha256_file(const char *path, uint8_t *digest)
+{
+	struct sha256 sha;
+	char buf[65536];
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	sha256_init(&sha);
+	while ((len = read(fd, buf, sizeof(buf))) != 0) {
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		sha256_update(&sha, buf, len);
+	}
+	close(fd);
+	sha256_final(&sha, digest);
+
+	return 0;
+}
+
+static const uint32_t SHA256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define SHA256_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+sha256_block(struct sha256 *sha, const uint8_t *block)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int n;
+
+	for (n=0; n<16; n++)
+		w[n] = (uint32_t)block[4*n] << 24 | (uint32_t)block[4*n+1] << 16 | (uint32_t)block[4*n+2] << 8 | block[4*n+3];
+	for (n=16; n<64; n++)
+		w[n] = w[n-16] + (SHA256_ROR(w[n-15], 7) ^ SHA256_ROR(w[n-15], 18) ^ (w[n-15] >> 3))
+			+ w[n-7] + (SHA256_ROR(w[n-2], 17) ^ SHA256_ROR(w[n-2], 19) ^ (w[n-2] >> 10));
+	a = sha->h[0]; b = sha->h[1]; c = sha->h[2]; d = sha->h[3];
+	e = sha->h[4]; f = sha->h[5]; g = sha->h[6]; h = sha->h[7];
+	for (n=0; n<64; n++) {
+		t1 = h + (SHA256_ROR(e, 6) ^ SHA256_ROR(e, 11) ^ SHA256_ROR(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[n] + w[n];
+		t2 = (SHA256_ROR(a, 2) ^ SHA256_ROR(a, 13) ^ SHA256_ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	sha->h[0] += a; sha->h[1] += b; sha->h[2] += c; sha->h[3] += d;
+	sha->h[4] += e; sha->h[5] += f; sha->h[6] += g; sha->h[7] += h;
+}
+
+void
+sha256_init(struct sha256 *sha)
+{
+	static const uint32_t h[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(sha->h, h, sizeof(h));
+	sha->len = 0;
+}
+
+void
+sha256_update(struct sha256 *sha, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	size_t used = sha->len % 64, n;
+
+	sha->len += len;
+	if (used) {
+		n = 64 - used < len ? 64 - used : len;
+		memcpy(sha->block + used, p, n);
+		p += n;
+		len -= n;
+		if (used + n < 64)
+			return;
+		sha256_block(sha, sha->block);
+	}
+	for (; len >= 64; p += 64, len -= 64)
+		sha256_block(sha, p);
+	memcpy(sha->block, p, len);
+}
+
+void
+sha256_final(struct sha256 *sha, uint8_t *digest)
+{
+	uint64_t bits = sha->len * 8;
+	size_t used = sha->len % 64;
+	int n;
+
+	sha->block[used++] = 0x80;
+	if (used > 56) {
+		bzero(sha->block + used, 64 - used);
+		sha256_block(sha, sha->block);
+		used = 0;
+	}
+	bzero(sha->block + used, 56 - used);
+	for (n=0; n<8; n++)
+		sha->block[56 + n] = bits >> (56 - 8*n);
+	sha256_block(sha, sha->block);
+	for (n=0; n<32; n++)
+		digest[n] = sha->h[n/4] >> (24 - 8*(n%4));
+}
+
+#define ARENA_CHUNK_SIZE (8 * 1024 * 1024)
+#define ARENA_CHUNK_ALIGN (2 * 1024 * 1024) /* huge page size */
+#define ARENA_ALIGN 8
+
+static struct arena_chunk *
+arena_chunk_new(size_t size)
+{
+	struct arena_chunk *chunk = MAP_FAILED;
+
+	size = (size + sizeof(struct arena_chunk) + ARENA_CHUNK_ALIGN - 1) & ~((size_t)ARENA_CHUNK_ALIGN - 1);
+#ifdef MAP_HUGETLB
+	if (conf.hugepages)
+		chunk = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+	if (chunk == MAP_FAILED) {
+		/* no reserved huge pages, fallback to transparent huge pages if requested */
+		chunk = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (chunk == MAP_FAILED)
+			err(1, "arena: could not map %zu bytes", size);
+#ifdef MADV_HUGEPAGE
+		if (conf.hugepages)
+			madvise(chunk, size, MADV_HUGEPAGE);
+#endif
+	}
+	chunk->size = size - sizeof(struct arena_chunk);
+	chunk->used = 0;
+
+	return chunk;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+
+	size = (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+	if (!arena->chunk || arena->chunk->used + size > arena->chunk->size) {
+		chunk = arena_chunk_new(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+		chunk->prev = arena->chunk;
+		arena->chunk = chunk;
+		arena->chunk_count++;
+	}
+	chunk = arena->chunk;
+	arena->last = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return arena->last;
+}
+
+void *
+arena_alloc_zero(struct arena *arena, size_t size)
+{
+	void *p = arena_alloc(arena, size);
+
+	bzero(p, size);
+	return p;
+}
+
+/* gives back the memory of 'p' if it is the last allocation, for records that end up being ignored */
+void
+arena_pop(struct arena *arena, void *p)
+{
+	if (p != arena->last)
+		return;
+	arena->chunk->used = (char *)p - arena->chunk->data;
+	arena->last = NULL;
+}
+
+/* moves all chunks of 'src' to 'dst' */
+void
+arena_merge(struct arena *dst, struct arena *src)
+{
+	struct arena_chunk *chunk;
+
+	if (!src->chunk)
+		return;
+	for (chunk = src->chunk; chunk->prev; chunk = chunk->prev);
+	chunk->prev = dst->chunk;
+	dst->chunk = src->chunk;
+	dst->chunk_count += src->chunk_count;
+	dst->last = NULL;
+	bzero(src, sizeof(struct arena));
+}
+
+/* adds the used part of all chunks to snapshot 'snap' */
+void
+arena_snapshot(struct snap *snap, struct arena *arena)
+{
+	struct arena_chunk *chunk;
+
+	for (chunk = arena->chunk; chunk; chunk = chunk->prev)
+		snap_region(snap, chunk->data, chunk->used);
+	snap_zero(snap, arena, sizeof(struct arena));
+}
+
+void
+arena_free(struct arena *arena)
+{
+	struct arena_chunk *chunk, *prev;
+
+	for (chunk = arena->chunk; chunk; chunk = prev) {
+		prev = chunk->prev;
+		munmap(chunk, chunk->size + sizeof(struct arena_chunk));
+	}
+	bzero(arena, sizeof(struct arena));
+}
+
+#define IDX_ALLOC_MIN 1024
+#define IDX_SLOT(idx, id) (((uint32_t)(id) * 0x9E3779B1u) >> (32 - (idx)->slots_bits))
+
+static void
+idx_rehash(struct idx *idx, int bits)
+{
+	uint32_t mask = (1u << bits) - 1;
+	uint32_t h;
+	int n;
+
+	free(idx->slots);
+	idx->slots = calloc((size_t)1 << bits, sizeof(struct idx_slot));
+	if (!idx->slots)
+		err(1, "calloc");
+	idx->slots_bits = bits;
+	for (n=0; n<idx->count; n++) {
+		h = IDX_SLOT(idx, idx->ids[n]);
+		while (idx->slots[h].pos)
+			h = (h + 1) & mask;
+		idx->slots[h].id = idx->ids[n];
+		idx->slots[h].pos = n + 1;
+	}
+}
+
+/* returns the position of 'id' in the dense arrays, or -1 if not found */
+int
+idx_pos(struct idx *idx, int id)
+{
+	uint32_t mask, h;
+
+	if (!idx->slots)
+		return -1;
+	mask = (1u << idx->slots_bits) - 1;
+	for (h = IDX_SLOT(idx, id); idx->slots[h].pos; h = (h + 1) & mask)
+		if (idx->slots[h].id == id)
+			return idx->slots[h].pos - 1;
+	return -1;
+}
+
+void *
+idx_get(struct idx *idx, int id)
+{
+	int pos = idx_pos(idx, id);
+
+	if (pos < 0)
+		return NULL;
+	return idx->items[pos];
+}
+
+/* appends 'item' with 'id', which must not already be present. returns its position */
+int
+idx_put(struct idx *idx, int id, void *item)
+{
+	uint32_t mask, h;
+
+	if (idx->count == idx->alloc) {
+		idx->alloc = idx->alloc ? idx->alloc * 2 : IDX_ALLOC_MIN;
+		idx->ids = realloc(idx->ids, idx->alloc * sizeof(int));
+		idx->items = realloc(idx->items, idx->alloc * sizeof(void *));
+		if (!idx->ids || !idx->items)
+			err(1, "realloc");
+	}
+	idx->ids[idx->count] = id;
+	idx->items[idx->count] = item;
+	idx->count++;
+
+	/* keep the hash table at most half full */
+	if (!idx->slots || idx->count * 2 > (1 << idx->slots_bits)) {
+		idx_rehash(idx, idx->slots ? idx->slots_bits + 1 : 11);
+		return idx->count - 1;
+	}
+	mask = (1u << idx->slots_bits) - 1;
+	for (h = IDX_SLOT(idx, id); idx->slots[h].pos; h = (h + 1) & mask);
+	idx->slots[h].id = id;
+	idx->slots[h].pos = idx->count;
+
+	return idx->count - 1;
+}
+
+struct idx_entry {
+	int id;
+	void *item;
+};
+
+static int
+idx_entry_cmp(const void *a, const void *b)
+{
+	const struct idx_entry *ea = a, *eb = b;
+
+	return (ea->id > eb->id) - (ea->id < eb->id);
+}
+
+/* sorts the dense arrays by id, so that iterating over items follows id order */
+void
+idx_sort(struct idx *idx)
+{
+	struct idx_entry *entries;
+	int n;
+
+	if (idx->count == 0)
+		return;
+	entries = malloc(idx->count * sizeof(struct idx_entry));
+	if (!entries)
+		err(1, "malloc");
+	for (n=0; n<idx->count; n++) {
+		entries[n].id = idx->ids[n];
+		entries[n].item = idx->items[n];
+	}
+	qsort(entries, idx->count, sizeof(struct idx_entry), idx_entry_cmp);
+	for (n=0; n<idx->count; n++) {
+		idx->ids[n] = entries[n].id;
+		idx->items[n] = entries[n].item;
+	}
+	free(entries);
+	idx_rehash(idx, idx->slots_bits);
+}
+
+void
+idx_free(struct idx *idx)
+{
+	free(idx->ids);
+	free(idx->items);
+	free(idx->slots);
+	bzero(idx, sizeof(struct idx));
+}
+
+static uint32_t
+geo_cell(float lat, float lon)
+{
+	int row, col;
+
+	row = (lat + 90) * GEO_CELLS_PER_DEG;
+	col = (lon + 180) * GEO_CELLS_PER_DEG;
+	row = row < 0 ? 0 : row >= 180 * GEO_CELLS_PER_DEG ? 180 * GEO_CELLS_PER_DEG - 1 : row;
+	col = col < 0 ? 0 : col >= GEO_COLS ? GEO_COLS - 1 : col;
+	return (uint32_t)row * GEO_COLS + col;
+}
+
+struct geo_entry {
+	uint32_t cell;
+	int item;
+};
+
+static int
+geo_entry_cmp(const void *a, const void *b)
+{
+	const struct geo_entry *ea = a, *eb = b;
+
+	if (ea->cell != eb->cell)
+		return ea->cell < eb->cell ? -1 : 1;
+	return (ea->item > eb->item) - (ea->item < eb->item);
+}
+
+/* indexes the 'count' points of coordinates 'lat' and 'lon' by their position */
+void
+geo_grid_build(struct geo_grid *grid, const float *lat, const float *lon, int count)
+{
+	struct geo_entry *entries;
+	int n;
+
+	entries = malloc((count + 1) * sizeof(struct geo_entry));
+	grid->cells = malloc((count + 1) * sizeof(uint32_t));
+	grid->items = malloc((count + 1) * sizeof(int));
+	grid->lat = malloc((count + 1) * sizeof(float));
+	grid->lon = malloc((count + 1) * sizeof(float));
+	if (!entries || !grid->cells || !grid->items || !grid->lat || !grid->lon)
+		err(1, "malloc");
+	for (n=0; n<count; n++) {
+		entries[n].cell = geo_cell(lat[n], lon[n]);
+		entries[n].item = n;
+	}
+	qsort(entries, count, sizeof(struct geo_entry), geo_entry_cmp);
+	for (n=0; n<count; n++) {
+		grid->cells[n] = entries[n].cell;
+		grid->items[n] = entries[n].item;
+		grid->lat[n] = lat[entries[n].item];
+		grid->lon[n] = lon[entries[n].item];
+	}
+	grid->count = count;
+	free(entries);
+}
+
+/* returns the position of the first point of 'grid' with a cell not lower than 'cell' */
+static int
+geo_grid_lower(struct geo_grid *grid, uint32_t cell)
+{
+	int lo = 0, hi = grid->count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (grid->cells[mid] < cell)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* stores in 'pos' the grid positions of the points inside the box, and returns their count */
+static int
+geo_grid_scan(struct geo_grid *grid, float lat_min, float lon_min, float lat_max, float lon_max, int *pos)
+{
+	uint32_t first, last, row;
+	int n, count = 0;
+
+	if (lat_min > lat_max || lon_min > lon_max)
+		return 0;
+	first = geo_cell(lat_min, lon_min);
+	last = geo_cell(lat_max, lon_max);
+	for (row = first / GEO_COLS; row <= last / GEO_COLS; row++) {
+		for (n = geo_grid_lower(grid, row * GEO_COLS + first % GEO_COLS);
+				n < grid->count && grid->cells[n] <= row * GEO_COLS + last % GEO_COLS; n++) {
+			if (grid->lat[n] >= lat_min && grid->lat[n] <= lat_max && grid->lon[n] >= lon_min && grid->lon[n] <= lon_max)
+				pos[count++] = n;
+		}
+	}
+	return count;
+}
+
+/* stores in 'items' the points inside the box, in grid order, and returns their count.
+ * 'items' must have room for all the points of the grid */
+int
+geo_grid_bbox(struct geo_grid *grid, float lat_min, float lon_min, float lat_max, float lon_max, int *items)
+{
+	int n, count;
+
+	count = geo_grid_scan(grid, lat_min, lon_min, lat_max, lon_max, items);
+	for (n=0; n<count; n++)
+		items[n] = grid->items[items[n]];
+	return count;
+}
+
+/* great circle distance in meters */
+double
+geo_distance(float lat1, float lon1, float lat2, float lon2)
+{
+	double dlat = (lat2 - lat1) * M_PI / 180, dlon = (lon2 - lon1) * M_PI / 180, a;
+
+	a = sin(dlat / 2) * sin(dlat / 2) + cos(lat1 * M_PI / 180) * cos(lat2 * M_PI / 180) * sin(dlon / 2) * sin(dlon / 2);
+	return 2 * GEO_EARTH_RADIUS * asin(sqrt(a < 1 ? a : 1));
+}
+
+struct geo_result {
+	int item;
+	double dist;
+};
+
+static int
+geo_result_cmp(const void *a, const void *b)
+{
+	const struct geo_result *ra = a, *rb = b;
+
+	if (ra->dist != rb->dist)
+		return ra->dist < rb->dist ? -1 : 1;
+	return (ra->item > rb->item) - (ra->item < rb->item);
+}
+
+/* returns in 'results' the points of the box containing the circle of 'radius' meters around 'lat' 'lon',
+ * sorted by distance, and their count. 'covered' is set when the box spans the whole grid.
+ * 'pos' is scratch space for all the points of the grid */
+static struct geo_result *
+geo_grid_around(struct geo_grid *grid, float lat, float lon, double radius, int *pos, int *count, int *covered)
+{
+	struct geo_result *results;
+	double dlat, dlon, c;
+	int n;
+
+	/* longitudes span most at the latitude of the box closest to a pole */
+	dlat = radius / GEO_EARTH_RADIUS * 180 / M_PI;
+	c = fabs(lat) + dlat < 90 ? cos((fabs(lat) + dlat) * M_PI / 180) : 0;
+	dlon = c * GEO_EARTH_RADIUS * M_PI > radius ? radius / (c * GEO_EARTH_RADIUS) * 180 / M_PI : 180;
+	*covered = lat - dlat <= -90 && lat + dlat >= 90 && dlon >= 180;
+	if (dlon >= 180)
+		*count = geo_grid_scan(grid, lat - dlat, -180, lat + dlat, 180, pos);
+	else {
+		/* a box crossing the antimeridian continues from the other side of the grid */
+		*count = geo_grid_scan(grid, lat - dlat, fmax(lon - dlon, -180), lat + dlat, fmin(lon + dlon, 180), pos);
+		if (lon - dlon < -180)
+			*count += geo_grid_scan(grid, lat - dlat, lon - dlon + 360, lat + dlat, 180, pos + *count);
+		if (lon + dlon > 180)
+			*count += geo_grid_scan(grid, lat - dlat, -180, lat + dlat, lon + dlon - 360, pos + *count);
+	}
+	results = malloc((*count + 1) * sizeof(struct geo_result));
+	if (!results)
+		err(1, "malloc");
+	for (n=0; n<*count; n++) {
+		results[n].item = grid->items[pos[n]];
+		results[n].dist = geo_distance(lat, lon, grid->lat[pos[n]], grid->lon[pos[n]]);
+	}
+	qsort(results, *count, sizeof(struct geo_result), geo_result_cmp);
+	return results;
+}
+
+/* stores in 'items' the points within 'radius' meters of 'lat' 'lon' and in 'dists' their distance, sorted by distance.
+ * returns their count. 'items' and 'dists' must have room for all the points of the grid */
+int
+geo_grid_near(struct geo_grid *grid, float lat, float lon, double radius, int *items, double *dists)
+{
+	struct geo_result *results;
+	int n, count, covered;
+
+	results = geo_grid_around(grid, lat, lon, radius, items, &count, &covered);
+	for (n=0; n<count && results[n].dist <= radius; n++) {
+		items[n] = results[n].item;
+		dists[n] = results[n].dist;
+	}
+	free(results);
+	return n;
+}
+
+/* stores in 'items' the 'k' points nearest to 'lat' 'lon' and in 'dists' their distance, sorted by distance.
+ * the search radius is doubled until it contains 'k' points. returns their count, lower than 'k' for a smaller grid.
+ * 'items' and 'dists' must have room for all the points of the grid */
+int
+geo_grid_knn(struct geo_grid *grid, float lat, float lon, int k, int *items, double *dists)
+{
+	struct geo_result *results;
+	double radius;
+	int n, count, inside, covered;
+
+	if (k > grid->count)
+		k = grid->count;
+	for (radius=1000; ; radius*=2) {
+		results = geo_grid_around(grid, lat, lon, radius, items, &count, &covered);
+		for (inside=0; inside<count && results[inside].dist <= radius; inside++)
+			;
+		if (inside >= k || covered)
+			break;
+		free(results);
+	}
+	for (n=0; n<k && n<count; n++) {
+		items[n] = results[n].item;
+		dists[n] = results[n].dist;
+	}
+	free(results);
+	return n;
+}
+
+void
+geo_grid_free(struct geo_grid *grid)
+{
+	free(grid->cells);
+	free(grid->items);
+	free(grid->lat);
+	free(grid->lon);
+	bzero(grid, sizeof(struct geo_grid));
+}
+
+/* prepares 'bitmap' for positions lower than 'size' */
+void
+bitmap_init(struct bitmap *bitmap, int size)
+{
+	bitmap->chunk_count = (size >> BITMAP_CHUNK_BITS) + 1;
+	bitmap->chunks = xmalloc_zero(bitmap->chunk_count * sizeof(struct bitmap_chunk));
+}
+
+/* sets position 'pos'. positions of a chunk must be set in increasing order, setting the last one again does nothing */
+void
+bitmap_add(struct bitmap *bitmap, int pos)
+{
+	struct bitmap_chunk *chunk = &bitmap->chunks[pos >> BITMAP_CHUNK_BITS];
+	uint16_t low = pos & ((1 << BITMAP_CHUNK_BITS) - 1);
+	int n;
+
+	if (chunk->bits) {
+		if (!(chunk->bits[low / 64] & (1ULL << (low % 64)))) {
+			chunk->bits[low / 64] |= 1ULL << (low % 64);
+			chunk->count++;
+		}
+		return;
+	}
+	if (chunk->count > 0 && chunk->array[chunk->count - 1] == low)
+		return;
+	if (chunk->count == BITMAP_ARRAY_MAX) {
+		chunk->bits = xmalloc_zero(BITMAP_CHUNK_WORDS * sizeof(uint64_t));
+		for (n=0; n<chunk->count; n++)
+			chunk->bits[chunk->array[n] / 64] |= 1ULL << (chunk->array[n] % 64);
+		chunk->bits[low / 64] |= 1ULL << (low % 64);
+		chunk->count++;
+		free(chunk->array);
+		chunk->array = NULL;
+		chunk->alloc = 0;
+		return;
+	}
+	if (chunk->count == chunk->alloc) {
+		chunk->alloc = chunk->alloc ? chunk->alloc * 2 : 16;
+		chunk->array = realloc(chunk->array, chunk->alloc * sizeof(uint16_t));
+		if (!chunk->array)
+			err(1, "realloc");
+	}
+	chunk->array[chunk->count++] = low;
+}
+
+/* sets the positions of 'bitmap' in the uncompressed bitmap 'words' */
+void
+bitmap_or_words(struct bitmap *bitmap, uint64_t *words)
+{
+	struct bitmap_chunk *chunk;
+	uint64_t *dst;
+	int c, n;
+
+	for (c=0; c<bitmap->chunk_count; c++) {
+		chunk = &bitmap->chunks[c];
+		dst = words + c * BITMAP_CHUNK_WORDS;
+		if (chunk->bits) {
+			for (n=0; n<BITMAP_CHUNK_WORDS; n++)
+				dst[n] |= chunk->bits[n];
+		} else {
+			for (n=0; n<chunk->count; n++)
+				dst[chunk->array[n] / 64] |= 1ULL << (chunk->array[n] % 64);
+		}
+	}
+}
+
+int
+bitmap_count(struct bitmap *bitmap)
+{
+	int c, count = 0;
+
+	for (c=0; c<bitmap->chunk_count; c++)
+		count += bitmap->chunks[c].count;
+	return count;
+}
+
+void
+bitmap_free(struct bitmap *bitmap)
+{
+	int c;
+
+	for (c=0; c<bitmap->chunk_count; c++) {
+		free(bitmap->chunks[c].array);
+		free(bitmap->chunks[c].bits);
+	}
+	free(bitmap->chunks);
+	bzero(bitmap, sizeof(struct bitmap));
+}
+
+#define CSR_SLICE(csr, n) ((void ***)((char *)(csr)->links[n].parent + slice_off))
+#define CSR_COUNT(csr, n) ((int *)((char *)(csr)->links[n].parent + count_off))
+
+/* records a link from 'parent' to 'child', see csr_build() */
+void
+csr_link(struct csr *csr, void *parent, void *child)
+{
+	if (csr->count == csr->links_alloc) {
+		csr->links_alloc = csr->links_alloc ? csr->links_alloc * 2 : 4096;
+		csr->links = realloc(csr->links, csr->links_alloc * sizeof(struct csr_link));
+		if (!csr->links)
+			err(1, "realloc");
+	}
+	csr->links[csr->count].parent = parent;
+	csr->links[csr->count].child = child;
+	csr->count++;
+}
+
+/* stores the children of all linked parents contiguously, and points the slice of each parent
+ * (a pointer to pointers at 'slice_off' and an int count at 'count_off') into that array */
+void
+csr_build(struct csr *csr, size_t slice_off, size_t count_off)
+{
+	void ***slice;
+	int *count;
+	int n, used;
+
+	if (csr->count == 0)
+		return;
+	csr->children = malloc(csr->count * sizeof(void *));
+	if (!csr->children)
+		err(1, "malloc");
+	for (n=0; n<csr->count; n++) {
+		*CSR_SLICE(csr, n) = NULL;
+		*CSR_COUNT(csr, n) = 0;
+	}
+	for (n=0; n<csr->count; n++)
+		(*CSR_COUNT(csr, n))++;
+	/* slices are allocated in order of first link, then filled in link order */
+	for (n=0, used=0; n<csr->count; n++) {
+		slice = CSR_SLICE(csr, n);
+		count = CSR_COUNT(csr, n);
+		if (!*slice) {
+			*slice = csr->children + used;
+			used += *count;
+			*count = 0;
+		}
+		(*slice)[(*count)++] = csr->links[n].child;
+	}
+	free(csr->links);
+	csr->links = NULL;
+	csr->links_alloc = 0;
+}
 
-#include "utils.h"
+void
+csr_free(struct csr *csr)
+{
+	free(csr->links);
+	free(csr->children);
+	bzero(csr, sizeof(struct csr));
+}
 
-/* KML colors : AABBGGRR */
-#define KML_HEADER \
-	"<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n" \
-	"<kml xmlns=\"http://www.opengis.net/kml/2.2\" xmlns:gx=\"http://www.google.com/kml/ext/2.2\">\n" \
-	"<Folder id=\"%s\">\n" \
-	"\t<name>%s</name>\n" \
-	"\t<Snippet>%s</Snippet>\n" \
-	"\t<description>Generated by https://github.com/looran/antennes on %s</description>\n" \
-	"\t<Style id=\"blue\">\n" \
-	"\t\t<IconStyle><color>ffff0000</color></IconStyle>\n" \
-	"\t</Style>\n" \
-	"\t<Style id=\"orange\">\n" \
-	"\t\t<IconStyle><color>ff0088ff</color></IconStyle>\n" \
-	"\t</Style>\n" \
-	"\t<Style id=\"red\">\n" \
-	"\t\t<IconStyle><color>ff0000ff</color></IconStyle>\n" \
-	"\t</Style>\n"
+/* serializes insertions in all dictionaries, which are rare */
+static pthread_mutex_t dict_lock = PTHREAD_MUTEX_INITIALIZER;
 
-#define KML_DOC_START \
-	"\t<Document id=\"%d\">\n" \
-	"\t\t<name>%s</name>\n"
-
-#define KML_PLACEMARK_POINT \
-	"\t\t<Placemark id=\"%d\">\n" \
-	"\t\t\t<name>%s</name>\n" \
-	"\t\t\t<description><![CDATA[%s]]></description>\n" \
-	"%s" \
-	"\t\t\t<TimeSpan id=\"ts%d\">\n" \
-	"\t\t\t  <begin>%s</begin>\n" \
-	"\t\t\t</TimeSpan>\n" \
-	"\t\t\t<Point>\n" \
-	"\t\t\t\t<altitudeMode>%s</altitudeMode>\n" \
-	"\t\t\t\t<coordinates>%f,%f,%f</coordinates>\n" \
-	"\t\t\t</Point>\n" \
-	"\t\t</Placemark>\n"
-
-#define KML_PLACEMARK_POINT_STYLE \
-	"\t\t\t<styleUrl>#%s</styleUrl>\n"
+/* returns the slot of 'label' in 'dict', or the empty slot where it would be inserted */
+static int
+dict_slot(struct dict *dict, const char *label, uint32_t hash)
+{
+	int s, code;
 
-#define KML_DOC_END \
-	"\t</Document>\n"
+	for (s = hash & (DICT_SLOTS - 1); ; s = (s + 1) & (DICT_SLOTS - 1)) {
+		code = __atomic_load_n(&dict->slots[s], __ATOMIC_ACQUIRE) - 1;
+		if (code < 0 || (dict->hashes[code] == hash && !strcmp(dict->labels[code], label)))
+			return s;
+	}
+}
 
-#define KML_FOOTER \
-	"</Folder>\n" \
-	"</kml>\n"
+/* returns the code of 'label' in 'dict', inserting it if it is new */
+int
+dict_code(struct dict *dict, const char *label)
+{
+	const unsigned char *p;
+	uint32_t hash = 2166136261u; /* FNV-1a */
+	int s, code;
+
+	for (p = (const unsigned char *)label; *p; p++)
+		hash = (hash ^ *p) * 16777619u;
+	s = dict_slot(dict, label, hash);
+	code = __atomic_load_n(&dict->slots[s], __ATOMIC_ACQUIRE) - 1;
+	if (code >= 0)
+		return code;
+
+	pthread_mutex_lock(&dict_lock);
+	s = dict_slot(dict, label, hash); /* inserted by another thread meanwhile */
+	code = dict->slots[s] - 1;
+	if (code < 0) {
+		code = dict->count;
+		if (code == DICT_MAX)
+			errx(1, "exceeded dictionary size %d when adding '%s'", DICT_MAX, label);
+		dict->labels[code] = label;
+		dict->hashes[code] = hash;
+		__atomic_store_n(&dict->count, code + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&dict->slots[s], code + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&dict_lock);
 
-extern struct conf conf;
+	return code;
+}
 
-void
-csv_open(struct csv *csv, char *path, int conv, char sep, char quote)
+const char *
+dict_label(struct dict *dict, int code)
 {
-	int f;
-	struct stat fstat;
-	char *ptr;
+	return dict->labels[code];
+}
 
-	if (stat(path, &fstat) == -1)
-		errx(1, "could not find csv: %s", path);
-	f = open(path, O_RDONLY);
-	if (!f)
-		errx(1, "could not open csv: %s", path);
-	ptr = mmap(0, fstat.st_size, PROT_READ, MAP_PRIVATE, f, 0);
-	if (!ptr)
-		errx(1, "could not mmap csv: %s", path);
-	csv->file = malloc(fstat.st_size+1);
-	memcpy(csv->file, ptr, fstat.st_size);
-	munmap(ptr, fstat.st_size);
-	csv->file[fstat.st_size] = '\0';
-	csv->size = fstat.st_size;
-	csv->p = csv->file;
-	csv->conv = conv;
-	csv->sep[0] = sep;
-	csv->sep[1] = '\0';
-	csv->quote[0] = quote;
-	csv->quote[1] = '\0';
+/* adds the labels of 'dict' to snapshot 'snap', the dictionary being part of a region of the caller */
+void
+dict_snapshot(struct snap *snap, struct dict *dict)
+{
+	snap_ptrs(snap, dict->labels, dict->count);
 }
 
+/* adds the children array to snapshot 'snap', the slices of parents must be added by the caller */
 void
-csv_close(struct csv *csv)
+csr_snapshot(struct snap *snap, struct csr *csr)
 {
-	free(csv->file);
+	snap_region(snap, csr->children, csr->count * sizeof(void *));
+	snap_ptr(snap, &csr->children);
+	snap_ptrs(snap, csr->children, csr->count);
 }
 
-int
-csv_line(struct csv *csv)
+/* adds the grid arrays to snapshot 'snap' */
+void
+geo_grid_snapshot(struct snap *snap, struct geo_grid *grid)
 {
-	csv->line = strsep(&csv->p, "\n");
-	if (!csv->line || csv->line[0] == '\0')
-		return 0;
-	if (csv->p && *(csv->p-2) == '\r')
-		*(csv->p-2) = '\0'; /* remove \r */
-	csv->line_count++;
-	csv->field_count = 0;
-	return 1;
+	snap_data(snap, grid->cells, (grid->count + 1) * sizeof(uint32_t));
+	snap_data(snap, grid->items, (grid->count + 1) * sizeof(int));
+	snap_data(snap, grid->lat, (grid->count + 1) * sizeof(float));
+	snap_data(snap, grid->lon, (grid->count + 1) * sizeof(float));
+	snap_ptr(snap, &grid->cells);
+	snap_ptr(snap, &grid->items);
+	snap_ptr(snap, &grid->lat);
+	snap_ptr(snap, &grid->lon);
 }
 
-char *
-csv_field(struct csv *csv)
+/* adds the chunks of 'bitmap' to snapshot 'snap', the bitmap being part of a region of the caller */
+void
+bitmap_snapshot(struct snap *snap, struct bitmap *bitmap)
 {
-	char *tok;
-
-	csv->field_count++;
-	if (csv->quote[0] && csv->line[0] == csv->quote[0]) {
-		/* handle quoted field */
-		csv->line++;
-		tok = csv->line;
-		/* look for terminating quote, followed by separator or null byte */
-		do {
-			csv->line++;
-			csv->line = strchr(csv->line, csv->quote[0]);
-		} while (*(csv->line+1) != '\0' && *(csv->line+1) != csv->sep[0]);
-		*csv->line = '\0';
-		csv->line += 2; /* go to next field */
-	} else {
-		/* handle non-quoted field */
-		tok = strsep(&csv->line, csv->sep);
-		if (!tok)
-			tok = ""; /* in case the field is not found (old csv format), set it to an empty string */
+	struct bitmap_chunk *chunk;
+	int c;
+
+	snap_region(snap, bitmap->chunks, bitmap->chunk_count * sizeof(struct bitmap_chunk));
+	snap_ptr(snap, &bitmap->chunks);
+	for (c=0; c<bitmap->chunk_count; c++) {
+		chunk = &bitmap->chunks[c];
+		if (chunk->array)
+			snap_data(snap, chunk->array, chunk->alloc * sizeof(uint16_t));
+		if (chunk->bits)
+			snap_data(snap, chunk->bits, BITMAP_CHUNK_WORDS * sizeof(uint64_t));
+		snap_ptr(snap, &chunk->array);
+		snap_ptr(snap, &chunk->bits);
 	}
-	return tok;
 }
 
+/* adds the index arrays to snapshot 'snap', items must be added by the caller */
 void
-csv_int(struct csv *csv, int *val, char **orig)
+idx_snapshot(struct snap *snap, struct idx *idx)
 {
-	char *tok = csv_field(csv);
+	snap_data(snap, idx->ids, idx->count * sizeof(int));
+	snap_region(snap, idx->items, idx->count * sizeof(void *));
+	if (idx->slots)
+		snap_data(snap, idx->slots, ((size_t)1 << idx->slots_bits) * sizeof(struct idx_slot));
+	snap_ptr(snap, &idx->ids);
+	snap_ptr(snap, &idx->items);
+	snap_ptr(snap, &idx->slots);
+	snap_ptrs(snap, idx->items, idx->count);
+}
 
-	if (tok) {
-		if (orig)
-			*orig = tok;
-		if (val)
-			*val = atoi_fast(tok);
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0 /* the address is only a hint, checked after mmap() */
+#endif
+#define SNAP_MAGIC "ANTSNAP\0"
+#define SNAP_HEADER_SIZE 4096
+#define SNAP_REGION_ALIGN 64
+
+struct snap_header {
+	char magic[8];
+	uint64_t layout; /* key of the records layout, see snap_layout() */
+	uint64_t base;
+	uint64_t size; /* file size */
+	uint64_t root; /* offset of the root record */
+	uint64_t relocs; /* offset of the relocations bitmap, which covers the file up to this offset */
+};
+
+static int
+snap_region_cmp(const void *a, const void *b)
+{
+	const struct snap_region *ra = a, *rb = b;
+
+	return (ra->addr > rb->addr) - (ra->addr < rb->addr);
+}
+
+/* returns the region containing 'addr', or NULL */
+static struct snap_region *
+snap_lookup(struct snap *snap, const void *addr)
+{
+	const char *p = addr;
+	int lo = 0, hi = snap->count - 1, mid;
+
+	if (snap->hit && p >= snap->hit->addr && p < snap->hit->addr + snap->hit->size)
+		return snap->hit;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (p < snap->regions[mid].addr)
+			hi = mid - 1;
+		else if (p >= snap->regions[mid].addr + snap->regions[mid].size)
+			lo = mid + 1;
+		else {
+			snap->hit = &snap->regions[mid];
+			return snap->hit;
+		}
 	}
+	return NULL;
 }
 
-void
-csv_int16(struct csv *csv, uint32_t *val, char **orig)
+static struct snap_region *
+snap_find(struct snap *snap, const void *addr)
 {
-	char *tok = csv_field(csv);
+	struct snap_region *region = snap_lookup(snap, addr);
 
-	if (tok) {
-		if (orig)
-			*orig = tok;
-		if (val)
-			*val = atoi16_fast(tok);
+	if (!region)
+		errx(1, "snapshot: address %p is outside of all regions", addr);
+	return region;
+}
+
+static void
+snap_add(struct snap *snap, const void *addr, size_t size, int data)
+{
+	if (snap->pass != SNAP_REGIONS || size == 0)
+		return;
+	if (snap->count == snap->alloc) {
+		snap->alloc = snap->alloc ? snap->alloc * 2 : 256;
+		snap->regions = realloc(snap->regions, snap->alloc * sizeof(struct snap_region));
+		if (!snap->regions)
+			err(1, "realloc");
 	}
+	snap->regions[snap->count].addr = addr;
+	snap->regions[snap->count].size = size;
+	snap->regions[snap->count].data = data;
+	snap->count++;
 }
 
 void
-csv_float(struct csv *csv, double *val, char **orig)
+snap_region(struct snap *snap, const void *addr, size_t size)
 {
-	char *tok = csv_field(csv);
+	snap_add(snap, addr, size, 0);
+}
 
-	if (tok) {
-		if (orig)
-			*orig = tok;
-		if (val)
-			*val = atof_fast(tok);
+/* adds a region holding no pointers, such as text or numbers, which is not checked for missed pointers */
+void
+snap_data(struct snap *snap, const void *addr, size_t size)
+{
+	snap_add(snap, addr, size, 1);
+}
+
+/* returns the address of the first word of the image that still points to a region, or NULL.
+ * such a word is a pointer that was not given to snap_ptr() or snap_zero() */
+static const void *
+snap_missed(struct snap *snap)
+{
+	struct snap_region *region;
+	const char *lo, *hi;
+	uint64_t off, val;
+	int n;
+
+	lo = snap->regions[0].addr;
+	hi = snap->regions[snap->count-1].addr + snap->regions[snap->count-1].size;
+	for (n=0; n<snap->count; n++) {
+		region = &snap->regions[n];
+		if (region->data || (uintptr_t)region->addr % sizeof(uint64_t))
+			continue;
+		for (off=region->off; off + sizeof(uint64_t) <= region->off + region->size; off += sizeof(uint64_t)) {
+			if (snap->relocs[off / 512] & (1ULL << (off / 8 % 64)))
+				continue;
+			val = *(uint64_t *)(snap->map + off);
+			if (val >= (uintptr_t)lo && val < (uintptr_t)hi && snap_lookup(snap, (const void *)(uintptr_t)val))
+				return region->addr + (off - region->off);
+		}
 	}
+	return NULL;
 }
 
+/* stores the pointer at 'field' in the image, translated for the base address */
 void
-csv_str(struct csv *csv, char **s)
+snap_ptr(struct snap *snap, const void *field)
 {
-	char *tok = csv_field(csv);
-
-	if (tok) {
-		if (csv->conv == CSV_CONV_UTF8_TO_ISO8859)
-			utf8_to_iso8859(tok);
-		*s = tok;
+	const char *val = *(char * const *)field;
+	struct snap_region *region;
+	uint64_t off, *dst;
+
+	if (snap->pass != SNAP_POINTERS)
+		return;
+	region = snap_find(snap, field);
+	off = region->off + ((const char *)field - region->addr);
+	if (off % sizeof(uint64_t))
+		errx(1, "snapshot: unaligned pointer at %p", field);
+	dst = (uint64_t *)(snap->map + off);
+	if (!val) {
+		*dst = 0;
+		return;
 	}
+	region = snap_find(snap, val);
+	*dst = SNAP_BASE + region->off + (val - region->addr);
+	snap->relocs[off / 512] |= 1ULL << (off / 8 % 64);
 }
 
 void
-csv_date(struct csv *csv, struct tm *val, char **orig)
+snap_ptrs(struct snap *snap, const void *fields, int count)
 {
-	char *tok = csv_field(csv);
+	int n;
 
-	if (tok) {
-		if (orig)
-			*orig = tok;
-		if (val) {
-			bzero(val, sizeof(struct tm));
-			strptime(tok, "%d/%m/%Y", val);
+	for (n=0; n<count; n++)
+		snap_ptr(snap, (char * const *)fields + n);
+}
+
+/* clears bytes of the image, for state that is not valid in a snapshot */
+void
+snap_zero(struct snap *snap, const void *addr, size_t size)
+{
+	struct snap_region *region;
+
+	if (snap->pass != SNAP_POINTERS)
+		return;
+	region = snap_find(snap, addr);
+	bzero(snap->map + region->off + ((const char *)addr - region->addr), size);
+}
+
+/* records of this file saved in snapshots, as fields of the records of the callers */
+static const struct snap_field SNAP_UTILS_FIELDS[] = {
+	SNAP_STRUCT(struct csv),
+	SNAP_FIELD(struct csv, file),
+	SNAP_FIELD(struct csv, p),
+	SNAP_FIELD(struct csv, size),
+	SNAP_FIELD(struct csv, map_size),
+	SNAP_FIELD(struct csv, line),
+	SNAP_FIELD(struct csv, fields),
+	SNAP_FIELD(struct csv, fields_count),
+	SNAP_FIELD(struct csv, line_count),
+	SNAP_FIELD(struct csv, field_count),
+	SNAP_FIELD(struct csv, scan),
+	SNAP_FIELD(struct csv, scan_start),
+	SNAP_FIELD(struct csv, scan_end),
+	SNAP_FIELD(struct csv, conv),
+	SNAP_FIELD(struct csv, sep),
+	SNAP_FIELD(struct csv, quote),
+	SNAP_STRUCT(struct arena),
+	SNAP_FIELD(struct arena, chunk),
+	SNAP_FIELD(struct arena, last),
+	SNAP_FIELD(struct arena, chunk_count),
+	SNAP_STRUCT(struct arena_chunk),
+	SNAP_FIELD(struct arena_chunk, prev),
+	SNAP_FIELD(struct arena_chunk, size),
+	SNAP_FIELD(struct arena_chunk, used),
+	SNAP_STRUCT(struct idx),
+	SNAP_FIELD(struct idx, ids),
+	SNAP_FIELD(struct idx, items),
+	SNAP_FIELD(struct idx, count),
+	SNAP_FIELD(struct idx, alloc),
+	SNAP_FIELD(struct idx, slots),
+	SNAP_FIELD(struct idx, slots_bits),
+	SNAP_STRUCT(struct idx_slot),
+	SNAP_FIELD(struct idx_slot, id),
+	SNAP_FIELD(struct idx_slot, pos),
+	SNAP_STRUCT(struct csr),
+	SNAP_FIELD(struct csr, links),
+	SNAP_FIELD(struct csr, links_alloc),
+	SNAP_FIELD(struct csr, children),
+	SNAP_FIELD(struct csr, count),
+	SNAP_STRUCT(struct csr_link),
+	SNAP_FIELD(struct csr_link, parent),
+	SNAP_FIELD(struct csr_link, child),
+	SNAP_STRUCT(struct dict),
+	SNAP_FIELD(struct dict, labels),
+	SNAP_FIELD(struct dict, hashes),
+	SNAP_FIELD(struct dict, slots),
+	SNAP_FIELD(struct dict, count),
+	SNAP_STRUCT(struct geo_grid),
+	SNAP_FIELD(struct geo_grid, cells),
+	SNAP_FIELD(struct geo_grid, items),
+	SNAP_FIELD(struct geo_grid, lat),
+	SNAP_FIELD(struct geo_grid, lon),
+	SNAP_FIELD(struct geo_grid, count),
+	SNAP_STRUCT(struct bitmap),
+	SNAP_FIELD(struct bitmap, chunks),
+	SNAP_FIELD(struct bitmap, chunk_count),
+	SNAP_STRUCT(struct bitmap_chunk),
+	SNAP_FIELD(struct bitmap_chunk, count),
+	SNAP_FIELD(struct bitmap_chunk, alloc),
+	SNAP_FIELD(struct bitmap_chunk, array),
+	SNAP_FIELD(struct bitmap_chunk, bits),
+};
+
+/* returns the key of snapshots of records with the layout 'fields' of 'count' entries, and of the records of this file.
+ * 'version' changes the key when saved values change meaning without changing the layout */
+uint64_t
+snap_layout(int version, const struct snap_field *fields, int count)
+{
+	uint64_t fp = FINGERPRINT_INIT;
+	int n;
+
+	fp = fingerprint_int(fp, version);
+	for (n=0; n<(int)(sizeof(SNAP_UTILS_FIELDS) / sizeof(SNAP_UTILS_FIELDS[0])); n++) {
+		fp = fingerprint_int(fp, SNAP_UTILS_FIELDS[n].offset);
+		fp = fingerprint_int(fp, SNAP_UTILS_FIELDS[n].size);
+	}
+	for (n=0; n<count; n++) {
+		fp = fingerprint_int(fp, fields[n].offset);
+		fp = fingerprint_int(fp, fields[n].size);
+	}
+
+	return fp;
+}
+
+/* writes the snapshot of the records reachable from 'root' to 'path', through a temporary file renamed once complete.
+ * returns -1 with errno set on error */
+int
+snap_write(const char *path, uint64_t layout, void (*walk)(struct snap *, void *), void *root)
+{
+	struct snap snap;
+	struct snap_header *header;
+	char tmp[PATH_MAX];
+	size_t off, relocs_off, size;
+	const void *missed;
+	int f, n, count, error;
+
+	bzero(&snap, sizeof(snap));
+	snap.pass = SNAP_REGIONS;
+	walk(&snap, root);
+	qsort(snap.regions, snap.count, sizeof(struct snap_region), snap_region_cmp);
+	off = SNAP_HEADER_SIZE;
+	for (n=0, count=0; n<snap.count; n++) {
+		if (count > 0 && snap.regions[n].addr < snap.regions[count-1].addr + snap.regions[count-1].size) {
+			if (snap.regions[n].addr == snap.regions[count-1].addr && snap.regions[n].size == snap.regions[count-1].size)
+				continue; /* added twice */
+			errx(1, "snapshot: overlapping regions at %p", snap.regions[n].addr);
 		}
+		off = (off + SNAP_REGION_ALIGN - 1) & ~((size_t)SNAP_REGION_ALIGN - 1);
+		snap.regions[count] = snap.regions[n];
+		snap.regions[count].off = off;
+		off += snap.regions[count].size;
+		count++;
+	}
+	snap.count = count;
+	relocs_off = (off + SNAP_HEADER_SIZE - 1) & ~((size_t)SNAP_HEADER_SIZE - 1);
+	size = relocs_off + (relocs_off / 512 + 1) * sizeof(uint64_t);
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = open(tmp, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if (f == -1)
+		goto fail;
+	if (ftruncate(f, size) == -1)
+		goto fail_file;
+#ifdef __linux__
+	/* reserve the blocks, writing to the mapping of a full disk would raise SIGBUS */
+	if ((error = posix_fallocate(f, 0, size)) != 0) {
+		errno = error;
+		goto fail_file;
+	}
+#endif
+	snap.map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, f, 0);
+	if (snap.map == MAP_FAILED)
+		goto fail_file;
+	for (n=0; n<snap.count; n++)
+		memcpy(snap.map + snap.regions[n].off, snap.regions[n].addr, snap.regions[n].size);
+	snap.relocs = (uint64_t *)(snap.map + relocs_off);
+	snap.pass = SNAP_POINTERS;
+	walk(&snap, root);
+	if ((missed = snap_missed(&snap))) {
+		warnx_out("snapshot: pointer at %p is not translated", missed);
+		munmap(snap.map, size);
+		errno = EINVAL;
+		goto fail_file;
+	}
+
+	header = (struct snap_header *)snap.map;
+	memcpy(header->magic, SNAP_MAGIC, sizeof(header->magic));
+	header->layout = layout;
+	header->base = SNAP_BASE;
+	header->size = size;
+	header->root = snap_find(&snap, root)->off + ((char *)root - snap_find(&snap, root)->addr);
+	header->relocs = relocs_off;
+	munmap(snap.map, size);
+	close(f);
+	free(snap.regions);
+	if (rename(tmp, path) == -1) {
+		unlink(tmp);
+		return -1;
 	}
+	return 0;
+
+fail_file:
+	error = errno;
+	close(f);
+	unlink(tmp);
+	errno = error;
+fail:
+	free(snap.regions);
+	return -1;
 }
 
-struct kml *
-kml_open(const char *path, const char *name, const char *desc)
+/* maps the snapshot at 'path' and returns its root record, or NULL if it is missing or has a different layout.
+ * the mapping is shared and read-only at SNAP_BASE, or a relocated private copy if that address is not available */
+void *
+snap_load(const char *path, uint64_t layout, char **map, size_t *map_size)
 {
-	struct kml *kml = xmalloc_zero(sizeof(struct kml));
-	struct stat fstat;
-	char buf[1024];
-	int len;
+	struct snap_header header;
+	struct stat st;
+	uint64_t *relocs, word, delta;
+	char *ptr;
+	size_t w;
+	int f, b;
 
-	if (stat(path, &fstat) >= 0)
-		errx(1, "kml file already exists: %s", path);
-	verb("creating KML file %s\n", path);
-	kml->path = strdup(path);
-	kml->f = fopen(path, "w");
-	if (!kml->f)
-		errx(1, "could not create kml file %s\n", path);
-	len = snprintf(buf, sizeof(buf), KML_HEADER, name, name, desc, conf.now_str);
-	fwrite(buf, len, 1, kml->f);
+	f = open(path, O_RDONLY);
+	if (f == -1)
+		return NULL;
+	if (pread(f, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, SNAP_MAGIC, sizeof(header.magic))
+			|| header.layout != layout || header.base != SNAP_BASE || fstat(f, &st) == -1 || (uint64_t)st.st_size != header.size) {
+		close(f);
+		return NULL;
+	}
+	ptr = mmap((void *)SNAP_BASE, header.size, PROT_READ, MAP_SHARED|MAP_FIXED_NOREPLACE, f, 0);
+	if (ptr != MAP_FAILED && ptr != (char *)SNAP_BASE) {
+		munmap(ptr, header.size);
+		ptr = MAP_FAILED;
+	}
+	if (ptr == MAP_FAILED) {
+		/* base address not available, relocate pointers in a private copy */
+		ptr = mmap(NULL, header.size, PROT_READ|PROT_WRITE, MAP_PRIVATE, f, 0);
+		if (ptr == MAP_FAILED) {
+			close(f);
+			return NULL;
+		}
+		delta = (uint64_t)ptr - SNAP_BASE;
+		relocs = (uint64_t *)(ptr + header.relocs);
+		for (w=0; w < header.relocs / 512 + 1; w++) {
+			for (word = relocs[w]; word; word &= word - 1) {
+				b = __builtin_ctzll(word);
+				*(uint64_t *)(ptr + (w * 64 + b) * 8) += delta;
+			}
+		}
+		mprotect(ptr, header.size, PROT_READ);
+	}
+	close(f);
+	*map = ptr;
+	*map_size = header.size;
 
-	return kml;
+	return ptr + header.root;
 }
 
+struct tasks {
+	struct task *tasks;
+	int count;
+	int started;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static __thread struct task *task_current = NULL;
+
 void
-kml_close(struct kml *kml)
+task_dep(struct task *task, struct task *dep)
 {
-	struct kml_doc *doc;
-	char buf[1024];
-	int len, idx;
+	if (task->deps_count == TASK_DEPS_MAX)
+		errx(1, "task_dep: maximum dependencies count %d reached", TASK_DEPS_MAX);
+	task->deps[task->deps_count] = dep;
+	task->deps_count++;
+}
 
-	verb("closing kml file %s with %d docs\n", kml->path, kml->docs_count);
+static int
+task_ready(struct task *task)
+{
+	int n;
 
-	/* write KML documents */
-	for (idx=0; idx<kml->docs_count; idx++) {
-		doc = kml->docs[idx];
-		len = snprintf(buf, sizeof(buf), KML_DOC_START, doc->id, doc->name);
-		fwrite(buf, len, 1, kml->f);
-		fwrite(doc->placemarks, doc->placemarks_size, 1, kml->f);
-		fwrite(KML_DOC_END, sizeof(KML_DOC_END)-1, 1, kml->f);
-		free(doc->placemarks);
-		free(doc->name);
-		free(doc);
-	}
+	if (task->state != TASK_WAITING)
+		return 0;
+	for (n=0; n<task->deps_count; n++)
+		if (task->deps[n]->state != TASK_DONE)
+			return 0;
+	return 1;
+}
+
+static void
+task_exec(struct task *task)
+{
+	task->out = open_memstream(&task->out_buf, &task->out_len);
+	task->err = open_memstream(&task->err_buf, &task->err_len);
+	if (!task->out || !task->err)
+		err(1, "open_memstream");
+	task_current = task;
+	task->fn(task->arg);
+	task_current = NULL;
+	fclose(task->out);
+	fclose(task->err);
+}
 
-	fwrite(KML_FOOTER, sizeof(KML_FOOTER)-1, 1, kml->f);
+static void *
+tasks_worker(void *arg)
+{
+	struct tasks *tasks = arg;
+	struct task *task;
+	int n;
+
+	pthread_mutex_lock(&tasks->lock);
+	while (tasks->started < tasks->count) {
+		task = NULL;
+		for (n=0; n<tasks->count; n++) {
+			if (task_ready(&tasks->tasks[n])) {
+				task = &tasks->tasks[n];
+				break;
+			}
+		}
+		if (!task) {
+			pthread_cond_wait(&tasks->cond, &tasks->lock);
+			continue;
+		}
+		task->state = TASK_RUNNING;
+		tasks->started++;
+		pthread_mutex_unlock(&tasks->lock);
+		task_exec(task);
+		pthread_mutex_lock(&tasks->lock);
+		task->state = TASK_DONE;
+		pthread_cond_broadcast(&tasks->cond);
+	}
+	pthread_mutex_unlock(&tasks->lock);
 
-	fclose(kml->f);
-	free(kml->path);
-	free(kml);
+	return NULL;
 }
 
-#define DESCRIPTION_BUF_SIZE 131072
+/* runs 'count' tasks using 'jobs' threads, and prints their output in tasks order as soon as possible */
 void
-kml_add_placemark_point(struct kml *kml, int doc_id, const char *doc_name, int id, char *name, char *description, float lat, float lon, float haut, const char *haut_mode, const char *styleurl, const struct tm *ts_begin)
+tasks_run(struct task *list, int count, int jobs)
 {
-	char buf[DESCRIPTION_BUF_SIZE];
-	char buf2[256];
-	int len, idx;
-	struct kml_doc *doc;
-	char tsbuf[50];
-
-	/* get the document matching doc_id */
-	doc = NULL;
-	for (idx=0; idx<kml->docs_count; idx++) {
-		if (kml->docs[idx]->id == doc_id) {
-			doc = kml->docs[idx];
-			break;
+	struct tasks tasks;
+	pthread_t *threads;
+	int n;
+
+	if (jobs <= 1) {
+		for (n=0; n<count; n++) {
+			list[n].fn(list[n].arg);
+			list[n].state = TASK_DONE;
+			if (list[n].done)
+				list[n].done(list[n].arg);
 		}
+		return;
 	}
-	if (!doc) {
-		if (kml->docs_count == KML_DOC_MAX)
-		    errx(1, "kml reached maximum document count %d", KML_DOC_MAX);
-		doc = xmalloc_zero(sizeof(struct kml_doc));
-		doc->id = doc_id;
-		doc->name = strdup(doc_name);
-		kml->docs[kml->docs_count] = doc;
-		kml->docs_count++;
+
+	tasks.tasks = list;
+	tasks.count = count;
+	tasks.started = 0;
+	pthread_mutex_init(&tasks.lock, NULL);
+	pthread_cond_init(&tasks.cond, NULL);
+	if (jobs > count)
+		jobs = count;
+	threads = xmalloc_zero(jobs * sizeof(pthread_t));
+	for (n=0; n<jobs; n++)
+		if (pthread_create(&threads[n], NULL, tasks_worker, &tasks) != 0)
+			errx(1, "could not create thread");
+
+	/* flush tasks output and call their done function, in order */
+	for (n=0; n<count; n++) {
+		pthread_mutex_lock(&tasks.lock);
+		while (list[n].state != TASK_DONE)
+			pthread_cond_wait(&tasks.cond, &tasks.lock);
+		pthread_mutex_unlock(&tasks.lock);
+		fwrite(list[n].out_buf, list[n].out_len, 1, out_stdout());
+		fwrite(list[n].err_buf, list[n].err_len, 1, out_stderr());
+		free(list[n].out_buf);
+		free(list[n].err_buf);
+		if (list[n].done)
+			list[n].done(list[n].arg);
 	}
 
-	/* append to placemarks in this document */
-	if (ts_begin)
-		strftime(tsbuf, sizeof(tsbuf), "%Y-%m-%d", ts_begin);
-	else
-		tsbuf[0] = '\0';
-	if (styleurl)
-		snprintf(buf2, sizeof(buf2), KML_PLACEMARK_POINT_STYLE, styleurl);
-	len = snprintf(buf, sizeof(buf), KML_PLACEMARK_POINT, id, name, description, buf2, id, tsbuf, haut_mode, lon, lat, haut);
-	if (len >= sizeof(buf))
-		errx(1, "kml_add_placemark_point internal buffer limit reached (%d)", len);
-	doc->placemarks = realloc(doc->placemarks, doc->placemarks_size + len);
-	memcpy(doc->placemarks + doc->placemarks_size, buf, len);
-	doc->placemarks_size += len;
-	doc->placemarks_count++;
+	for (n=0; n<jobs; n++)
+		pthread_join(threads[n], NULL);
+	free(threads);
+	pthread_mutex_destroy(&tasks.lock);
+	pthread_cond_destroy(&tasks.cond);
+}
+
+struct parallel {
+	void (*fn)(void *, int);
+	void *arg;
+	int count;
+	int next;
+};
+
+static void *
+parallel_worker(void *arg)
+{
+	struct parallel *parallel = arg;
+	int n;
+
+	while ((n = __atomic_fetch_add(&parallel->next, 1, __ATOMIC_RELAXED)) < parallel->count)
+		parallel->fn(parallel->arg, n);
+
+	return NULL;
+}
+
+/* calls fn(arg, n) for n from 0 to 'count' - 1 using 'jobs' threads, including the calling thread.
+ * threads take the next index as soon as they are done with the previous one. */
+void
+parallel_for(int count, int jobs, void (*fn)(void *, int), void *arg)
+{
+	struct parallel parallel;
+	pthread_t *threads;
+	int n;
+
+	if (jobs > count)
+		jobs = count;
+	if (jobs <= 1) {
+		for (n=0; n<count; n++)
+			fn(arg, n);
+		return;
+	}
+
+	parallel.fn = fn;
+	parallel.arg = arg;
+	parallel.count = count;
+	parallel.next = 0;
+	threads = xmalloc_zero((jobs - 1) * sizeof(pthread_t));
+	for (n=0; n<jobs-1; n++)
+		if (pthread_create(&threads[n], NULL, parallel_worker, &parallel) != 0)
+			errx(1, "could not create thread");
+	parallel_worker(&parallel);
+	for (n=0; n<jobs-1; n++)
+		pthread_join(threads[n], NULL);
+	free(threads);
+}
+
+/* output of the main thread, captured to be stored along with a snapshot */
+static struct {
+	FILE *out;
+	char *out_buf;
+	size_t out_len;
+	FILE *err;
+	char *err_buf;
+	size_t err_len;
+} capture;
+
+/* returns the stream for regular output of the current thread */
+FILE *
+out_stdout(void)
+{
+	if (task_current)
+		return task_current->out;
+	if (capture.out)
+		return capture.out;
+	return stdout;
+}
+
+/* returns the stream for diagnostic output of the current thread */
+FILE *
+out_stderr(void)
+{
+	if (task_current)
+		return task_current->err;
+	if (capture.err)
+		return capture.err;
+	return stderr;
+}
+
+/* starts capturing the regular and error output of the main thread, including the output of the tasks it runs */
+void
+out_capture_begin(void)
+{
+	capture.out = open_memstream(&capture.out_buf, &capture.out_len);
+	capture.err = open_memstream(&capture.err_buf, &capture.err_len);
+	if (!capture.out || !capture.err)
+		err(1, "open_memstream");
+}
+
+/* stops capturing output, and returns it in buffers to be freed by the caller */
+void
+out_capture_end(char **out, size_t *out_len, char **err, size_t *err_len)
+{
+	fclose(capture.out);
+	fclose(capture.err);
+	capture.out = NULL;
+	capture.err = NULL;
+	*out = capture.out_buf;
+	*out_len = capture.out_len;
+	*err = capture.err_buf;
+	*err_len = capture.err_len;
+}
+
+/* same as warnx(), printed to out_stderr() */
+void
+warnx_out(const char *fmt, ...)
+{
+	FILE *f = out_stderr();
+	va_list ap;
+
+	fprintf(f, "%s: ", getprogname());
+	va_start(ap, fmt);
+	vfprintf(f, fmt, ap);
+	va_end(ap);
+	fputc('\n', f);
+}
+
+/* adds a string field to fingerprint 'fp', NULL being the same as an empty string */
+uint64_t
+fingerprint_str(uint64_t fp, const char *str)
+{
+	const unsigned char *p;
+
+	if (str)
+		for (p = (const unsigned char *)str; *p; p++)
+			fp = (fp ^ *p) * 1099511628211ULL;
+
+	return (fp ^ 0xff) * 1099511628211ULL;
+}
+
+/* adds an integer field to fingerprint 'fp' */
+uint64_t
+fingerprint_int(uint64_t fp, int64_t num)
+{
+	uint64_t bits = num;
+	int n;
+
+	for (n=0; n<8; n++, bits >>= 8)
+		fp = (fp ^ (bits & 0xff)) * 1099511628211ULL;
+
+	return fp;
 }
 
 /* converts Degree Minute Seconds coordinates notation to Decimal Degree */
@@ -308,11 +2944,11 @@ coord_dms_to_dd(int lat_dms[3], char *lat_ns, int lon_dms[3], char *lon_ew, floa
 		*out_lon = - *out_lon;
 }
 
-/* makes a string usable as a path. returns a station copy. */
+/* makes a string usable as a path. returns a static copy, per thread. */
 const char *
 pathable(const char *s)
 {
-	static char buf[255];
+	static __thread char buf[255];
 	int len, i;
 
 	strncpy(buf, s, sizeof(buf)-1);
@@ -355,35 +2991,140 @@ xmalloc_zero(size_t size)
 	return p;
 }
 
-/* returns a positive value if 'a' is older than 'b', negative value if 'b' older than 'a' and 0 if 'a' equals 'b'.
- * the value is the number of days of difference. only year, month and day are compared */
-int
-tm_diff(struct tm *a, struct tm *b)
+/* returns the day number, from 1970-01-01, of a date of the gregorian calendar */
+int32_t
+day_from_date(int year, int month, int mday)
+{
+	int era, yoe, doy, doe;
+
+	year -= month <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + mday - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+/* returns the year, month and day of day number 'day' */
+void
+day_to_date(int32_t day, int *year, int *month, int *mday)
+{
+	int era, doe, yoe, doy, mp;
+
+	day += 719468;
+	era = (day >= 0 ? day : day - 146096) / 146097;
+	doe = day - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	*mday = doy - (153 * mp + 2) / 5 + 1;
+	*month = mp < 10 ? mp + 3 : mp - 9;
+	*year = yoe + era * 400 + (*month <= 2);
+}
+
+/* parses a dd/mm/yyyy date to a day number, or returns DAY_NONE if empty, invalid or followed by other characters */
+int32_t
+date_parse(const char *s)
+{
+	static const int month_days[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int val[3], n, digits, leap;
+
+	for (n=0; n<3; n++) {
+		val[n] = 0;
+		for (digits=0; *s >= '0' && *s <= '9'; s++, digits++)
+			val[n] = val[n] * 10 + (*s - '0');
+		if (digits == 0 || digits > (n < 2 ? 2 : 4))
+			return DAY_NONE;
+		if (n < 2 && *s++ != '/')
+			return DAY_NONE;
+	}
+	if (*s != '\0' || val[1] < 1 || val[1] > 12 || val[0] < 1 || val[0] > month_days[val[1] - 1])
+		return DAY_NONE;
+	leap = (val[2] % 4 == 0 && val[2] % 100 != 0) || val[2] % 400 == 0;
+	if (val[1] == 2 && val[0] == 29 && !leap)
+		return DAY_NONE;
+
+	return day_from_date(val[2], val[1], val[0]);
+}
+
+/* range_scan_*() set the bits of 'bitmap' for the rows from 'start' where lo <= max and hi >= min.
+ * 'start' is a multiple of 64, bitmap words are written whole. values are compared as signed integers */
+static int
+range_scan_generic(const uint64_t *lo, const uint64_t *hi, int start, int count, uint64_t min, uint64_t max, uint64_t *bitmap)
 {
-	int diff = 0;
+	int n, matches = 0;
+
+	for (n=start; n<count; n++) {
+		if (n % 64 == 0)
+			bitmap[n / 64] = 0;
+		if (lo[n] <= max && hi[n] >= min) {
+			bitmap[n / 64] |= 1ULL << (n % 64);
+			matches++;
+		}
+	}
+	return matches;
+}
 
-	diff += (a->tm_year - b->tm_year) * 365;
-	diff += (a->tm_mon - b->tm_mon) * 30;
-	diff += a->tm_mday - b->tm_mday;
+#ifdef __x86_64__
+__attribute__((target("avx2"))) static int
+range_scan_avx2(const uint64_t *lo, const uint64_t *hi, int count, uint64_t min, uint64_t max, uint64_t *bitmap)
+{
+	__m256i vmin = _mm256_set1_epi64x(min), vmax = _mm256_set1_epi64x(max);
+	__m256i out;
+	uint64_t word;
+	int n, b, matches = 0;
+
+	for (n=0; n+64<=count; n+=64) {
+		word = 0;
+		for (b=0; b<64; b+=4) {
+			out = _mm256_or_si256(_mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *)(lo + n + b)), vmax),
+				_mm256_cmpgt_epi64(vmin, _mm256_loadu_si256((const __m256i *)(hi + n + b))));
+			word |= (uint64_t)(~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xf) << b;
+		}
+		bitmap[n / 64] = word;
+		matches += __builtin_popcountll(word);
+	}
+	return matches + range_scan_generic(lo, hi, n, count, min, max, bitmap);
+}
+#endif
 
-	return diff;
+/* sets in 'bitmap' the bits of the rows of columns 'lo' and 'hi' where the range lo-hi overlaps min-max,
+ * and clears the others. 'bitmap' must have room for 'count' bits. returns the number of matching rows */
+int
+range_scan(const uint64_t *lo, const uint64_t *hi, int count, uint64_t min, uint64_t max, uint64_t *bitmap)
+{
+	if (min > INT64_MAX)
+		min = INT64_MAX;
+	if (max > INT64_MAX)
+		max = INT64_MAX;
+#ifdef __x86_64__
+	if (__builtin_cpu_supports("avx2"))
+		return range_scan_avx2(lo, hi, count, min, max, bitmap);
+#endif
+	return range_scan_generic(lo, hi, 0, count, min, max, bitmap);
 }
 
+/* fills 'ranked' with the positive counts of 'table' of 'size' entries, by decreasing count then increasing index,
+ * and returns the number of entries. 'ranked' must have room for 'size' entries */
 int
-next_smallest_positive_int(int *table, int size, int last, int last_index, int *next_index)
+histo_rank(const int *table, int size, struct histo_entry *ranked)
 {
-	int n, next = 0;
+	struct histo_entry entry;
+	int n, m, count = 0;
 
 	for (n=0; n<size; n++) {
-		if ( table[n] > 0
-				&& (!last || (table[n] < last || (table[n] == last && n > last_index)))
-				&& (table[n] > next) ) {
-			next = table[n];
-			*next_index = n;
-		}
+		if (table[n] <= 0)
+			continue;
+		entry.index = n;
+		entry.count = table[n];
+		for (m=count; m>0 && ranked[m-1].count < entry.count; m--)
+			ranked[m] = ranked[m-1];
+		ranked[m] = entry;
+		count++;
 	}
 
-	return next;
+	return count;
 }
 
 int
@@ -503,6 +3244,79 @@ itoa_i32(int32_t value, char *buffer)
 	return itoa_u32(u, buffer);
 }
 
+/* writes 'value' with 6 decimals, the same as printf("%f") */
+char *
+ftoa6(float value, char *buffer)
+{
+	uint32_t bits, mant, frac;
+	uint64_t num, rem, half;
+	int exp, n;
+
+	memcpy(&bits, &value, sizeof(bits));
+	exp = (bits >> 23) & 0xff;
+	mant = bits & 0x7fffff;
+	/* value is mant * 2^exp */
+	if (exp == 0) {
+		exp = -149;
+	} else {
+		mant |= 0x800000;
+		exp -= 150;
+	}
+	if (exp > 6) /* infinite, nan, or beyond 2^30 */
+		return buffer + sprintf(buffer, "%f", value);
+	if (bits >> 31)
+		*buffer++ = '-';
+
+	/* round value * 10^6 to the nearest integer, ties to even */
+	num = (uint64_t)mant * 1000000;
+	if (exp >= 0) {
+		num <<= exp;
+	} else if (exp > -63) {
+		rem = num & ((1ULL << -exp) - 1);
+		half = 1ULL << (-exp - 1);
+		num >>= -exp;
+		if (rem > half || (rem == half && (num & 1)))
+			num++;
+	} else {
+		num = 0;
+	}
+
+	buffer = itoa_u32(num / 1000000, buffer);
+	*buffer++ = '.';
+	frac = num % 1000000;
+	for (n=5; n>=0; n--) {
+		buffer[n] = '0' + frac % 10;
+		frac /= 10;
+	}
+
+	return buffer + 6;
+}
+
+/* writes day number 'day' as YYYY-MM-DD, or nothing for DAY_NONE */
+char *
+daytoa(int32_t day, char *buffer)
+{
+	int year, month, mday;
+
+	if (day == DAY_NONE)
+		return buffer;
+	day_to_date(day, &year, &month, &mday);
+	if (year < 1000 || year > 9999)
+		return buffer + sprintf(buffer, "%04d-%02d-%02d", year, month, mday);
+	buffer[0] = '0' + year / 1000;
+	buffer[1] = '0' + year / 100 % 10;
+	buffer[2] = '0' + year / 10 % 10;
+	buffer[3] = '0' + year % 10;
+	buffer[4] = '-';
+	buffer[5] = '0' + month / 10;
+	buffer[6] = '0' + month % 10;
+	buffer[7] = '-';
+	buffer[8] = '0' + mday / 10;
+	buffer[9] = '0' + mday % 10;
+
+	return buffer + 10;
+}
+
 void
 utf8_to_iso8859(char *s)
 {
@@ -1,22 +1,37 @@
 struct conf {
-	struct tm now;
-	char now_str[64];
+	int32_t now; /* today, see DAY_NONE */
+	char now_str[64]; /* date written in the kml files, empty when they are not dated */
 	int no_color;
 	int verbose;
 	int warn_incoherent_data;
+	int hugepages;
+	int jobs;
+	int snapshot;
+	int incremental;
+	int compress; /* KML_COMPRESS_* */
+	int tiles;
 };
 
+/* dates are stored as day numbers from 1970-01-01, DAY_NONE being older than any date */
+#define DAY_NONE (-0x40000000)
+
 #define CSV_NORMAL 0
 #define CSV_CONV_UTF8_TO_ISO8859 1
+#define CSV_FIELDS_MAX 64
+#define CSV_SCAN_SIZE 32
 struct csv {
-	char *file;
+	char *file; /* private writable mapping of the file, or a copy for non regular files */
 	char *p;
-	int size;
+	size_t size;
+	size_t map_size; /* 0 if 'file' is a heap copy */
 	char *line;
-	char *save_line;
-	char *save_field;
+	char *fields[CSV_FIELDS_MAX]; /* fields of the current line, filled by csv_line() */
+	int fields_count;
 	int line_count;
-	int field_count;
+	int field_count; /* index of the next field returned by csv_field() */
+	uint32_t (*scan)(const char *, char, char); /* block scanner, chosen at runtime */
+	char *scan_start; /* bytes that may be read by the block scanner, others being parsed by other threads */
+	char *scan_end;
 	int conv;
 	char sep[2];
 	char quote[2];
@@ -34,20 +49,262 @@ static const char *KML_STYLES[] = {
 };
 
 
-struct kml_doc {
-	int id;
-	char *name;
-	char *placemarks;
-	int placemarks_size;
-	int placemarks_count;
+/* kml files are written as a stream: documents are written one after the other, and placemarks to the current document.
+ * placemarks are referenced instead of copied, and written with writev() */
+#define KML_PLACEMARK_BUF_SIZE 131072
+#define KML_IOV_MAX 1024
+#define KML_TEXT_BUF_SIZE 65536
+
+/* SHA-256 of a stream of bytes */
+#define SHA256_LEN 32
+struct sha256 {
+	uint32_t h[8];
+	uint64_t len;
+	uint8_t block[64];
 };
-#define KML_DOC_MAX 200
 
-struct kml {
+/* digests of the files written to an output directory by the previous run, to keep the files that did not change.
+ * files are first written to a temporary file, then renamed over the previous file only if their digest differs */
+#define MANIFEST_FILE ".antennes_manifest"
+struct manifest_entry {
+	char *path; /* relative to the output directory */
+	uint8_t digest[SHA256_LEN];
+	int64_t size;
+	int written; /* by this run */
+};
+struct manifest {
+	char *dir;
+	struct manifest_entry *entries; /* loaded entries sorted by path, then the entries added by this run */
+	int count;
+	int alloc;
+	int loaded;
+	int unchanged;
+	int replaced;
+	int removed;
+};
+
+/* file written by a kml: the kml file itself, or one of its compressed copies */
+struct kml_file {
 	char *path;
-	FILE *f;
-	struct kml_doc *docs[KML_DOC_MAX];
+	char *tmp_path; /* file being written when the kml is in a manifest */
+	int fd;
+	struct sha256 sha; /* of the written data, when in a manifest */
+	int64_t size;
+};
+
+/* compressed copies of a kml file in gzip and kmz (zip) formats, written along with it when enabled in conf.compress.
+ * the kml text is cut in blocks of KML_DEFLATE_BLOCK bytes deflated on conf.jobs threads, each block using the end of
+ * the previous one as dictionary, and ending on a byte boundary so that the compressed blocks are concatenated */
+#define KML_COMPRESS_GZ 0x1
+#define KML_COMPRESS_KMZ 0x2
+#define KML_DEFLATE_BLOCK (1024 * 1024)
+#define KML_DEFLATE_DICT 32768
+struct kml_deflate_block {
+	unsigned char *in; /* KML_DEFLATE_DICT bytes of dictionary, then the block */
+	size_t dict_len;
+	size_t in_len;
+	unsigned char *out;
+	size_t out_len;
+	size_t out_alloc;
+	uint32_t crc;
+	int last;
+};
+struct kml_deflate {
+	struct kml_file *gz; /* NULL when not written */
+	struct kml_file *kmz;
+	struct manifest *manifest;
+	struct kml_deflate_block *blocks;
+	int block_count;
+	int filled; /* blocks filled, the last one possibly partially */
+	uint32_t crc;
+	uint64_t in_size;
+	uint64_t out_size;
+};
+
+struct kml {
+	struct kml_file file;
+	struct kml_deflate *deflate; /* NULL when not compressed */
+	struct manifest *manifest;
+	struct iovec iov[KML_IOV_MAX]; /* pending writes */
+	int iov_count;
+	char *text; /* copies of formatted headers, referenced by 'iov' */
+	size_t text_len;
 	int docs_count;
+	int doc_open;
+	int update_section; /* section being written in an update file */
+};
+
+/* area of a kml super-overlay tile, active while its projection on screen is between min_lod and max_lod pixels wide,
+ * max_lod -1 meaning no limit */
+struct kml_region {
+	double north;
+	double south;
+	double east;
+	double west;
+	int min_lod;
+	int max_lod;
+};
+
+/* fingerprint of the fields of a record, to compare records between data sets: 64-bit FNV-1a of the fields,
+ * each string followed by a terminating byte so that moving characters between fields changes the fingerprint */
+#define FINGERPRINT_INIT 14695981039346656037ULL
+
+/* index of records by integer id, sized to the loaded data instead of the largest id.
+ * records are stored in dense arrays in insertion order (or id order after idx_sort())
+ * and located by id through an open addressing hash table of positions. */
+struct idx_slot {
+	int id;
+	int pos; /* position in dense arrays + 1, 0 for an empty slot */
+};
+struct idx {
+	int *ids;
+	void **items;
+	int count;
+	int alloc;
+	struct idx_slot *slots;
+	int slots_bits;
+};
+
+/* spatial index of points in a grid of cells of 1/GEO_CELLS_PER_DEG degree. points are sorted by cell, and the points of
+ * a row of cells are located by binary search, so the index is no larger than the points themselves */
+#define GEO_CELLS_PER_DEG 16
+#define GEO_COLS (360 * GEO_CELLS_PER_DEG)
+#define GEO_EARTH_RADIUS 6371000.0 /* meters */
+struct geo_grid {
+	uint32_t *cells; /* cell of each point, sorted */
+	int *items; /* position given to geo_grid_build() of each point */
+	float *lat;
+	float *lon;
+	int count;
+};
+
+/* compressed bitmap of positions, split in chunks of 65536 positions stored as a sorted array of their low bits
+ * while sparse, and as a bitset past BITMAP_ARRAY_MAX positions (roaring bitmaps). chunks are allocated upfront
+ * for a number of positions, so that chunks of a bitmap can be filled by different threads */
+#define BITMAP_CHUNK_BITS 16
+#define BITMAP_CHUNK_WORDS ((1 << BITMAP_CHUNK_BITS) / 64)
+#define BITMAP_ARRAY_MAX 4096 /* as large as a bitset */
+struct bitmap_chunk {
+	int count;
+	int alloc;
+	uint16_t *array;
+	uint64_t *bits; /* BITMAP_CHUNK_WORDS, replaces 'array' when full */
+};
+struct bitmap {
+	struct bitmap_chunk *chunks;
+	int chunk_count;
+};
+
+/* compressed sparse rows: links from parents to children, stored as one contiguous array of children.
+ * links are added in any order, then csr_build() gives each parent a slice of the array holding its children
+ * in the order they were linked, through a pointer and a count field of the parent found at the given offsets. */
+struct csr_link {
+	void *parent;
+	void *child;
+};
+struct csr {
+	struct csr_link *links; /* until built */
+	int links_alloc;
+	void **children;
+	int count;
+};
+
+/* arena allocator: records are carved out of large chunks, which are all released at once.
+ * chunks are backed by huge pages when conf.hugepages is set. */
+struct arena_chunk {
+	struct arena_chunk *prev;
+	size_t size;
+	size_t used;
+	char data[];
+};
+struct arena {
+	struct arena_chunk *chunk; /* current chunk */
+	void *last; /* last allocation, can be given back with arena_pop() */
+	int chunk_count;
+};
+
+/* graph of tasks run by a pool of threads. the output of each task is buffered and printed in task order,
+ * so that it is the same as running the tasks sequentially. tasks must be given in a dependency order. */
+#define TASK_DEPS_MAX 4
+#define TASK_WAITING 0
+#define TASK_RUNNING 1
+#define TASK_DONE 2
+struct task {
+	void (*fn)(void *);
+	void *arg;
+	void (*done)(void *); /* optional, called with 'arg' by the thread running tasks_run(), in tasks order */
+	struct task *deps[TASK_DEPS_MAX];
+	int deps_count;
+	/* state */
+	int state;
+	FILE *out;
+	char *out_buf;
+	size_t out_len;
+	FILE *err;
+	char *err_buf;
+	size_t err_len;
+};
+
+/* snapshot: image of records spread over memory regions, written to a file with pointers stored for SNAP_BASE.
+ * the image is mapped read-only at SNAP_BASE, so that processes share it, or relocated if that address is in use.
+ * snapshots are written by calling a walk function twice: first to collect the regions, then to translate pointers.
+ * words of the regions that still point to a region once translated are reported, as a pointer the walk function missed */
+#define SNAP_BASE 0x3a0000000000ULL
+#define SNAP_REGIONS 0
+#define SNAP_POINTERS 1
+struct snap_region {
+	const char *addr;
+	size_t size;
+	size_t off; /* offset in the file */
+	int data; /* holds no pointers, see snap_data() */
+};
+/* layout of the records of a snapshot: the size of each record type followed by the offset and size of its fields,
+ * hashed by snap_layout() into the key of the snapshots, so that a snapshot written with another layout is ignored */
+struct snap_field {
+	size_t offset; /* SNAP_FIELD_STRUCT for the size of a record type */
+	size_t size;
+};
+#define SNAP_FIELD_STRUCT ((size_t)-1)
+#define SNAP_STRUCT(type) { SNAP_FIELD_STRUCT, sizeof(type) }
+#define SNAP_FIELD(type, field) { offsetof(type, field), sizeof(((type *)0)->field) }
+struct snap {
+	int pass;
+	struct snap_region *regions;
+	int count;
+	int alloc;
+	struct snap_region *hit; /* last region found, most lookups hit the same region */
+	char *map; /* file mapping while writing */
+	uint64_t *relocs; /* bitmap of the pointer words of the image */
+};
+
+/* dictionary of the distinct values of a low-cardinality column, coded from 0 by order of insertion.
+ * lookups of known values do not lock, so a dictionary can be filled from multiple threads.
+ * labels are not copied and must live as long as the dictionary */
+#define DICT_MAX 256
+#define DICT_SLOTS 512 /* power of 2, larger than DICT_MAX */
+struct dict {
+	const char *labels[DICT_MAX];
+	uint32_t hashes[DICT_MAX];
+	int16_t slots[DICT_SLOTS]; /* code + 1 of the label hashed to each slot, 0 when empty */
+	int count;
+};
+
+/* rows parsed by a worker thread from one chunk of lines of a csv file */
+struct csv_batch {
+	struct csv csv;
+	struct dict dict; /* values coded by the worker thread, for a column coded in file order once linked */
+	int16_t dict_codes[DICT_MAX]; /* code + 1 of each value of 'dict' in the dictionary of the file, 0 until linked */
+	struct arena arena; /* rows storage */
+	void **rows;
+	int *lines; /* line number of each row in the chunk */
+	int count;
+	int alloc;
+};
+
+/* entry of a ranked histogram, see histo_rank() */
+struct histo_entry {
+	int index;
+	int count;
 };
 
 /* csv */
@@ -55,27 +312,120 @@ void		 csv_open(struct csv *, char *, int, char, char);
 void		 csv_close(struct csv *);
 int		 csv_line(struct csv *);
 char		*csv_field(struct csv *);
+char		*csv_field_at(struct csv *, int);
+struct csv_batch *csv_batches(struct csv *, int *);
+void		 csv_batch_add(struct csv_batch *, void *);
+int		 csv_batch_code(struct csv_batch *, struct dict *, int);
+void		 csv_batches_free(struct csv_batch *, int, struct arena *);
 void		 csv_int(struct csv *, int *, char **);
 void		 csv_int16(struct csv *, uint32_t *, char **);
 void		 csv_float(struct csv *, double *, char **);
 void		 csv_str(struct csv *, char **);
-void		 csv_date(struct csv *, struct tm *, char **);
+void		 csv_date(struct csv *, int32_t *, char **);
+void		 csv_dict(struct csv *, struct dict *, uint8_t *);
 /* kml */
-struct kml	*kml_open(const char *, const char *, const char *);
+struct kml	*kml_open(const char *, const char *, const char *, struct manifest *);
 void		 kml_close(struct kml *);
-void		 kml_add_placemark_point(struct kml *, int, const char *, int, char *, char *, float, float, float, const char *, const char *, const struct tm *);
+int		 kml_placemark_point(char *, size_t, int, const char *, const struct iovec *, int, float, float, float, const char *, const char *, int32_t);
+void		 kml_doc_begin(struct kml *, const char *, const char *);
+void		 kml_doc_end(struct kml *);
+void		 kml_add_placemark(struct kml *, const char *, size_t);
+struct kml	*kml_update_open(const char *, const char *);
+void		 kml_update_close(struct kml *);
+void		 kml_update_delete(struct kml *, int);
+void		 kml_update_create(struct kml *, const char *);
+struct kml	*kml_tile_open(const char *, const char *, const char *, const struct kml_region *, struct manifest *);
+void		 kml_tile_close(struct kml *);
+void		 kml_tile_clusters_begin(struct kml *, const struct kml_region *);
+void		 kml_tile_clusters_end(struct kml *);
+void		 kml_tile_cluster(struct kml *, int, float, float);
+void		 kml_tile_link(struct kml *, const char *, const char *, const struct kml_region *);
+/* arena */
+void		*arena_alloc(struct arena *, size_t);
+void		*arena_alloc_zero(struct arena *, size_t);
+void		 arena_pop(struct arena *, void *);
+void		 arena_merge(struct arena *, struct arena *);
+void		 arena_free(struct arena *);
+/* idx */
+int		 dict_code(struct dict *, const char *);
+const char	*dict_label(struct dict *, int);
+void		*idx_get(struct idx *, int);
+int		 idx_pos(struct idx *, int);
+int		 idx_put(struct idx *, int, void *);
+void		 idx_sort(struct idx *);
+void		 idx_free(struct idx *);
+/* geo */
+void		 geo_grid_build(struct geo_grid *, const float *, const float *, int);
+int		 geo_grid_bbox(struct geo_grid *, float, float, float, float, int *);
+int		 geo_grid_near(struct geo_grid *, float, float, double, int *, double *);
+int		 geo_grid_knn(struct geo_grid *, float, float, int, int *, double *);
+void		 geo_grid_free(struct geo_grid *);
+double		 geo_distance(float, float, float, float);
+/* bitmap */
+void		 bitmap_init(struct bitmap *, int);
+void		 bitmap_add(struct bitmap *, int);
+void		 bitmap_or_words(struct bitmap *, uint64_t *);
+int		 bitmap_count(struct bitmap *);
+void		 bitmap_free(struct bitmap *);
+/* csr */
+void		 csr_link(struct csr *, void *, void *);
+void		 csr_build(struct csr *, size_t, size_t);
+void		 csr_free(struct csr *);
+/* snap */
+void		 snap_region(struct snap *, const void *, size_t);
+void		 snap_data(struct snap *, const void *, size_t);
+void		 snap_ptr(struct snap *, const void *);
+void		 snap_ptrs(struct snap *, const void *, int);
+void		 snap_zero(struct snap *, const void *, size_t);
+int		 snap_write(const char *, uint64_t, void (*)(struct snap *, void *), void *);
+void		*snap_load(const char *, uint64_t, char **, size_t *);
+uint64_t	 snap_layout(int, const struct snap_field *, int);
+void		 csv_snapshot(struct snap *, struct csv *);
+void		 arena_snapshot(struct snap *, struct arena *);
+void		 idx_snapshot(struct snap *, struct idx *);
+void		 dict_snapshot(struct snap *, struct dict *);
+void		 csr_snapshot(struct snap *, struct csr *);
+void		 geo_grid_snapshot(struct snap *, struct geo_grid *);
+void		 bitmap_snapshot(struct snap *, struct bitmap *);
+/* task */
+void		 task_dep(struct task *, struct task *);
+void		 tasks_run(struct task *, int, int);
+void		 parallel_for(int, int, void (*)(void *, int), void *);
+FILE		*out_stdout(void);
+FILE		*out_stderr(void);
+void		 out_capture_begin(void);
+void		 out_capture_end(char **, size_t *, char **, size_t *);
+void		 warnx_out(const char *, ...);
+/* manifest */
+struct manifest *manifest_load(const char *);
+void		 manifest_commit(struct manifest *, const char *, const char *, const uint8_t *, int64_t);
+void		 manifest_save(struct manifest *);
+void		 manifest_free(struct manifest *);
+/* sha256 */
+void		 sha256_init(struct sha256 *);
+void		 sha256_update(struct sha256 *, const void *, size_t);
+void		 sha256_final(struct sha256 *, uint8_t *);
+int		 sha256_file(const char *, uint8_t *);
+/* fingerprint */
+uint64_t	 fingerprint_str(uint64_t, const char *);
+uint64_t	 fingerprint_int(uint64_t, int64_t);
 /* utils */
 void		 coord_dms_to_dd(int [3], char *, int [3], char *, float *, float *);
 const char	*pathable(const char *);
 int	 	 append_not_empty(char *, char *);
 void		*xmalloc_zero(size_t);
-int		 tm_diff(struct tm *, struct tm *);
-int		 next_smallest_positive_int(int *, int, int, int, int *);
+int32_t		 day_from_date(int, int, int);
+void		 day_to_date(int32_t, int *, int *, int *);
+int32_t		 date_parse(const char *);
+int		 histo_rank(const int *, int, struct histo_entry *);
+int		 range_scan(const uint64_t *, const uint64_t *, int, uint64_t, uint64_t, uint64_t *);
 int		 atoi_fast(const char *);
 uint64_t	 atoi16_fast(const char *);
 double		 atof_fast(char *);
 char		*itoa_u32(uint32_t, char *);
 char		*itoa_i32(int32_t, char *);
+char		*ftoa6(float, char *);
+char		*daytoa(int32_t, char *);
 void		 utf8_to_iso8859(char *);
 void		 strreplace(char *, int, char, char);
 #define strbuf_chr(buf, chr) do { \
@@ -85,12 +435,19 @@ void		 strreplace(char *, int, char, char);
 } while (0)
 #define strbuf_str(buf, str) do { buf = stpcpy(buf, str); } while (0)
 #define strbuf_int(buf, num) do { buf = itoa_i32(num, buf); } while (0)
+#define strbuf_lit(buf, lit) do { \
+	memcpy(buf, lit, sizeof(lit) - 1); \
+	buf += sizeof(lit) - 1; \
+} while (0)
+#define strbuf_float6(buf, num) do { buf = ftoa6(num, buf); } while (0)
+#define strbuf_date(buf, day) do { buf = daytoa(day, buf); } while (0)
+#define msg(...) do { fprintf(out_stdout(), __VA_ARGS__); } while (0)
 #define verb(...) do { \
 	if (conf.verbose) \
-		fprintf(stderr, __VA_ARGS__); \
+		fprintf(out_stderr(), __VA_ARGS__); \
 } while (0)
-#define info(...) do { fprintf(stderr, __VA_ARGS__); } while (0)
+#define info(...) do { fprintf(out_stderr(), __VA_ARGS__); } while (0)
 #define warn_incoherent_data(...) do { \
-	conf.warn_incoherent_data += 1; \
-	warnx("incoherent data: " __VA_ARGS__); \
+	__atomic_add_fetch(&conf.warn_incoherent_data, 1, __ATOMIC_RELAXED); \
+	warnx_out("incoherent data: " __VA_ARGS__); \
 } while (0)